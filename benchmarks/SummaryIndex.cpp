@@ -0,0 +1,118 @@
+#include "benchmark/benchmark.h"
+#include "llvm/IR/ModuleSummaryIndex.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Transforms/IPO/FunctionImport.h"
+
+#include <random>
+#include <string>
+
+using namespace llvm;
+
+static const unsigned FunctionsPerModule = 256;
+static const unsigned VarsPerModule = 32;
+static const unsigned CallsPerFunction = 8;
+static const unsigned RefsPerFunction = 2;
+
+// Spread the GUIDs like MD5 hashes would, without hashing names.
+static GlobalValue::GUID getGUID(unsigned Module, unsigned Value) {
+  return ((uint64_t(Module) << 32) | Value) * 0x9E3779B97F4A7C15ULL;
+}
+
+// A combined index for NumModules modules. Every function calls functions
+// picked at random, a quarter of them in its own module, and references
+// global variables of its own module.
+static std::unique_ptr<ModuleSummaryIndex> buildIndex(unsigned NumModules) {
+  auto Index = std::make_unique<ModuleSummaryIndex>(/*HaveGVs=*/false);
+  std::mt19937 Rand(42);
+  for (unsigned M = 0; M != NumModules; ++M) {
+    StringRef Path = Index->addModule("m" + std::to_string(M), M)->first();
+    GlobalValueSummary::GVFlags Flags(GlobalValue::ExternalLinkage,
+                                      /*NotEligibleToImport=*/false,
+                                      /*Live=*/false, /*IsLocal=*/false,
+                                      /*CanAutoHide=*/false);
+    for (unsigned V = 0; V != VarsPerModule; ++V) {
+      auto GVS = std::make_unique<GlobalVarSummary>(
+          Flags, GlobalVarSummary::GVarFlags(false, false),
+          std::vector<ValueInfo>{});
+      GVS->setModulePath(Path);
+      Index->addGlobalValueSummary(
+          Index->getOrInsertValueInfo(getGUID(M, FunctionsPerModule + V)),
+          std::move(GVS));
+    }
+    for (unsigned F = 0; F != FunctionsPerModule; ++F) {
+      std::vector<ValueInfo> Refs;
+      for (unsigned R = 0; R != RefsPerFunction; ++R)
+        Refs.push_back(Index->getOrInsertValueInfo(
+            getGUID(M, FunctionsPerModule + Rand() % VarsPerModule)));
+      std::vector<FunctionSummary::EdgeTy> Calls;
+      for (unsigned C = 0; C != CallsPerFunction; ++C) {
+        unsigned Callee = C % 4 ? Rand() % NumModules : M;
+        Calls.push_back({Index->getOrInsertValueInfo(
+                             getGUID(Callee, Rand() % FunctionsPerModule)),
+                         CalleeInfo()});
+      }
+      auto FS = std::make_unique<FunctionSummary>(
+          Flags, /*NumInsts=*/Rand() % 100, FunctionSummary::FFlags{},
+          /*EntryCount=*/0, std::move(Refs), std::move(Calls),
+          std::vector<GlobalValue::GUID>{},
+          std::vector<FunctionSummary::VFuncId>{},
+          std::vector<FunctionSummary::VFuncId>{},
+          std::vector<FunctionSummary::ConstVCall>{},
+          std::vector<FunctionSummary::ConstVCall>{});
+      FS->setModulePath(Path);
+      Index->addGlobalValueSummary(
+          Index->getOrInsertValueInfo(getGUID(M, F)), std::move(FS));
+    }
+  }
+  return Index;
+}
+
+// Building the index, and the heap it takes up.
+static void BM_SummaryIndexBuild(benchmark::State &state) {
+  size_t HeapBytes = 0;
+  for (auto _ : state) {
+    size_t Before = sys::Process::GetMallocUsage();
+    auto Index = buildIndex(state.range(0));
+    HeapBytes = sys::Process::GetMallocUsage() - Before;
+    benchmark::DoNotOptimize(Index.get());
+  }
+  state.counters["HeapBytes"] = HeapBytes;
+  state.SetItemsProcessed(state.iterations() * state.range(0) *
+                          FunctionsPerModule);
+}
+BENCHMARK(BM_SummaryIndexBuild)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond);
+
+// The thin link proper: dead symbols, then the import and export lists.
+static void BM_SummaryIndexThinLink(benchmark::State &state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto Index = buildIndex(state.range(0));
+    DenseSet<GlobalValue::GUID> GUIDPreservedSymbols;
+    for (unsigned M = 0; M != state.range(0); ++M)
+      GUIDPreservedSymbols.insert(getGUID(M, 0));
+    state.ResumeTiming();
+
+    computeDeadSymbols(*Index, GUIDPreservedSymbols,
+                       [](GlobalValue::GUID) { return PrevailingType::Yes; });
+    StringMap<GVSummaryMapTy> ModuleToDefinedGVSummaries;
+    Index->collectDefinedGVSummariesPerModule(ModuleToDefinedGVSummaries);
+    StringMap<FunctionImporter::ImportMapTy> ImportLists;
+    StringMap<FunctionImporter::ExportSetTy> ExportLists;
+    ComputeCrossModuleImport(*Index, ModuleToDefinedGVSummaries, ImportLists,
+                             ExportLists);
+    benchmark::DoNotOptimize(ImportLists);
+
+    state.PauseTiming();
+    Index.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) *
+                          FunctionsPerModule);
+}
+BENCHMARK(BM_SummaryIndexThinLink)
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,36 @@
+#include "benchmark/benchmark.h"
+#include "llvm/Support/ThreadPool.h"
+
+#include <atomic>
+
+// Many tiny tasks submitted from outside the pool.
+static void BM_ThreadPoolExternalTasks(benchmark::State& state) {
+  llvm::ThreadPool Pool;
+  std::atomic<unsigned> Count{0};
+  for (auto _ : state) {
+    for (int64_t I = 0; I < state.range(0); ++I)
+      Pool.async([&Count] { ++Count; });
+    Pool.wait();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ThreadPoolExternalTasks)->Range(1 << 10, 1 << 16);
+
+// Tasks spawning tasks, which stay on the deque of the spawning thread.
+static void BM_ThreadPoolNestedTasks(benchmark::State& state) {
+  llvm::ThreadPool Pool;
+  std::atomic<unsigned> Count{0};
+  const int64_t Outer = 64;
+  for (auto _ : state) {
+    for (int64_t I = 0; I < Outer; ++I)
+      Pool.async([&Pool, &Count, &state] {
+        for (int64_t J = 0; J < state.range(0); ++J)
+          Pool.async([&Count] { ++Count; });
+      });
+    Pool.wait();
+  }
+  state.SetItemsProcessed(state.iterations() * Outer * state.range(0));
+}
+BENCHMARK(BM_ThreadPoolNestedTasks)->Range(1 << 6, 1 << 12);
+
+BENCHMARK_MAIN();
@@ -23,6 +23,7 @@
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/TinyPtrVector.h"
+#include "llvm/ADT/iterator.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Allocator.h"
@@ -31,11 +32,13 @@
 #include "llvm/Support/StringSaver.h"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <utility>
@@ -116,6 +119,13 @@ inline const char *getHotnessName(CalleeInfo::HotnessType HT) {
 }
 
 class GlobalValueSummary;
+class SummaryEdgeDecoder;
+
+/// The reference and call edges of a summary that were kept encoded when the
+/// summary was read, to be decoded by \p Decoder when they are first accessed.
+struct EncodedSummaryEdges {
+  SummaryEdgeDecoder *Decoder;
+};
 
 using GlobalValueSummaryList = std::vector<std::unique_ptr<GlobalValueSummary>>;
 
@@ -150,14 +160,102 @@ struct alignas(8) GlobalValueSummaryInfo {
   GlobalValueSummaryList SummaryList;
 };
 
-/// Map from global value GUID to corresponding summary structures. Use a
-/// std::map rather than a DenseMap so that pointers to the map's value_type
-/// (which are used by ValueInfo) are not invalidated by insertion. Also it will
-/// likely incur less overhead, as the value type is not very small and the size
-/// of the map is unknown, resulting in inefficiencies due to repeated
-/// insertions and resizing.
-using GlobalValueSummaryMapTy =
-    std::map<GlobalValue::GUID, GlobalValueSummaryInfo>;
+/// Map from global value GUID to corresponding summary structures.
+///
+/// The entries are allocated in an arena, so that pointers to the map's
+/// value_type (which are used by ValueInfo) are not invalidated by insertion,
+/// and are found through a hash table on their GUID. Iteration is in
+/// increasing GUID order, over a table of the entries that is sorted again by
+/// the first iteration after an insertion. That sort is synchronized, so any
+/// number of threads may iterate a map that is no longer being modified.
+/// Entries inserted while iterating may not be visited.
+class GlobalValueSummaryMapTy {
+public:
+  using key_type = GlobalValue::GUID;
+  using mapped_type = GlobalValueSummaryInfo;
+  using value_type = std::pair<const GlobalValue::GUID, GlobalValueSummaryInfo>;
+
+private:
+  SpecificBumpPtrAllocator<value_type> Alloc;
+  DenseMap<GlobalValue::GUID, value_type *> Entries;
+
+  /// All the entries. The first NumSorted are sorted by GUID, the rest were
+  /// inserted since.
+  mutable std::vector<value_type *> Order;
+  mutable std::atomic<size_t> NumSorted{0};
+
+  /// Merge the entries inserted since the last sort into the sorted prefix of
+  /// Order, under a lock shared by all maps.
+  void sortInserted() const;
+
+  void sortOrder() const {
+    if (NumSorted.load(std::memory_order_acquire) != Order.size())
+      sortInserted();
+  }
+
+  template <typename EntryT>
+  class iterator_impl
+      : public iterator_facade_base<iterator_impl<EntryT>,
+                                    std::forward_iterator_tag, EntryT> {
+    const GlobalValueSummaryMapTy *Map = nullptr;
+    size_t Pos = 0;
+
+  public:
+    iterator_impl() = default;
+    iterator_impl(const GlobalValueSummaryMapTy *Map, size_t Pos)
+        : Map(Map), Pos(Pos) {}
+
+    bool operator==(const iterator_impl &RHS) const {
+      return Map == RHS.Map && Pos == RHS.Pos;
+    }
+    EntryT &operator*() const { return *Map->Order[Pos]; }
+    iterator_impl &operator++() {
+      ++Pos;
+      return *this;
+    }
+  };
+
+public:
+  using iterator = iterator_impl<value_type>;
+  using const_iterator = iterator_impl<const value_type>;
+
+  GlobalValueSummaryMapTy() = default;
+  GlobalValueSummaryMapTy(GlobalValueSummaryMapTy &&Other)
+      : Alloc(std::move(Other.Alloc)), Entries(std::move(Other.Entries)),
+        Order(std::move(Other.Order)), NumSorted(Other.NumSorted.load()) {
+    Other.NumSorted = 0;
+  }
+
+  iterator begin() {
+    sortOrder();
+    return iterator(this, 0);
+  }
+  const_iterator begin() const {
+    sortOrder();
+    return const_iterator(this, 0);
+  }
+  iterator end() { return iterator(this, Order.size()); }
+  const_iterator end() const { return const_iterator(this, Order.size()); }
+
+  size_t size() const { return Entries.size(); }
+  bool empty() const { return Entries.empty(); }
+
+  /// Return the entry for \p GUID, or nullptr if there is none.
+  value_type *lookup(GlobalValue::GUID GUID) const {
+    return Entries.lookup(GUID);
+  }
+
+  /// Return the entry for \p GUID, inserting an empty one if there is none.
+  value_type *getOrInsert(GlobalValue::GUID GUID, bool HaveGVs) {
+    value_type *&Entry = Entries[GUID];
+    if (!Entry) {
+      Entry = new (Alloc.Allocate())
+          value_type(GUID, GlobalValueSummaryInfo(HaveGVs));
+      Order.push_back(Entry);
+    }
+    return Entry;
+  }
+};
 
 /// Struct that holds a reference to a particular GUID in a global value
 /// summary.
@@ -352,6 +450,21 @@ private:
   /// are listed in the derived FunctionSummary object.
   std::vector<ValueInfo> RefEdgeList;
 
+  /// If set, RefEdgeList and the call edges of a FunctionSummary are empty
+  /// until these encoded edges are decoded. A summary is read by several
+  /// threads during the thin link, so the first access decodes them under
+  /// the lock of the decoder and then clears the pointer.
+  struct LazyEdgesPtr {
+    std::atomic<const EncodedSummaryEdges *> Ptr{nullptr};
+
+    LazyEdgesPtr() = default;
+    LazyEdgesPtr(const LazyEdgesPtr &Other)
+        : Ptr(Other.Ptr.load(std::memory_order_acquire)) {}
+  };
+  mutable LazyEdgesPtr LazyEdges;
+
+  void decodeLazyEdges() const;
+
 protected:
   GlobalValueSummary(SummaryKind K, GVFlags Flags, std::vector<ValueInfo> Refs)
       : Kind(K), Flags(Flags), RefEdgeList(std::move(Refs)) {
@@ -359,6 +472,12 @@ protected:
            "Expect no references for AliasSummary");
   }
 
+  /// Make sure the edges of this summary are decoded.
+  void decodeEdges() const {
+    if (LazyEdges.Ptr.load(std::memory_order_acquire))
+      decodeLazyEdges();
+  }
+
 public:
   virtual ~GlobalValueSummary() = default;
 
@@ -412,7 +531,17 @@ public:
   void setNotEligibleToImport() { Flags.NotEligibleToImport = true; }
 
   /// Return the list of values referenced by this global value definition.
-  ArrayRef<ValueInfo> refs() const { return RefEdgeList; }
+  ArrayRef<ValueInfo> refs() const {
+    decodeEdges();
+    return RefEdgeList;
+  }
+
+  /// Keep the edges of this summary, which must not have any yet, encoded
+  /// until they are first accessed.
+  void setEncodedEdges(const EncodedSummaryEdges *Edges) {
+    assert(RefEdgeList.empty() && "Summary already has edges");
+    LazyEdges.Ptr.store(Edges, std::memory_order_relaxed);
+  }
 
   /// If this is an alias summary, returns the summary of the aliased object (a
   /// global variable or function), otherwise returns itself.
@@ -630,9 +759,15 @@ public:
   void setEntryCount(uint64_t EC) { EntryCount = EC; }
 
   /// Return the list of <CalleeValueInfo, CalleeInfo> pairs.
-  ArrayRef<EdgeTy> calls() const { return CallGraphEdgeList; }
+  ArrayRef<EdgeTy> calls() const {
+    decodeEdges();
+    return CallGraphEdgeList;
+  }
 
-  void addCall(EdgeTy E) { CallGraphEdgeList.push_back(E); }
+  void addCall(EdgeTy E) {
+    decodeEdges();
+    CallGraphEdgeList.push_back(E);
+  }
 
   /// Returns the list of type identifiers used by this function in
   /// llvm.type.test intrinsics other than by an llvm.assume intrinsic,
@@ -688,6 +823,7 @@ public:
 
   const TypeIdInfo *getTypeIdInfo() const { return TIdInfo.get(); };
 
+  friend class GlobalValueSummary;
   friend struct GraphTraits<ValueInfo>;
 };
 
@@ -911,6 +1047,24 @@ struct TypeIdOffsetVtableInfo {
 /// to inheritance, which is why this is a vector.
 using TypeIdCompatibleVtableInfo = std::vector<TypeIdOffsetVtableInfo>;
 
+/// Decodes the edges of summaries that a reader kept encoded. Owned by the
+/// index that holds the summaries.
+class SummaryEdgeDecoder {
+  friend class GlobalValueSummary;
+
+  /// Serializes the decoding of the summaries of this decoder.
+  std::mutex Mutex;
+
+public:
+  virtual ~SummaryEdgeDecoder() = default;
+
+  /// Decode \p Edges into the reference edges \p Refs and, for a function
+  /// summary, the call edges \p Calls.
+  virtual void decode(const EncodedSummaryEdges &Edges,
+                      std::vector<ValueInfo> &Refs,
+                      std::vector<FunctionSummary::EdgeTy> *Calls) = 0;
+};
+
 /// Class to hold module path string table and global value map,
 /// and encapsulate methods for operating on them.
 class ModuleSummaryIndex {
@@ -933,8 +1087,9 @@ private:
   std::map<std::string, TypeIdCompatibleVtableInfo> TypeIdCompatibleVtableMap;
 
   /// Mapping from original ID to GUID. If original ID can map to multiple
-  /// GUIDs, it will be mapped to 0.
-  std::map<GlobalValue::GUID, GlobalValue::GUID> OidGuidMap;
+  /// GUIDs, it will be mapped to 0. This has an entry for every local in the
+  /// combined index, so it is kept in a flat table rather than a std::map.
+  DenseMap<GlobalValue::GUID, GlobalValue::GUID> OidGuidMap;
 
   /// Indicates that summary-based GlobalValue GC has run, and values with
   /// GVFlags::Live==false are really dead. Otherwise, all values must be
@@ -967,6 +1122,9 @@ private:
   std::set<std::string> CfiFunctionDefs;
   std::set<std::string> CfiFunctionDecls;
 
+  /// Decoders of the summary edges that are still encoded.
+  std::vector<std::unique_ptr<SummaryEdgeDecoder>> EdgeDecoders;
+
   // Used in cases where we want to record the name of a global, but
   // don't have the string owned elsewhere (e.g. the Strtab on a module).
   StringSaver Saver;
@@ -977,8 +1135,7 @@ private:
 
   GlobalValueSummaryMapTy::value_type *
   getOrInsertValuePtr(GlobalValue::GUID GUID) {
-    return &*GlobalValueMap.emplace(GUID, GlobalValueSummaryInfo(HaveGVs))
-                 .first;
+    return GlobalValueMap.getOrInsert(GUID, HaveGVs);
   }
 
 public:
@@ -1094,8 +1251,7 @@ public:
 
   /// Return a ValueInfo for GUID if it exists, otherwise return ValueInfo().
   ValueInfo getValueInfo(GlobalValue::GUID GUID) const {
-    auto I = GlobalValueMap.find(GUID);
-    return ValueInfo(HaveGVs, I == GlobalValueMap.end() ? nullptr : &*I);
+    return ValueInfo(HaveGVs, GlobalValueMap.lookup(GUID));
   }
 
   /// Return a ValueInfo for \p GUID.
@@ -1136,6 +1292,14 @@ public:
   std::set<std::string> &cfiFunctionDecls() { return CfiFunctionDecls; }
   const std::set<std::string> &cfiFunctionDecls() const { return CfiFunctionDecls; }
 
+  /// Take ownership of a decoder of summary edges, which must live as long
+  /// as the summaries whose edges it decodes.
+  SummaryEdgeDecoder &
+  addEdgeDecoder(std::unique_ptr<SummaryEdgeDecoder> Decoder) {
+    EdgeDecoders.push_back(std::move(Decoder));
+    return *EdgeDecoders.back();
+  }
+
   /// Add a global value summary for a value.
   void addGlobalValueSummary(const GlobalValue &GV,
                              std::unique_ptr<GlobalValueSummary> Summary) {
@@ -1164,10 +1328,9 @@ public:
                        GlobalValue::GUID OrigGUID) {
     if (OrigGUID == 0 || ValueGUID == OrigGUID)
       return;
-    if (OidGuidMap.count(OrigGUID) && OidGuidMap[OrigGUID] != ValueGUID)
-      OidGuidMap[OrigGUID] = 0;
-    else
-      OidGuidMap[OrigGUID] = ValueGUID;
+    auto Inserted = OidGuidMap.try_emplace(OrigGUID, ValueGUID);
+    if (!Inserted.second && Inserted.first->second != ValueGUID)
+      Inserted.first->second = 0;
   }
 
   /// Find the summary for ValueInfo \p VI in module \p ModuleId, or nullptr if
@@ -1374,42 +1537,29 @@ template <> struct GraphTraits<ValueInfo> {
 
   static NodeRef getEntryNode(ValueInfo V) { return V; }
 
-  static ChildIteratorType child_begin(NodeRef N) {
+  static std::vector<FunctionSummary::EdgeTy> &getCallEdges(NodeRef N) {
     if (!N.getSummaryList().size()) // handle external function
-      return ChildIteratorType(
-          FunctionSummary::ExternalNode.CallGraphEdgeList.begin(),
-          &valueInfoFromEdge);
+      return FunctionSummary::ExternalNode.CallGraphEdgeList;
     FunctionSummary *F =
         cast<FunctionSummary>(N.getSummaryList().front()->getBaseObject());
-    return ChildIteratorType(F->CallGraphEdgeList.begin(), &valueInfoFromEdge);
+    F->decodeEdges();
+    return F->CallGraphEdgeList;
+  }
+
+  static ChildIteratorType child_begin(NodeRef N) {
+    return ChildIteratorType(getCallEdges(N).begin(), &valueInfoFromEdge);
   }
 
   static ChildIteratorType child_end(NodeRef N) {
-    if (!N.getSummaryList().size()) // handle external function
-      return ChildIteratorType(
-          FunctionSummary::ExternalNode.CallGraphEdgeList.end(),
-          &valueInfoFromEdge);
-    FunctionSummary *F =
-        cast<FunctionSummary>(N.getSummaryList().front()->getBaseObject());
-    return ChildIteratorType(F->CallGraphEdgeList.end(), &valueInfoFromEdge);
+    return ChildIteratorType(getCallEdges(N).end(), &valueInfoFromEdge);
   }
 
   static ChildEdgeIteratorType child_edge_begin(NodeRef N) {
-    if (!N.getSummaryList().size()) // handle external function
-      return FunctionSummary::ExternalNode.CallGraphEdgeList.begin();
-
-    FunctionSummary *F =
-        cast<FunctionSummary>(N.getSummaryList().front()->getBaseObject());
-    return F->CallGraphEdgeList.begin();
+    return getCallEdges(N).begin();
   }
 
   static ChildEdgeIteratorType child_edge_end(NodeRef N) {
-    if (!N.getSummaryList().size()) // handle external function
-      return FunctionSummary::ExternalNode.CallGraphEdgeList.end();
-
-    FunctionSummary *F =
-        cast<FunctionSummary>(N.getSummaryList().front()->getBaseObject());
-    return F->CallGraphEdgeList.end();
+    return getCallEdges(N).end();
   }
 
   static NodeRef edge_dest(EdgeRef E) { return E.first; }
@@ -210,15 +210,12 @@ template <> struct CustomMappingTraits<GlobalValueSummaryMapTy> {
       io.setError("key not an integer");
       return;
     }
-    if (!V.count(KeyInt))
-      V.emplace(KeyInt, /*IsAnalysis=*/false);
-    auto &Elem = V.find(KeyInt)->second;
+    auto &Elem = V.getOrInsert(KeyInt, /*IsAnalysis=*/false)->second;
     for (auto &FSum : FSums) {
       std::vector<ValueInfo> Refs;
       for (auto &RefGUID : FSum.Refs) {
-        if (!V.count(RefGUID))
-          V.emplace(RefGUID, /*IsAnalysis=*/false);
-        Refs.push_back(ValueInfo(/*IsAnalysis=*/false, &*V.find(RefGUID)));
+        Refs.push_back(ValueInfo(/*IsAnalysis=*/false,
+                                 V.getOrInsert(RefGUID, /*IsAnalysis=*/false)));
       }
       Elem.SummaryList.push_back(std::make_unique<FunctionSummary>(
           GlobalValueSummary::GVFlags(
@@ -27,11 +27,28 @@ namespace lto {
 using AddBufferFn =
     std::function<void(unsigned Task, std::unique_ptr<MemoryBuffer> MB)>;
 
+/// Options of the local file system cache.
+struct LocalCacheOptions {
+  /// Compress new entries with zlib, if LLVM was built with zlib support.
+  /// Compressed and uncompressed entries can both be read back either way.
+  bool Compress = false;
+
+  /// Keep up to this many bytes of recently used entries in memory, so that
+  /// repeated links in the same process do not read them back from disk. The
+  /// memory is shared by all the caches of the process, and the largest size
+  /// requested by any of them applies. A value of 0 disables the memory tier.
+  uint64_t MemoryCacheSize = 0;
+};
+
 /// Create a local file system cache which uses the given cache directory and
 /// file callback. This function also creates the cache directory if it does not
 /// already exist.
-Expected<NativeObjectCache> localCache(StringRef CacheDirectoryPath,
-                                       AddBufferFn AddBuffer);
+///
+/// Every use of an entry is recorded in the index of the cache directory, if
+/// it has one (see CachePruningPolicy::UseIndex).
+Expected<NativeObjectCache>
+localCache(StringRef CacheDirectoryPath, AddBufferFn AddBuffer,
+           LocalCacheOptions Options = LocalCacheOptions());
 
 } // namespace lto
 } // namespace llvm
@@ -117,6 +117,14 @@ struct Config {
   /// Statistics output file path.
   std::string StatsFile;
 
+  /// Whether the time trace profiler is enabled. Every ThinLTO backend thread
+  /// then records into a profiler of its own, see
+  /// timeTraceProfilerFinishThread().
+  bool TimeTraceEnabled = false;
+
+  /// Time trace profiler granularity of the backend threads, in microseconds.
+  unsigned TimeTraceGranularity = 500;
+
   bool ShouldDiscardValueNames = true;
   DiagnosticHandlerFunction DiagHandler;
 
@@ -63,6 +63,13 @@ public:
   /// Write the profile to \c OS
   void write(raw_fd_ostream &OS);
 
+  /// Write the union of the profiles of \p Shards to \c OS. The shards must
+  /// hold disjoint sets of function names and agree on the profile kind, as
+  /// the shards of a merge partitioned by function name do. Their records are
+  /// written in place instead of being merged into one writer first.
+  static void writeShards(ArrayRef<InstrProfWriter *> Shards,
+                          raw_fd_ostream &OS);
+
   /// Write the profile in text format to \c OS
   Error writeText(raw_fd_ostream &OS);
 
@@ -110,7 +117,7 @@ private:
   void addRecord(StringRef Name, uint64_t Hash, InstrProfRecord &&I,
                  uint64_t Weight, function_ref<void(Error)> Warn);
   bool shouldEncodeData(const ProfilingData &PD);
-  void writeImpl(ProfOStream &OS);
+  void writeImpl(ProfOStream &OS, ArrayRef<InstrProfWriter *> Shards);
 };
 
 } // end namespace llvm
@@ -57,13 +57,32 @@ struct CachePruningPolicy {
   /// 4096 and large_dir disabled), there is a per-directory entry limit of
   /// 508*510*floor(4096/(40+8))~=20M for average filename length of 40.
   uint64_t MaxSizeFiles = 1000000;
+
+  /// Whether to prune from the index file "llvmcache.index" instead of walking
+  /// the cache directory. The index lists the size and time of last use of the
+  /// entries, and is appended to by recordCacheIndexUse() on every use. If the
+  /// index does not exist yet, it is created from a directory walk.
+  ///
+  /// The index is an append-only log rather than a memory-mapped table, so
+  /// pruning reads the whole index, which is compacted as it grows to stay
+  /// within twice the size of one record per entry.
+  bool UseIndex = false;
+
+  /// With UseIndex, the interval between two directory walks that reconcile
+  /// the index with the entries actually present, e.g. written by a client
+  /// that does not record its uses. A value of 0 walks on every pruning. A
+  /// value of None never walks once the index exists.
+  llvm::Optional<std::chrono::seconds> IndexWalkInterval =
+      std::chrono::seconds(std::chrono::hours(24));
 };
 
 /// Parse the given string as a cache pruning policy. Defaults are taken from a
 /// default constructed CachePruningPolicy object.
 /// For example: "prune_interval=30s:prune_after=24h:cache_size=50%"
 /// which means a pruning interval of 30 seconds, expiration time of 24 hours
-/// and maximum cache size of 50% of available disk space.
+/// and maximum cache size of 50% of available disk space. "cache_index=1"
+/// enables the index based pruning, and "index_walk_interval=12h" sets the
+/// interval of its directory walks.
 Expected<CachePruningPolicy> parseCachePruningPolicy(StringRef PolicyStr);
 
 /// Peform pruning using the supplied policy, returns true if pruning
@@ -74,6 +93,16 @@ Expected<CachePruningPolicy> parseCachePruningPolicy(StringRef PolicyStr);
 /// pattern "llvmcache-*".
 bool pruneCache(StringRef Path, CachePruningPolicy Policy);
 
+/// Record in the index of the cache directory \p Path that the entry
+/// \p EntryName, which uses \p Size bytes on disk, was just used. This does
+/// nothing if the directory has no index, i.e. if it is not pruned with
+/// CachePruningPolicy::UseIndex. The record is a single append to the index,
+/// so this is safe to call concurrently from several threads and processes,
+/// and with a pruning in progress. Once the uses appended since the index was
+/// last rewritten outweigh its records, this compacts the index to one record
+/// per entry.
+void recordCacheIndexUse(StringRef Path, StringRef EntryName, uint64_t Size);
+
 } // namespace llvm
 
 #endif
@@ -16,6 +16,7 @@
 #include <algorithm>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 
 #if defined(_MSC_VER) && LLVM_ENABLE_THREADS
@@ -71,9 +72,14 @@ public:
   }
 };
 
+/// A group of tasks running on the process-wide ThreadPool. Waiting for the
+/// group from one of the threads of the pool runs the tasks of the group that
+/// have not started yet, and only blocks while the others run elsewhere, so
+/// groups can be nested freely.
 class TaskGroup {
-  Latch L;
-  bool Parallel;
+  /// The tasks of the group, shared with their tickets on the pool.
+  struct State;
+  std::shared_ptr<State> S;
 
 public:
   TaskGroup();
@@ -81,7 +87,7 @@ public:
 
   void spawn(std::function<void()> f);
 
-  void sync() const { L.sync(); }
+  void sync() const;
 };
 
 #if defined(_MSC_VER)
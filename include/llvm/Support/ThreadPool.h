@@ -6,7 +6,7 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file defines a crude C++11 based thread pool.
+// This file defines a work-stealing C++11 based thread pool.
 //
 //===----------------------------------------------------------------------===//
 
@@ -20,6 +20,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -31,13 +32,26 @@ namespace llvm {
 /// A ThreadPool for asynchronous parallel execution on a defined number of
 /// threads.
 ///
-/// The pool keeps a vector of threads alive, waiting on a condition variable
-/// for some work to become available.
+/// The pool keeps a vector of threads alive. Each thread owns a work-stealing
+/// deque: tasks submitted from within a task of the pool are pushed onto the
+/// deque of the submitting thread, tasks submitted from outside go through a
+/// shared queue. Idle threads steal from the other deques before going to
+/// sleep on a condition variable.
+///
+/// A pool can also be constructed on top of another one, in which case it has
+/// no threads of its own: its tasks run on the threads of the parent, and it
+/// only limits how many of them run at a time. Clients should build their
+/// pools on top of getGlobal() so that the whole process shares one set of
+/// threads instead of oversubscribing the machine.
 class ThreadPool {
 public:
   using TaskTy = std::function<void()>;
   using PackagedTaskTy = std::packaged_task<void()>;
 
+  /// Scheduling hint for a task. High priority tasks are started before any
+  /// pending normal priority task, but never preempt running tasks.
+  enum class Priority { Normal, High };
+
   /// Construct a pool with the number of threads found by
   /// hardware_concurrency().
   ThreadPool();
@@ -45,6 +59,11 @@ public:
   /// Construct a pool of \p ThreadCount threads
   ThreadPool(unsigned ThreadCount);
 
+  /// Construct a pool running its tasks on the threads of \p Parent, at most
+  /// \p MaxConcurrency of them at a time (0 means no limit besides the size of
+  /// \p Parent). wait() only waits for the tasks submitted through this pool.
+  ThreadPool(ThreadPool &Parent, unsigned MaxConcurrency);
+
   /// Blocking destructor: the pool will wait for all the threads to complete.
   ~ThreadPool();
 
@@ -54,45 +73,114 @@ public:
   inline std::shared_future<void> async(Function &&F, Args &&... ArgList) {
     auto Task =
         std::bind(std::forward<Function>(F), std::forward<Args>(ArgList)...);
-    return asyncImpl(std::move(Task));
+    return asyncImpl(std::move(Task), Priority::Normal);
   }
 
   /// Asynchronous submission of a task to the pool. The returned future can be
   /// used to wait for the task to finish and is *non-blocking* on destruction.
   template <typename Function>
   inline std::shared_future<void> async(Function &&F) {
-    return asyncImpl(std::forward<Function>(F));
+    return asyncImpl(std::forward<Function>(F), Priority::Normal);
+  }
+
+  /// Asynchronous submission of a task to the pool with the priority hint
+  /// \p P. The returned future can be used to wait for the task to finish and
+  /// is *non-blocking* on destruction.
+  template <typename Function>
+  inline std::shared_future<void> async(Priority P, Function &&F) {
+    return asyncImpl(std::forward<Function>(F), P);
   }
 
   /// Blocking wait for all the threads to complete and the queue to be empty.
   /// It is an error to try to add new tasks while blocking on this call.
+  /// When called from a task running on the parent of this pool, the tasks of
+  /// this pool that have not started yet are run by the waiting thread.
   void wait();
 
+  /// Whether the calling thread is one of the threads running the tasks of
+  /// this pool.
+  bool isWorkerThread() const;
+
+  /// Return the process-wide pool. The parallel algorithms of Parallel.h run
+  /// on it, and other clients should construct their pools on top of it.
+  static ThreadPool &getGlobal();
+
+  /// Set the number of threads of the process-wide pool, and thereby the
+  /// concurrency limit of all of its clients. Must be called before the first
+  /// call to getGlobal(). 0 means hardware_concurrency().
+  static void setGlobalThreadCount(unsigned ThreadCount);
+
 private:
   /// Asynchronous submission of a task to the pool. The returned future can be
   /// used to wait for the task to finish and is *non-blocking* on destruction.
-  std::shared_future<void> asyncImpl(TaskTy F);
+  std::shared_future<void> asyncImpl(TaskTy F, Priority P);
+
+#if LLVM_ENABLE_THREADS
+  /// Per-thread deque of tasks, defined in ThreadPool.cpp.
+  class WorkQueue;
+
+  /// Tasks of a pool built on a parent, defined in ThreadPool.cpp.
+  struct ForwardQueue;
+
+  /// Main loop of the thread owning the deque \p Index.
+  void work(unsigned Index);
+
+  /// Get the next task for the thread owning the deque \p Index, or null if
+  /// none was found.
+  PackagedTaskTy *findTask(unsigned Index);
+
+  /// Whether any task is queued and waiting to be started.
+  bool hasQueuedTasks() const;
+
+  /// Block the calling thread until some work might be available. Return
+  /// false if the pool is being destroyed and no task is left.
+  bool sleep();
+
+  /// Wake up one sleeping thread, if any.
+  void wakeOne();
+
+  /// Run a task grabbed from one of the queues and release it.
+  void runTask(PackagedTaskTy *Task);
+
+  /// Account for the completion of a task, notifying wait() if needed.
+  void finishTask();
 
   /// Threads in flight
   std::vector<llvm::thread> Threads;
 
-  /// Tasks waiting for execution in the pool.
-  std::queue<PackagedTaskTy> Tasks;
+  /// Work-stealing deques, one per thread.
+  std::vector<std::unique_ptr<WorkQueue>> WorkQueues;
+
+  /// Tasks submitted from outside the pool, and all high priority tasks.
+  std::deque<PackagedTaskTy *> SharedTasks[2];
+  std::atomic<unsigned> NumSharedTasks[2];
 
-  /// Locking and signaling for accessing the Tasks queue.
+  /// Locking for accessing the shared queues.
   std::mutex QueueLock;
-  std::condition_variable QueueCondition;
+
+  /// Locking and signaling for idle threads.
+  std::mutex SleepLock;
+  std::condition_variable SleepCondition;
+  std::atomic<unsigned> NumSleeping;
+  unsigned PendingWakeups;
 
   /// Locking and signaling for job completion
   std::mutex CompletionLock;
   std::condition_variable CompletionCondition;
 
-  /// Keep track of the number of thread actually busy
-  std::atomic<unsigned> ActiveThreads;
+  /// Number of tasks submitted and not yet completed.
+  std::atomic<unsigned> NumPendingTasks;
 
-#if LLVM_ENABLE_THREADS // avoids warning for unused variable
   /// Signal for the destruction of the pool, asking thread to exit.
-  bool EnableFlag;
+  std::atomic<bool> EnableFlag;
+
+  /// For a pool built on a parent, the tasks which have not started yet.
+  /// Shared with the tickets submitted to the parent to run them, which may
+  /// outlive the pool.
+  std::shared_ptr<ForwardQueue> Forwarded;
+#else
+  /// Tasks waiting for execution in the pool.
+  std::queue<PackagedTaskTy> Tasks;
 #endif
 };
 }
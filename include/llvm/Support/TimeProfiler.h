@@ -9,27 +9,37 @@
 #ifndef LLVM_SUPPORT_TIME_PROFILER_H
 #define LLVM_SUPPORT_TIME_PROFILER_H
 
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace llvm {
 
 struct TimeTraceProfiler;
-extern TimeTraceProfiler *TimeTraceProfilerInstance;
+extern LLVM_THREAD_LOCAL TimeTraceProfiler *TimeTraceProfilerInstance;
 
 /// Initialize the time trace profiler.
-/// This sets up the global \p TimeTraceProfilerInstance
-/// variable to be the profiler instance.
+/// This sets up the thread-local \p TimeTraceProfilerInstance
+/// variable to be the profiler instance. Each thread that wants its sections
+/// recorded must initialize its own profiler; secondary threads hand their
+/// sections over with timeTraceProfilerFinishThread().
 void timeTraceProfilerInitialize(unsigned TimeTraceGranularity);
 
-/// Cleanup the time trace profiler, if it was initialized.
+/// Cleanup the time trace profiler, if it was initialized. This also releases
+/// the sections handed over by other threads.
 void timeTraceProfilerCleanup();
 
+/// Finish recording on the current thread. The profiler of this thread is
+/// queued up to be written, on a track of its own, by the thread calling
+/// timeTraceProfilerWrite().
+void timeTraceProfilerFinishThread();
+
 /// Is the time trace profiler enabled, i.e. initialized?
 inline bool timeTraceProfilerEnabled() {
   return TimeTraceProfilerInstance != nullptr;
 }
 
-/// Write profiling data to output file.
+/// Write profiling data to output file, including the sections of every
+/// thread that called timeTraceProfilerFinishThread() so far.
 /// Data produced is JSON, in Chrome "Trace Event" format, see
 /// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU/preview
 void timeTraceProfilerWrite(raw_pwrite_stream &OS);
@@ -312,6 +312,14 @@ public:
   /// scheduling opportunities.
   virtual bool targetSchedulesPostRAScheduling() const { return false; };
 
+  /// Returns true if \p GV is allocated separately for each entry point that
+  /// uses it, directly or through a callee, so that code in another module
+  /// cannot refer to it. Module splitting keeps such a global in the same
+  /// partition as all of its users.
+  virtual bool isAllocatedPerEntryPoint(const GlobalValue &GV) const {
+    return false;
+  }
+
   void getNameWithPrefix(SmallVectorImpl<char> &Name, const GlobalValue *GV,
                          Mangler &Mang, bool MayAlwaysUsePrivate = false) const;
   MCSymbol *getSymbol(const GlobalValue *GV) const;
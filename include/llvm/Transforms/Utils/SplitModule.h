@@ -20,11 +20,19 @@
 
 namespace llvm {
 
+class GlobalValue;
 class Module;
 
 /// Splits the module M into N linkable partitions. The function ModuleCallback
 /// is called N times passing each individual partition as the MPart argument.
 ///
+/// Globals for which IsAllocatedPerEntryPoint returns true, such as AMDGPU
+/// local memory (see TargetMachine::isAllocatedPerEntryPoint), are kept in the
+/// same partition as every function that uses them, directly or through a
+/// callee. This alone does not make the partitions of an AMDHSA module
+/// separately loadable: each partition's code object carries the HSA metadata
+/// of its own kernels only, and nothing merges those notes.
+///
 /// FIXME: This function does not deal with the somewhat subtle symbol
 /// visibility issues around module splitting, including (but not limited to):
 ///
@@ -35,7 +43,8 @@ class Module;
 void SplitModule(
     std::unique_ptr<Module> M, unsigned N,
     function_ref<void(std::unique_ptr<Module> MPart)> ModuleCallback,
-    bool PreserveLocals = false);
+    bool PreserveLocals = false,
+    function_ref<bool(const GlobalValue &GV)> IsAllocatedPerEntryPoint = {});
 
 } // end namespace llvm
 
@@ -15,8 +15,10 @@
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/ADT/Twine.h"
@@ -67,9 +69,11 @@
 #include "llvm/Support/Error.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/LEB128.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cassert>
@@ -87,11 +91,28 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "bitcode-reader"
+
+STATISTIC(NumEncodedSummaryEdges,
+          "Number of function summaries read with their edges encoded");
+STATISTIC(NumDecodedSummaryEdges,
+          "Number of function summaries whose encoded edges were decoded");
+
 static cl::opt<bool> PrintSummaryGUIDs(
     "print-summary-global-ids", cl::init(false), cl::Hidden,
     cl::desc(
         "Print the global id for each value when reading the module summary"));
 
+static cl::opt<unsigned> FunctionDecodeThreads(
+    "bitcode-function-decode-threads", cl::init(0), cl::Hidden,
+    cl::desc("When materializing a whole module, decode function blocks on "
+             "this many threads ahead of parsing them (0 = disabled)"));
+
+static cl::opt<bool> LazySummaryEdges(
+    "lazy-summary-edges", cl::init(true), cl::Hidden,
+    cl::desc("Keep the edges of function summaries read from a per-module "
+             "summary encoded until they are first accessed"));
+
 namespace {
 
 enum {
@@ -480,6 +501,121 @@ BitcodeReaderBase::readNameFromStrtab(ArrayRef<uint64_t> Record) {
 
 namespace {
 
+/// The entries of a function block, decoded on a worker thread so that
+/// parseFunctionBody only has to build the IR from them. Nested blocks are not
+/// decoded, only their position is kept to parse them from the stream.
+class StagedFunctionBlock {
+  struct Entry {
+    decltype(BitstreamEntry::Kind) Kind;
+    /// The abbrev ID of a record, or the block ID of a nested block.
+    unsigned ID;
+    unsigned Code;
+    /// The position of a nested block, just after its block ID.
+    uint64_t Bit;
+    size_t OpsBegin;
+    size_t OpsEnd;
+  };
+
+  std::vector<Entry> Entries;
+  std::vector<uint64_t> Ops;
+  uint64_t EndBit = 0;
+  size_t NextEntry = 0;
+  bool Failed = false;
+
+public:
+  std::shared_future<void> Ready;
+
+  /// Decode the function block entered at \p StartBit. Errors are not
+  /// reported here; parsing the block from the stream again reports them.
+  void decode(ArrayRef<uint8_t> BitcodeBytes, BitstreamBlockInfo *BlockInfo,
+              uint64_t StartBit);
+
+  bool failed() const { return Failed; }
+
+  /// Return the next entry like BitstreamCursor::advance. \p Stream is moved
+  /// to the start of a nested block, or past the end of the function block,
+  /// as if it had read the entry.
+  Expected<BitstreamEntry> advance(BitstreamCursor &Stream);
+
+  /// Read the record returned by the last call to advance.
+  Expected<unsigned> readRecord(SmallVectorImpl<uint64_t> &Record) const;
+};
+
+void StagedFunctionBlock::decode(ArrayRef<uint8_t> BitcodeBytes,
+                                 BitstreamBlockInfo *BlockInfo,
+                                 uint64_t StartBit) {
+  auto Fail = [this](Error Err) {
+    consumeError(std::move(Err));
+    Failed = true;
+  };
+
+  BitstreamCursor Cursor(BitcodeBytes);
+  Cursor.setBlockInfo(BlockInfo);
+  if (Error Err = Cursor.JumpToBit(StartBit))
+    return Fail(std::move(Err));
+  if (Error Err = Cursor.EnterSubBlock(bitc::FUNCTION_BLOCK_ID))
+    return Fail(std::move(Err));
+
+  SmallVector<uint64_t, 64> Record;
+  while (true) {
+    Expected<BitstreamEntry> MaybeEntry = Cursor.advance();
+    if (!MaybeEntry)
+      return Fail(MaybeEntry.takeError());
+    BitstreamEntry Entry = MaybeEntry.get();
+
+    switch (Entry.Kind) {
+    case BitstreamEntry::Error:
+      Failed = true;
+      return;
+    case BitstreamEntry::EndBlock:
+      Entries.push_back({Entry.Kind, 0, 0, 0, 0, 0});
+      EndBit = Cursor.GetCurrentBitNo();
+      return;
+    case BitstreamEntry::SubBlock:
+      Entries.push_back({Entry.Kind, Entry.ID, 0, Cursor.GetCurrentBitNo(), 0,
+                         0});
+      if (Error Err = Cursor.SkipBlock())
+        return Fail(std::move(Err));
+      continue;
+    case BitstreamEntry::Record:
+      break;
+    }
+
+    Record.clear();
+    Expected<unsigned> MaybeCode = Cursor.readRecord(Entry.ID, Record);
+    if (!MaybeCode)
+      return Fail(MaybeCode.takeError());
+    Entries.push_back({Entry.Kind, Entry.ID, MaybeCode.get(), 0, Ops.size(),
+                       Ops.size() + Record.size()});
+    Ops.insert(Ops.end(), Record.begin(), Record.end());
+  }
+}
+
+Expected<BitstreamEntry>
+StagedFunctionBlock::advance(BitstreamCursor &Stream) {
+  assert(NextEntry < Entries.size() && "Read past the end of the block");
+  const Entry &E = Entries[NextEntry++];
+  switch (E.Kind) {
+  case BitstreamEntry::SubBlock:
+    if (Error Err = Stream.JumpToBit(E.Bit))
+      return std::move(Err);
+    return BitstreamEntry::getSubBlock(E.ID);
+  case BitstreamEntry::EndBlock:
+    if (Error Err = Stream.JumpToBit(EndBit))
+      return std::move(Err);
+    return BitstreamEntry::getEndBlock();
+  default:
+    return BitstreamEntry::getRecord(E.ID);
+  }
+}
+
+Expected<unsigned>
+StagedFunctionBlock::readRecord(SmallVectorImpl<uint64_t> &Record) const {
+  const Entry &E = Entries[NextEntry - 1];
+  Record.append(Ops.begin() + E.OpsBegin, Ops.begin() + E.OpsEnd);
+  return E.Code;
+}
+
 class BitcodeReader : public BitcodeReaderBase, public GVMaterializer {
   LLVMContext &Context;
   Module *TheModule = nullptr;
@@ -537,6 +673,11 @@ class BitcodeReader : public BitcodeReaderBase, public GVMaterializer {
   /// where to find deferred function body in the stream.
   DenseMap<Function*, uint64_t> DeferredFunctionInfo;
 
+  /// Function blocks being decoded ahead of parsing them, see
+  /// stageFunctionBlock.
+  DenseMap<Function *, std::unique_ptr<StagedFunctionBlock>>
+      StagedFunctionBlocks;
+
   /// When Metadata block is initially scanned when parsing the module, we may
   /// choose to defer parsing of the metadata. This vector contains info about
   /// which Metadata blocks are deferred.
@@ -751,6 +892,8 @@ private:
   /// Save the positions of the Metadata blocks and skip parsing the blocks.
   Error rememberAndSkipMetadata();
   Error typeCheckLoadStoreInst(Type *ValType, Type *PtrType);
+  void stageFunctionBlock(ThreadPool &Pool, Function *F);
+  std::unique_ptr<StagedFunctionBlock> takeStagedFunctionBlock(Function *F);
   Error parseFunctionBody(Function *F);
   Error globalCleanup();
   Error resolveGlobalAndIndirectSymbolInits();
@@ -762,6 +905,40 @@ private:
   SyncScope::ID getDecodedSyncScopeID(unsigned Val);
 };
 
+/// Keeps the reference and call edges of the function summaries of one
+/// per-module summary as the value ids of their record, which take a fraction
+/// of the memory of the edge lists. Most summaries of a thin link are only
+/// visited when they are live, so the edges of dead ones are never decoded.
+class ModuleSummaryEdgeDecoder : public SummaryEdgeDecoder {
+  struct EncodedFunctionEdges : EncodedSummaryEdges {
+    /// ULEB128 encoded [numrefs, numrorefs, numworefs, numcalls,
+    /// numrefs x valueid, numcalls x (valueid[, hotness or relblockfreq])].
+    const uint8_t *Data;
+    unsigned Size;
+    bool HasProfile;
+    bool HasRelBF;
+  };
+
+  BumpPtrAllocator Alloc;
+
+  /// The value infos of the module, indexed by value id. Filled once the
+  /// summary block has been read.
+  std::vector<ValueInfo> ValueInfos;
+
+public:
+  const EncodedSummaryEdges *encode(ArrayRef<uint64_t> RefIds,
+                                    unsigned NumRORefs, unsigned NumWORefs,
+                                    ArrayRef<uint64_t> CallRecord,
+                                    bool HasProfile, bool HasRelBF);
+
+  void decode(const EncodedSummaryEdges &Edges, std::vector<ValueInfo> &Refs,
+              std::vector<FunctionSummary::EdgeTy> *Calls) override;
+
+  void setValueInfos(
+      const DenseMap<unsigned, std::pair<ValueInfo, GlobalValue::GUID>>
+          &ValueIdToValueInfoMap);
+};
+
 /// Class to manage reading and parsing function summary index bitcode
 /// files/sections.
 class ModuleSummaryIndexBitcodeReader : public BitcodeReaderBase {
@@ -3690,10 +3867,48 @@ void BitcodeReader::propagateByValTypes(CallBase *CB,
   }
 }
 
+/// Start decoding the body of \p F on \p Pool, if its position is known.
+void BitcodeReader::stageFunctionBlock(ThreadPool &Pool, Function *F) {
+  if (!F->isMaterializable())
+    return;
+  auto DFII = DeferredFunctionInfo.find(F);
+  if (DFII == DeferredFunctionInfo.end() || DFII->second == 0)
+    return;
+
+  auto &Staged = StagedFunctionBlocks[F];
+  if (Staged)
+    return;
+  Staged = std::make_unique<StagedFunctionBlock>();
+  StagedFunctionBlock *Block = Staged.get();
+  ArrayRef<uint8_t> BitcodeBytes = Stream.getBitcodeBytes();
+  BitstreamBlockInfo *Info = &BlockInfo;
+  uint64_t StartBit = DFII->second;
+  Block->Ready = Pool.async([=]() {
+    Block->decode(BitcodeBytes, Info, StartBit);
+  });
+}
+
+/// Return the decoded body of \p F, or null if it has to be parsed from the
+/// stream.
+std::unique_ptr<StagedFunctionBlock>
+BitcodeReader::takeStagedFunctionBlock(Function *F) {
+  auto It = StagedFunctionBlocks.find(F);
+  if (It == StagedFunctionBlocks.end())
+    return nullptr;
+  std::unique_ptr<StagedFunctionBlock> Staged = std::move(It->second);
+  StagedFunctionBlocks.erase(It);
+  Staged->Ready.wait();
+  if (Staged->failed())
+    return nullptr;
+  return Staged;
+}
+
 /// Lazily parse the specified function body block.
 Error BitcodeReader::parseFunctionBody(Function *F) {
-  if (Error Err = Stream.EnterSubBlock(bitc::FUNCTION_BLOCK_ID))
-    return Err;
+  std::unique_ptr<StagedFunctionBlock> Staged = takeStagedFunctionBlock(F);
+  if (!Staged)
+    if (Error Err = Stream.EnterSubBlock(bitc::FUNCTION_BLOCK_ID))
+      return Err;
 
   // Unexpected unresolved metadata when parsing function.
   if (MDLoader->hasFwdRefs())
@@ -3731,7 +3946,8 @@ Error BitcodeReader::parseFunctionBody(Function *F) {
   SmallVector<uint64_t, 64> Record;
 
   while (true) {
-    Expected<llvm::BitstreamEntry> MaybeEntry = Stream.advance();
+    Expected<llvm::BitstreamEntry> MaybeEntry =
+        Staged ? Staged->advance(Stream) : Stream.advance();
     if (!MaybeEntry)
       return MaybeEntry.takeError();
     llvm::BitstreamEntry Entry = MaybeEntry.get();
@@ -3783,7 +3999,9 @@ Error BitcodeReader::parseFunctionBody(Function *F) {
     Record.clear();
     Instruction *I = nullptr;
     Type *FullTy = nullptr;
-    Expected<unsigned> MaybeBitCode = Stream.readRecord(Entry.ID, Record);
+    Expected<unsigned> MaybeBitCode =
+        Staged ? Staged->readRecord(Record)
+               : Stream.readRecord(Entry.ID, Record);
     if (!MaybeBitCode)
       return MaybeBitCode.takeError();
     switch (unsigned BitCode = MaybeBitCode.get()) {
@@ -5292,10 +5510,26 @@ Error BitcodeReader::materializeModule() {
   WillMaterializeAllForwardRefs = true;
 
   // Iterate over the module, deserializing any functions that are still on
-  // disk.
-  for (Function &F : *TheModule) {
-    if (Error Err = materialize(&F))
-      return Err;
+  // disk. If requested, the function blocks ahead of the one being parsed are
+  // decoded on worker threads meanwhile.
+  {
+    std::vector<Function *> Functions;
+    for (Function &F : *TheModule)
+      Functions.push_back(&F);
+
+    std::unique_ptr<ThreadPool> DecodePool;
+    if (FunctionDecodeThreads)
+      DecodePool = std::make_unique<ThreadPool>(ThreadPool::getGlobal(),
+                                                FunctionDecodeThreads);
+    size_t StageAhead = 8 * FunctionDecodeThreads;
+
+    for (size_t I = 0, NextToStage = 0, E = Functions.size(); I != E; ++I) {
+      if (DecodePool)
+        for (; NextToStage != E && NextToStage <= I + StageAhead; ++NextToStage)
+          stageFunctionBlock(*DecodePool, Functions[NextToStage]);
+      if (Error Err = materialize(Functions[I]))
+        return Err;
+    }
   }
   // At this point, if there are any function bodies, parse the rest of
   // the bits in the module past the last function block we have recorded
@@ -5638,8 +5872,15 @@ std::vector<FunctionSummary::EdgeTy>
 ModuleSummaryIndexBitcodeReader::makeCallList(ArrayRef<uint64_t> Record,
                                               bool IsOldProfileFormat,
                                               bool HasProfile, bool HasRelBF) {
+  // Reserve exactly one edge per callee; the profile fields would otherwise
+  // double the size of every call list that stays in the index.
+  unsigned FieldsPerEdge = 1;
+  if (IsOldProfileFormat)
+    FieldsPerEdge += HasProfile ? 2 : 1;
+  else if (HasProfile || HasRelBF)
+    FieldsPerEdge += 1;
   std::vector<FunctionSummary::EdgeTy> Ret;
-  Ret.reserve(Record.size());
+  Ret.reserve(Record.size() / FieldsPerEdge);
   for (unsigned I = 0, E = Record.size(); I != E; ++I) {
     CalleeInfo::HotnessType Hotness = CalleeInfo::HotnessType::Unknown;
     uint64_t RelBF = 0;
@@ -5740,8 +5981,89 @@ static void setSpecialRefs(std::vector<ValueInfo> &Refs, unsigned ROCnt,
     Refs[RefNo].setWriteOnly();
 }
 
+const EncodedSummaryEdges *ModuleSummaryEdgeDecoder::encode(
+    ArrayRef<uint64_t> RefIds, unsigned NumRORefs, unsigned NumWORefs,
+    ArrayRef<uint64_t> CallRecord, bool HasProfile, bool HasRelBF) {
+  unsigned FieldsPerEdge = HasProfile || HasRelBF ? 2 : 1;
+  SmallString<256> Buffer;
+  raw_svector_ostream OS(Buffer);
+  encodeULEB128(RefIds.size(), OS);
+  encodeULEB128(NumRORefs, OS);
+  encodeULEB128(NumWORefs, OS);
+  encodeULEB128(CallRecord.size() / FieldsPerEdge, OS);
+  for (uint64_t Id : RefIds)
+    encodeULEB128(Id, OS);
+  for (uint64_t Field : CallRecord)
+    encodeULEB128(Field, OS);
+
+  auto *Edges = new (Alloc) EncodedFunctionEdges();
+  Edges->Decoder = this;
+  uint8_t *Data = Alloc.Allocate<uint8_t>(Buffer.size());
+  memcpy(Data, Buffer.data(), Buffer.size());
+  Edges->Data = Data;
+  Edges->Size = Buffer.size();
+  Edges->HasProfile = HasProfile;
+  Edges->HasRelBF = HasRelBF;
+  ++NumEncodedSummaryEdges;
+  return Edges;
+}
+
+void ModuleSummaryEdgeDecoder::decode(
+    const EncodedSummaryEdges &Edges, std::vector<ValueInfo> &Refs,
+    std::vector<FunctionSummary::EdgeTy> *Calls) {
+  const auto &FE = static_cast<const EncodedFunctionEdges &>(Edges);
+  const uint8_t *Ptr = FE.Data;
+  const uint8_t *End = FE.Data + FE.Size;
+  auto Next = [&]() {
+    unsigned Length;
+    uint64_t Value = decodeULEB128(Ptr, &Length, End);
+    Ptr += Length;
+    return Value;
+  };
+  auto GetValueInfo = [&](uint64_t Id) {
+    assert(Id < ValueInfos.size() && ValueInfos[Id] && "Unknown value id");
+    return ValueInfos[Id];
+  };
+
+  unsigned NumRefs = Next();
+  unsigned NumRORefs = Next();
+  unsigned NumWORefs = Next();
+  unsigned NumCalls = Next();
+  Refs.reserve(NumRefs);
+  for (unsigned I = 0; I != NumRefs; ++I)
+    Refs.push_back(GetValueInfo(Next()));
+  setSpecialRefs(Refs, NumRORefs, NumWORefs);
+
+  assert(Calls && "Only function summaries are encoded");
+  Calls->reserve(NumCalls);
+  for (unsigned I = 0; I != NumCalls; ++I) {
+    CalleeInfo::HotnessType Hotness = CalleeInfo::HotnessType::Unknown;
+    uint64_t RelBF = 0;
+    ValueInfo Callee = GetValueInfo(Next());
+    if (FE.HasProfile)
+      Hotness = static_cast<CalleeInfo::HotnessType>(Next());
+    else if (FE.HasRelBF)
+      RelBF = Next();
+    Calls->push_back(
+        FunctionSummary::EdgeTy{Callee, CalleeInfo(Hotness, RelBF)});
+  }
+  assert(Ptr == End && "Encoded edges not fully decoded");
+  ++NumDecodedSummaryEdges;
+}
+
+void ModuleSummaryEdgeDecoder::setValueInfos(
+    const DenseMap<unsigned, std::pair<ValueInfo, GlobalValue::GUID>>
+        &ValueIdToValueInfoMap) {
+  for (const auto &I : ValueIdToValueInfoMap) {
+    if (I.first >= ValueInfos.size())
+      ValueInfos.resize(I.first + 1);
+    ValueInfos[I.first] = I.second.first;
+  }
+}
+
 // Eagerly parse the entire summary block. This populates the GlobalValueSummary
-// objects in the index.
+// objects in the index. The edges of the function summaries of a per-module
+// summary are only decoded when they are first accessed.
 Error ModuleSummaryIndexBitcodeReader::parseEntireSummary(unsigned ID) {
   if (Error Err = Stream.EnterSubBlock(ID))
     return Err;
@@ -5769,6 +6091,19 @@ Error ModuleSummaryIndexBitcodeReader::parseEntireSummary(unsigned ID) {
                  ". Version should be in the range [1-7].");
   Record.clear();
 
+  // The value infos of the module are only complete at the end of the block,
+  // so the decoder gets them on the way out.
+  ModuleSummaryEdgeDecoder *EdgeDecoder = nullptr;
+  if (LazySummaryEdges && !IsOldProfileFormat) {
+    auto Decoder = std::make_unique<ModuleSummaryEdgeDecoder>();
+    EdgeDecoder = Decoder.get();
+    TheIndex.addEdgeDecoder(std::move(Decoder));
+  }
+  auto SetValueInfos = make_scope_exit([&]() {
+    if (EdgeDecoder)
+      EdgeDecoder->setValueInfos(ValueIdToValueInfoMap);
+  });
+
   // Keep around the last seen summary to be used when we see an optional
   // "OriginalName" attachement.
   GlobalValueSummary *LastSeenSummary = nullptr;
@@ -5890,14 +6225,25 @@ Error ModuleSummaryIndexBitcodeReader::parseEntireSummary(unsigned ID) {
       int CallGraphEdgeStartIndex = RefListStartIndex + NumRefs;
       assert(Record.size() >= RefListStartIndex + NumRefs &&
              "Record size inconsistent with number of references");
-      std::vector<ValueInfo> Refs = makeRefList(
-          ArrayRef<uint64_t>(Record).slice(RefListStartIndex, NumRefs));
       bool HasProfile = (BitCode == bitc::FS_PERMODULE_PROFILE);
       bool HasRelBF = (BitCode == bitc::FS_PERMODULE_RELBF);
-      std::vector<FunctionSummary::EdgeTy> Calls = makeCallList(
-          ArrayRef<uint64_t>(Record).slice(CallGraphEdgeStartIndex),
-          IsOldProfileFormat, HasProfile, HasRelBF);
-      setSpecialRefs(Refs, NumRORefs, NumWORefs);
+      std::vector<ValueInfo> Refs;
+      std::vector<FunctionSummary::EdgeTy> Calls;
+      const EncodedSummaryEdges *EncodedEdges = nullptr;
+      if (EdgeDecoder) {
+        EncodedEdges = EdgeDecoder->encode(
+            ArrayRef<uint64_t>(Record).slice(RefListStartIndex, NumRefs),
+            NumRORefs, NumWORefs,
+            ArrayRef<uint64_t>(Record).slice(CallGraphEdgeStartIndex),
+            HasProfile, HasRelBF);
+      } else {
+        Refs = makeRefList(
+            ArrayRef<uint64_t>(Record).slice(RefListStartIndex, NumRefs));
+        Calls = makeCallList(
+            ArrayRef<uint64_t>(Record).slice(CallGraphEdgeStartIndex),
+            IsOldProfileFormat, HasProfile, HasRelBF);
+        setSpecialRefs(Refs, NumRORefs, NumWORefs);
+      }
       auto FS = std::make_unique<FunctionSummary>(
           Flags, InstCount, getDecodedFFlags(RawFunFlags), /*EntryCount=*/0,
           std::move(Refs), std::move(Calls), std::move(PendingTypeTests),
@@ -5910,6 +6256,8 @@ Error ModuleSummaryIndexBitcodeReader::parseEntireSummary(unsigned ID) {
       PendingTypeCheckedLoadVCalls.clear();
       PendingTypeTestAssumeConstVCalls.clear();
       PendingTypeCheckedLoadConstVCalls.clear();
+      if (EncodedEdges)
+        FS->setEncodedEdges(EncodedEdges);
       auto VIAndOriginalGUID = getValueInfoFromValueId(ValueID);
       FS->setModulePath(getThisModule()->first());
       FS->setOriginalName(VIAndOriginalGUID.second);
@@ -67,6 +67,7 @@
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/SHA1.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cassert>
@@ -90,6 +91,11 @@ static cl::opt<bool> WriteRelBFToSummary(
     "write-relbf-to-summary", cl::Hidden, cl::init(false),
     cl::desc("Write relative block frequency to function summary "));
 
+static cl::opt<unsigned> FunctionEncodeThreads(
+    "bitcode-function-encode-threads", cl::init(0), cl::Hidden,
+    cl::desc("Encode function blocks on this many threads and splice them "
+             "into the module block in order (0 = disabled)"));
+
 extern FunctionSummary::ForceSummaryHotnessType ForceSummaryEdgesCold;
 
 namespace {
@@ -202,6 +208,14 @@ public:
               assignValueId(CallEdge.first.getGUID());
   }
 
+  /// Constructs a ModuleBitcodeWriterBase object for the module of \p Parent,
+  /// with a copy of its enumeration, writing to the provided \p Stream.
+  ModuleBitcodeWriterBase(const ModuleBitcodeWriterBase &Parent,
+                          StringTableBuilder &StrtabBuilder,
+                          BitstreamWriter &Stream)
+      : BitcodeWriterBase(Stream, StrtabBuilder), M(Parent.M), VE(Parent.VE),
+        Index(nullptr), GlobalValueId(Parent.GlobalValueId) {}
+
 protected:
   void writePerModuleGlobalValueSummary();
 
@@ -270,6 +284,16 @@ public:
         Buffer(Buffer), GenerateHash(GenerateHash), ModHash(ModHash),
         BitcodeStartBit(Stream.GetCurrentBitNo()) {}
 
+  /// Constructs a ModuleBitcodeWriter object that writes function blocks of
+  /// the module of \p Parent, using its enumeration, to the provided \p Buffer.
+  ModuleBitcodeWriter(const ModuleBitcodeWriter &Parent,
+                      SmallVectorImpl<char> &Buffer,
+                      StringTableBuilder &StrtabBuilder,
+                      BitstreamWriter &Stream)
+      : ModuleBitcodeWriterBase(Parent, StrtabBuilder, Stream), Buffer(Buffer),
+        GenerateHash(false), ModHash(nullptr),
+        BitcodeStartBit(Stream.GetCurrentBitNo()) {}
+
   /// Emit the current module to the bitstream.
   void write();
 
@@ -388,6 +412,9 @@ private:
   void
   writeFunction(const Function &F,
                 DenseMap<const Function *, uint64_t> &FunctionToBitcodeIndex);
+  void writeFunctionsInParallel(
+      unsigned Threads,
+      DenseMap<const Function *, uint64_t> &FunctionToBitcodeIndex);
   void writeBlockInfo();
   void writeModuleHash(size_t BlockStartPos);
 
@@ -3241,6 +3268,89 @@ void ModuleBitcodeWriter::writeFunction(
   Stream.ExitBlock();
 }
 
+/// Emit the function bodies to the module stream, encoding them on \p Threads
+/// worker threads.
+///
+/// Each worker copies the module-level enumeration, which is only read while
+/// the workers run, and writes a contiguous range of functions to its own
+/// stream. A function block only refers to module-level IDs and to
+/// abbreviations from the block info, which are the same in every stream, and
+/// starts on a word boundary, so its words are then copied into the module
+/// stream unchanged. The result is the same as writing the functions one after
+/// the other.
+void ModuleBitcodeWriter::writeFunctionsInParallel(
+    unsigned Threads,
+    DenseMap<const Function *, uint64_t> &FunctionToBitcodeIndex) {
+  std::vector<const Function *> Functions;
+  uint64_t TotalSize = 0;
+  for (const Function &F : M)
+    if (!F.isDeclaration()) {
+      Functions.push_back(&F);
+      TotalSize += F.getInstructionCount();
+    }
+  if (Functions.empty())
+    return;
+
+  // Split the functions into ranges with about the same number of
+  // instructions.
+  std::vector<size_t> RangeEnds;
+  uint64_t Size = 0;
+  for (size_t I = 0, E = Functions.size(); I != E; ++I) {
+    Size += Functions[I]->getInstructionCount();
+    if (Size * Threads >= TotalSize * (RangeEnds.size() + 1))
+      RangeEnds.push_back(I + 1);
+  }
+
+  struct EncodedRange {
+    SmallVector<char, 0> Buffer;
+    /// Byte offsets of each function block in Buffer, starting after the
+    /// word holding the ENTER_SUBBLOCK header.
+    std::vector<std::pair<size_t, size_t>> Blocks;
+  };
+  std::vector<EncodedRange> Encoded(RangeEnds.size());
+
+  auto EncodeRange = [&](EncodedRange &Out,
+                         ArrayRef<const Function *> Range) {
+    BitstreamWriter SubStream(Out.Buffer);
+    StringTableBuilder SubStrtab(StringTableBuilder::RAW);
+    ModuleBitcodeWriter SubWriter(*this, Out.Buffer, SubStrtab, SubStream);
+    SubWriter.writeBlockInfo();
+    DenseMap<const Function *, uint64_t> SubIndex;
+    for (const Function *F : Range) {
+      SubWriter.writeFunction(*F, SubIndex);
+      Out.Blocks.emplace_back(SubIndex[F] / 8 + 4, Out.Buffer.size());
+    }
+  };
+
+  {
+    ThreadPool Pool(ThreadPool::getGlobal(), Threads);
+    size_t Begin = 0;
+    for (size_t R = 0, E = RangeEnds.size(); R != E; ++R) {
+      ArrayRef<const Function *> Range =
+          makeArrayRef(Functions).slice(Begin, RangeEnds[R] - Begin);
+      Pool.async([&EncodeRange, &Encoded, R, Range] {
+        EncodeRange(Encoded[R], Range);
+      });
+      Begin = RangeEnds[R];
+    }
+    Pool.wait();
+  }
+
+  // The header is encoded with the abbrev width of the enclosing block, so
+  // write it here and copy the rest of the block, starting with its length.
+  auto F = Functions.begin();
+  for (const EncodedRange &Range : Encoded)
+    for (const auto &Block : Range.Blocks) {
+      FunctionToBitcodeIndex[*F++] = Stream.GetCurrentBitNo();
+      Stream.EmitCode(bitc::ENTER_SUBBLOCK);
+      Stream.EmitVBR(bitc::FUNCTION_BLOCK_ID, bitc::BlockIDWidth);
+      Stream.EmitVBR(4, bitc::CodeLenWidth);
+      Stream.FlushToWord();
+      for (size_t I = Block.first; I != Block.second; I += 4)
+        Stream.Emit(support::endian::read32le(&Range.Buffer[I]), 32);
+    }
+}
+
 // Emit blockinfo, which defines the standard abbreviations etc.
 void ModuleBitcodeWriter::writeBlockInfo() {
   // We only want to emit block info records for blocks that have multiple
@@ -4261,11 +4371,16 @@ void ModuleBitcodeWriter::write() {
   writeOperandBundleTags();
   writeSyncScopeNames();
 
-  // Emit function bodies.
+  // Emit function bodies. The use-list orders of all functions are kept on
+  // one stack in VE, so only encode them in parallel when they are not
+  // preserved.
   DenseMap<const Function *, uint64_t> FunctionToBitcodeIndex;
-  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F)
-    if (!F->isDeclaration())
-      writeFunction(*F, FunctionToBitcodeIndex);
+  if (FunctionEncodeThreads > 1 && !VE.shouldPreserveUseListOrder())
+    writeFunctionsInParallel(FunctionEncodeThreads, FunctionToBitcodeIndex);
+  else
+    for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F)
+      if (!F->isDeclaration())
+        writeFunction(*F, FunctionToBitcodeIndex);
 
   // Need to write after the above call to WriteFunction which populates
   // the summary information in the index.
@@ -140,7 +140,10 @@ private:
 
 public:
   ValueEnumerator(const Module &M, bool ShouldPreserveUseListOrder);
-  ValueEnumerator(const ValueEnumerator &) = delete;
+  /// Copies the module-level enumeration of \p VE, which must not have a
+  /// function incorporated or use-list orders to write, so that functions can
+  /// be incorporated into the copy on another thread.
+  explicit ValueEnumerator(const ValueEnumerator &VE);
   ValueEnumerator &operator=(const ValueEnumerator &) = delete;
 
   void dump() const;
@@ -48,10 +48,13 @@ std::unique_ptr<Module> llvm::splitCodeGen(
     return M;
   }
 
+  // Only used to ask the target which globals must stay with their users.
+  std::unique_ptr<TargetMachine> TM = TMFactory();
+
   // Create ThreadPool in nested scope so that threads will be joined
   // on destruction.
   {
-    ThreadPool CodegenThreadPool(OSs.size());
+    ThreadPool CodegenThreadPool(ThreadPool::getGlobal(), OSs.size());
     int ThreadCount = 0;
 
     SplitModule(
@@ -91,7 +94,10 @@ std::unique_ptr<Module> llvm::splitCodeGen(
               // copied into the thread's context.
               std::move(BC));
         },
-        PreserveLocals);
+        PreserveLocals,
+        [&](const GlobalValue &GV) {
+          return TM->isAllocatedPerEntryPoint(GV);
+        });
   }
 
   return {};
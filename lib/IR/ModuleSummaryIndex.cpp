@@ -29,6 +29,38 @@ STATISTIC(WriteOnlyLiveGVars,
 FunctionSummary FunctionSummary::ExternalNode =
     FunctionSummary::makeDummyFunctionSummary({});
 
+void GlobalValueSummary::decodeLazyEdges() const {
+  const EncodedSummaryEdges *Edges =
+      LazyEdges.Ptr.load(std::memory_order_acquire);
+  std::lock_guard<std::mutex> Lock(Edges->Decoder->Mutex);
+  if (!LazyEdges.Ptr.load(std::memory_order_relaxed))
+    return;
+  auto *This = const_cast<GlobalValueSummary *>(this);
+  std::vector<FunctionSummary::EdgeTy> *Calls = nullptr;
+  if (auto *FS = dyn_cast<FunctionSummary>(This))
+    Calls = &FS->CallGraphEdgeList;
+  Edges->Decoder->decode(*Edges, This->RefEdgeList, Calls);
+  LazyEdges.Ptr.store(nullptr, std::memory_order_release);
+}
+
+void GlobalValueSummaryMapTy::sortInserted() const {
+  // Const iteration is how the thin link reads the index from several
+  // threads, so the first reader to find unsorted entries sorts them while
+  // the others wait.
+  static std::mutex SortMutex;
+  std::lock_guard<std::mutex> Lock(SortMutex);
+  size_t Sorted = NumSorted.load(std::memory_order_relaxed);
+  if (Sorted == Order.size())
+    return;
+  auto GUIDLess = [](const value_type *A, const value_type *B) {
+    return A->first < B->first;
+  };
+  auto Inserted = Order.begin() + Sorted;
+  std::sort(Inserted, Order.end(), GUIDLess);
+  std::inplace_merge(Order.begin(), Inserted, Order.end(), GUIDLess);
+  NumSorted.store(Order.size(), std::memory_order_release);
+}
+
 bool ValueInfo::isDSOLocal() const {
   // Need to check all summaries are local in case of hash collisions.
   return getSummaryList().size() &&
@@ -12,11 +12,19 @@
 
 #include "llvm/LTO/Caching.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/Errc.h"
+#include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Process.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
+#include <list>
+#include <mutex>
 
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
 #include <unistd.h>
@@ -27,17 +35,119 @@
 using namespace llvm;
 using namespace llvm::lto;
 
+namespace {
+/// The in-memory tier of the caches: recently used entries, keyed by path and
+/// shared by all the caches of the process. Evicts least recently used first.
+class MemoryTier {
+  struct Entry {
+    std::string Path;
+    std::string Contents;
+    uint64_t SizeOnDisk;
+  };
+  using EntryList = std::list<Entry>;
+
+  std::mutex Mu;
+  uint64_t Capacity = 0;
+  uint64_t Size = 0;
+  /// Most recently used first.
+  EntryList Entries;
+  StringMap<EntryList::iterator> EntryForPath;
+
+  void erase(EntryList::iterator I) {
+    Size -= I->Contents.size();
+    EntryForPath.erase(I->Path);
+    Entries.erase(I);
+  }
+
+public:
+  void reserve(uint64_t NewCapacity) {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Capacity = std::max(Capacity, NewCapacity);
+  }
+
+  std::unique_ptr<MemoryBuffer> lookup(StringRef Path, uint64_t &SizeOnDisk) {
+    std::lock_guard<std::mutex> Lock(Mu);
+    auto I = EntryForPath.find(Path);
+    if (I == EntryForPath.end())
+      return nullptr;
+    Entries.splice(Entries.begin(), Entries, I->second);
+    SizeOnDisk = I->second->SizeOnDisk;
+    return MemoryBuffer::getMemBufferCopy(I->second->Contents, Path);
+  }
+
+  void insert(StringRef Path, StringRef Contents, uint64_t SizeOnDisk) {
+    std::lock_guard<std::mutex> Lock(Mu);
+    if (Contents.size() > Capacity)
+      return;
+    auto I = EntryForPath.find(Path);
+    if (I != EntryForPath.end())
+      erase(I->second);
+    Entries.push_front({Path, Contents, SizeOnDisk});
+    EntryForPath[Path] = Entries.begin();
+    Size += Contents.size();
+    while (Size > Capacity)
+      erase(std::prev(Entries.end()));
+  }
+};
+} // end anonymous namespace
+
+static ManagedStatic<MemoryTier> MemoryEntries;
+
+/// Compressed entries start with this magic, followed by the size of the
+/// uncompressed entry as a little endian 64-bit integer and the zlib stream.
+static const char CompressedMagic[] = "LLVMCZ01";
+static const size_t CompressedHeaderSize = 8 + sizeof(uint64_t);
+
+/// Return the contents of the entry \p MB, uncompressing it if needed, or null
+/// if the entry cannot be uncompressed.
+static std::unique_ptr<MemoryBuffer>
+readEntry(std::unique_ptr<MemoryBuffer> MB) {
+  StringRef Buffer = MB->getBuffer();
+  if (Buffer.size() < CompressedHeaderSize ||
+      !Buffer.startswith(StringRef(CompressedMagic, 8)))
+    return MB;
+  if (!zlib::isAvailable())
+    return nullptr;
+  uint64_t Size = support::endian::read64le(Buffer.data() + 8);
+  SmallVector<char, 0> Uncompressed;
+  if (Error E = zlib::uncompress(Buffer.drop_front(CompressedHeaderSize),
+                                 Uncompressed, Size)) {
+    consumeError(std::move(E));
+    return nullptr;
+  }
+  return std::make_unique<SmallVectorMemoryBuffer>(
+      std::move(Uncompressed), MB->getBufferIdentifier());
+}
+
 Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
-                                            AddBufferFn AddBuffer) {
+                                            AddBufferFn AddBuffer,
+                                            LocalCacheOptions Options) {
   if (std::error_code EC = sys::fs::create_directories(CacheDirectoryPath))
     return errorCodeToError(EC);
 
+  if (Options.MemoryCacheSize)
+    MemoryEntries->reserve(Options.MemoryCacheSize);
+  bool Compress = Options.Compress && zlib::isAvailable();
+  bool UseMemory = Options.MemoryCacheSize != 0;
+  std::string CacheDir = CacheDirectoryPath;
+
   return [=](unsigned Task, StringRef Key) -> AddStreamFn {
     // This choice of file name allows the cache to be pruned (see pruneCache()
     // in include/llvm/Support/CachePruning.h).
+    std::string EntryName = ("llvmcache-" + Key).str();
     SmallString<64> EntryPath;
-    sys::path::append(EntryPath, CacheDirectoryPath, "llvmcache-" + Key);
-    // First, see if we have a cache hit.
+    sys::path::append(EntryPath, CacheDir, EntryName);
+
+    // First, see if the entry is still in memory.
+    uint64_t SizeOnDisk;
+    if (UseMemory)
+      if (auto MB = MemoryEntries->lookup(EntryPath, SizeOnDisk)) {
+        recordCacheIndexUse(CacheDir, EntryName, SizeOnDisk);
+        AddBuffer(Task, std::move(MB));
+        return AddStreamFn();
+      }
+
+    // Then, see if we have a cache hit.
     SmallString<64> ResultPath;
     Expected<sys::fs::file_t> FDOrErr = sys::fs::openNativeFileForRead(
         Twine(EntryPath), sys::fs::OF_UpdateAtime, &ResultPath);
@@ -49,10 +159,20 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
                                     /*RequiresNullTerminator=*/false);
       sys::fs::closeFile(*FDOrErr);
       if (MBOrErr) {
-        AddBuffer(Task, std::move(*MBOrErr));
-        return AddStreamFn();
+        SizeOnDisk = (*MBOrErr)->getBufferSize();
+        // An entry that cannot be uncompressed, e.g. because this build has
+        // no zlib, is handled as a miss and overwritten.
+        if (auto MB = readEntry(std::move(*MBOrErr))) {
+          recordCacheIndexUse(CacheDir, EntryName, SizeOnDisk);
+          if (UseMemory)
+            MemoryEntries->insert(EntryPath, MB->getBuffer(), SizeOnDisk);
+          AddBuffer(Task, std::move(MB));
+          return AddStreamFn();
+        }
+        EC = errc::no_such_file_or_directory;
+      } else {
+        EC = MBOrErr.getError();
       }
-      EC = MBOrErr.getError();
     } else {
       EC = errorToErrorCode(FDOrErr.takeError());
     }
@@ -72,20 +192,51 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
     struct CacheStream : NativeObjectStream {
       AddBufferFn AddBuffer;
       sys::fs::TempFile TempFile;
+      std::string CacheDir;
+      std::string EntryName;
       std::string EntryPath;
       unsigned Task;
+      bool UseMemory;
+      // If the entry is compressed, the object is written here and only its
+      // compressed form goes to TempFile.
+      std::unique_ptr<SmallVector<char, 0>> Uncompressed;
 
       CacheStream(std::unique_ptr<raw_pwrite_stream> OS, AddBufferFn AddBuffer,
-                  sys::fs::TempFile TempFile, std::string EntryPath,
-                  unsigned Task)
+                  sys::fs::TempFile TempFile, std::string CacheDir,
+                  std::string EntryName, std::string EntryPath, unsigned Task,
+                  bool UseMemory,
+                  std::unique_ptr<SmallVector<char, 0>> Uncompressed)
           : NativeObjectStream(std::move(OS)), AddBuffer(std::move(AddBuffer)),
-            TempFile(std::move(TempFile)), EntryPath(std::move(EntryPath)),
-            Task(Task) {}
+            TempFile(std::move(TempFile)), CacheDir(std::move(CacheDir)),
+            EntryName(std::move(EntryName)), EntryPath(std::move(EntryPath)),
+            Task(Task), UseMemory(UseMemory),
+            Uncompressed(std::move(Uncompressed)) {}
 
       ~CacheStream() {
         // Make sure the stream is closed before committing it.
         OS.reset();
 
+        std::unique_ptr<MemoryBuffer> Contents;
+        if (Uncompressed) {
+          StringRef Object(Uncompressed->data(), Uncompressed->size());
+          SmallVector<char, 0> Compressed;
+          raw_fd_ostream TempOS(TempFile.FD, /*shouldClose=*/false);
+          if (Error E = zlib::compress(Object, Compressed)) {
+            // Store the entry uncompressed then.
+            consumeError(std::move(E));
+            TempOS << Object;
+          } else {
+            char Size[sizeof(uint64_t)];
+            support::endian::write64le(Size, Object.size());
+            TempOS << StringRef(CompressedMagic, 8)
+                   << StringRef(Size, sizeof(Size))
+                   << StringRef(Compressed.data(), Compressed.size());
+          }
+          TempOS.flush();
+          Contents = std::make_unique<SmallVectorMemoryBuffer>(
+              std::move(*Uncompressed), EntryPath);
+        }
+
         // Open the file first to avoid racing with a cache pruner.
         ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
             MemoryBuffer::getOpenFile(
@@ -126,14 +277,20 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
                              TempFile.TmpName + " to " + EntryPath + ": " +
                              toString(std::move(E)) + "\n");
 
-        AddBuffer(Task, std::move(*MBOrErr));
+        uint64_t SizeOnDisk = (*MBOrErr)->getBufferSize();
+        if (!Contents)
+          Contents = std::move(*MBOrErr);
+        recordCacheIndexUse(CacheDir, EntryName, SizeOnDisk);
+        if (UseMemory)
+          MemoryEntries->insert(EntryPath, Contents->getBuffer(), SizeOnDisk);
+        AddBuffer(Task, std::move(Contents));
       }
     };
 
     return [=](size_t Task) -> std::unique_ptr<NativeObjectStream> {
       // Write to a temporary to avoid race condition
       SmallString<64> TempFilenameModel;
-      sys::path::append(TempFilenameModel, CacheDirectoryPath, "Thin-%%%%%%.tmp.o");
+      sys::path::append(TempFilenameModel, CacheDir, "Thin-%%%%%%.tmp.o");
       Expected<sys::fs::TempFile> Temp = sys::fs::TempFile::create(
           TempFilenameModel, sys::fs::owner_read | sys::fs::owner_write);
       if (!Temp) {
@@ -142,9 +299,19 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
       }
 
       // This CacheStream will move the temporary file into the cache when done.
+      // A compressed entry is written to memory first and compressed at once.
+      std::unique_ptr<SmallVector<char, 0>> Uncompressed;
+      std::unique_ptr<raw_pwrite_stream> OS;
+      if (Compress) {
+        Uncompressed = std::make_unique<SmallVector<char, 0>>();
+        OS = std::make_unique<raw_svector_ostream>(*Uncompressed);
+      } else {
+        OS = std::make_unique<raw_fd_ostream>(Temp->FD,
+                                              /* ShouldClose */ false);
+      }
       return std::make_unique<CacheStream>(
-          std::make_unique<raw_fd_ostream>(Temp->FD, /* ShouldClose */ false),
-          AddBuffer, std::move(*Temp), EntryPath.str(), Task);
+          std::move(OS), AddBuffer, std::move(*Temp), CacheDir, EntryName,
+          EntryPath.str(), Task, UseMemory, std::move(Uncompressed));
     };
   };
 }
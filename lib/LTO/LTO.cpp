@@ -38,6 +38,7 @@
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/Threading.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/VCSRevision.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
@@ -48,6 +49,7 @@
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
 #include "llvm/Transforms/Utils/SplitModule.h"
 
+#include <numeric>
 #include <set>
 
 using namespace llvm;
@@ -60,6 +62,11 @@ static cl::opt<bool>
     DumpThinCGSCCs("dump-thin-cg-sccs", cl::init(false), cl::Hidden,
                    cl::desc("Dump the SCCs in the ThinLTO index's callgraph"));
 
+static cl::opt<bool> ThinLTOLargestFirst(
+    "thinlto-largest-first", cl::init(true), cl::Hidden,
+    cl::desc("Start the in-process ThinLTO backends of the modules with the "
+             "largest estimated cost first"));
+
 /// Enable global value internalization in LTO.
 cl::opt<bool> EnableLTOInternalization(
     "enable-lto-internalization", cl::init(true), cl::Hidden,
@@ -1042,6 +1049,10 @@ public:
       const std::map<GlobalValue::GUID, GlobalValue::LinkageTypes> &ResolvedODR,
       MapVector<StringRef, BitcodeModule> &ModuleMap) = 0;
   virtual Error wait() = 0;
+
+  /// Whether the output of this backend depends on the order in which the
+  /// modules are started, e.g. because it lists them in a file.
+  virtual bool isSensitiveToInputOrder() { return false; }
 };
 
 namespace {
@@ -1062,7 +1073,7 @@ public:
       const StringMap<GVSummaryMapTy> &ModuleToDefinedGVSummaries,
       AddStreamFn AddStream, NativeObjectCache Cache)
       : ThinBackendProc(Conf, CombinedIndex, ModuleToDefinedGVSummaries),
-        BackendThreadPool(ThinLTOParallelismLevel),
+        BackendThreadPool(ThreadPool::getGlobal(), ThinLTOParallelismLevel),
         AddStream(std::move(AddStream)), Cache(std::move(Cache)) {
     for (auto &Name : CombinedIndex.cfiFunctionDefs())
       CfiFunctionDefs.insert(
@@ -1128,9 +1139,23 @@ public:
                 &ResolvedODR,
             const GVSummaryMapTy &DefinedGlobals,
             MapVector<StringRef, BitcodeModule> &ModuleMap) {
-          Error E = runThinLTOBackendThread(
-              AddStream, Cache, Task, BM, CombinedIndex, ImportList, ExportList,
-              ResolvedODR, DefinedGlobals, ModuleMap);
+          // Backends run on pool threads, each of which records into a
+          // profiler of its own that is handed back once the module is done.
+          // A thread that already profiles (e.g. the main thread when there
+          // are no worker threads) just nests the section.
+          bool OwnsProfiler =
+              Conf.TimeTraceEnabled && !timeTraceProfilerEnabled();
+          if (OwnsProfiler)
+            timeTraceProfilerInitialize(Conf.TimeTraceGranularity);
+          Error E = [&] {
+            TimeTraceScope TimeScope("ThinLTO backend",
+                                     BM.getModuleIdentifier());
+            return runThinLTOBackendThread(
+                AddStream, Cache, Task, BM, CombinedIndex, ImportList,
+                ExportList, ResolvedODR, DefinedGlobals, ModuleMap);
+          }();
+          if (OwnsProfiler)
+            timeTraceProfilerFinishThread();
           if (E) {
             std::unique_lock<std::mutex> L(ErrMu);
             if (Err)
@@ -1239,6 +1264,11 @@ public:
   }
 
   Error wait() override { return Error::success(); }
+
+  bool isSensitiveToInputOrder() override {
+    // The order of the module paths in LinkedObjectsFile matters.
+    return true;
+  }
 };
 } // end anonymous namespace
 
@@ -1254,6 +1284,28 @@ ThinBackend lto::createWriteIndexesThinBackend(
   };
 }
 
+/// Estimate how long the backend of a module takes from the number of
+/// instructions of the functions it defines and of the ones it imports.
+static uint64_t
+estimateThinLTOBackendCost(const ModuleSummaryIndex &Index,
+                           const GVSummaryMapTy &DefinedGlobals,
+                           const FunctionImporter::ImportMapTy &ImportList) {
+  uint64_t Cost = 0;
+  for (auto &DefinedGlobal : DefinedGlobals)
+    if (auto *FS = dyn_cast<FunctionSummary>(DefinedGlobal.second))
+      Cost += FS->instCount();
+  for (auto &ImportedModule : ImportList)
+    for (GlobalValue::GUID GUID : ImportedModule.second) {
+      // Count each imported value at least once, even if it has no function
+      // summary, since importing it has a cost of its own.
+      ++Cost;
+      if (auto *S = Index.findSummaryInModule(GUID, ImportedModule.first()))
+        if (auto *FS = dyn_cast<FunctionSummary>(S->getBaseObject()))
+          Cost += FS->instCount();
+    }
+  return Cost;
+}
+
 Error LTO::runThinLTO(AddStreamFn AddStream, NativeObjectCache Cache,
                       const DenseSet<GlobalValue::GUID> &GUIDPreservedSymbols) {
   if (ThinLTO.ModuleMap.empty())
@@ -1359,14 +1411,34 @@ Error LTO::runThinLTO(AddStreamFn AddStream, NativeObjectCache Cache,
                       AddStream, Cache);
 
   // Tasks 0 through ParallelCodeGenParallelismLevel-1 are reserved for combined
-  // module and parallel code generation partitions.
-  unsigned Task = RegularLTO.ParallelCodeGenParallelismLevel;
-  for (auto &Mod : ThinLTO.ModuleMap) {
-    if (Error E = BackendProc->start(Task, Mod.second, ImportLists[Mod.first],
+  // module and parallel code generation partitions. Each module keeps the task
+  // of its position in ModuleMap, whatever order the backends are started in,
+  // so that the output does not depend on the scheduling.
+  unsigned FirstTask = RegularLTO.ParallelCodeGenParallelismLevel;
+  std::vector<unsigned> ModuleOrder(ThinLTO.ModuleMap.size());
+  std::iota(ModuleOrder.begin(), ModuleOrder.end(), 0);
+  if (ThinLTOLargestFirst && !BackendProc->isSensitiveToInputOrder()) {
+    // The backends run concurrently, so starting a huge module last leaves
+    // it running alone at the end of the link. Start the modules that are
+    // expected to take the longest first instead.
+    std::vector<uint64_t> Costs;
+    Costs.reserve(ThinLTO.ModuleMap.size());
+    for (auto &Mod : ThinLTO.ModuleMap)
+      Costs.push_back(estimateThinLTOBackendCost(
+          ThinLTO.CombinedIndex, ModuleToDefinedGVSummaries[Mod.first],
+          ImportLists[Mod.first]));
+    llvm::stable_sort(ModuleOrder, [&](unsigned LHS, unsigned RHS) {
+      return Costs[LHS] > Costs[RHS];
+    });
+  }
+
+  for (unsigned I : ModuleOrder) {
+    auto &Mod = *(ThinLTO.ModuleMap.begin() + I);
+    if (Error E = BackendProc->start(FirstTask + I, Mod.second,
+                                     ImportLists[Mod.first],
                                      ExportLists[Mod.first],
                                      ResolvedODR[Mod.first], ThinLTO.ModuleMap))
       return E;
-    ++Task;
   }
 
   return BackendProc->wait();
@@ -353,7 +353,8 @@ void codegen(Config &Conf, TargetMachine *TM, AddStreamFn AddStream,
 void splitCodeGen(Config &C, TargetMachine *TM, AddStreamFn AddStream,
                   unsigned ParallelCodeGenParallelismLevel,
                   std::unique_ptr<Module> Mod) {
-  ThreadPool CodegenThreadPool(ParallelCodeGenParallelismLevel);
+  ThreadPool CodegenThreadPool(ThreadPool::getGlobal(),
+                               ParallelCodeGenParallelismLevel);
   unsigned ThreadCount = 0;
   const Target *T = &TM->getTarget();
 
@@ -390,7 +391,8 @@ void splitCodeGen(Config &C, TargetMachine *TM, AddStreamFn AddStream,
             // copied into the thread's context.
             std::move(BC), ThreadCount++);
       },
-      false);
+      false,
+      [&](const GlobalValue &GV) { return TM->isAllocatedPerEntryPoint(GV); });
 
   // Because the inner lambda (which runs in a worker thread) captures our local
   // variables, we need to wait for the worker threads to terminate before we
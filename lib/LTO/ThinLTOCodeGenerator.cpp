@@ -346,6 +346,12 @@ public:
   // Access the path to this entry in the cache.
   StringRef getEntryPath() { return EntryPath; }
 
+  // Record a use of this entry in the index of the cache, if it has one.
+  void recordUse(uint64_t Size) {
+    recordCacheIndexUse(sys::path::parent_path(EntryPath),
+                        sys::path::filename(EntryPath), Size);
+  }
+
   // Try loading the buffer for this cache entry.
   ErrorOr<std::unique_ptr<MemoryBuffer>> tryLoadingBuffer() {
     if (EntryPath.empty())
@@ -358,6 +364,8 @@ public:
     ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr = MemoryBuffer::getOpenFile(
         *FDOrErr, EntryPath, /*FileSize=*/-1, /*RequiresNullTerminator=*/false);
     sys::fs::closeFile(*FDOrErr);
+    if (MBOrErr)
+      recordUse((*MBOrErr)->getBufferSize());
     return MBOrErr;
   }
 
@@ -372,9 +380,14 @@ public:
     llvm::sys::path::remove_filename(CachePath);
     sys::path::append(TempFilename, CachePath, "Thin-%%%%%%.tmp.o");
 
+    Error WriteErr = llvm::writeFileAtomically(TempFilename, EntryPath,
+                                               OutputBuffer.getBuffer());
+    if (!WriteErr) {
+      recordUse(OutputBuffer.getBufferSize());
+      return;
+    }
     if (auto Err = handleErrors(
-            llvm::writeFileAtomically(TempFilename, EntryPath,
-                                      OutputBuffer.getBuffer()),
+            std::move(WriteErr),
             [](const llvm::AtomicFileWriteError &E) {
               std::string ErrorMsgBuffer;
               llvm::raw_string_ostream S(ErrorMsgBuffer);
@@ -893,7 +906,7 @@ void ThinLTOCodeGenerator::run() {
 
   if (CodeGenOnly) {
     // Perform only parallel codegen and return.
-    ThreadPool Pool;
+    ThreadPool Pool(ThreadPool::getGlobal(), 0);
     int count = 0;
     for (auto &Mod : Modules) {
       Pool.async([&](int count) {
@@ -1009,7 +1022,7 @@ void ThinLTOCodeGenerator::run() {
 
   // Parallel optimizer + codegen
   {
-    ThreadPool Pool(ThreadCount);
+    ThreadPool Pool(ThreadPool::getGlobal(), ThreadCount);
     for (auto IndexCount : ModulesOrdering) {
       auto &Mod = Modules[IndexCount];
       Pool.async([&](int count) {
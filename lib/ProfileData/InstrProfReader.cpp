@@ -38,9 +38,10 @@
 using namespace llvm;
 
 static Expected<std::unique_ptr<MemoryBuffer>>
-setupMemoryBuffer(const Twine &Path) {
+setupMemoryBuffer(const Twine &Path, bool RequiresNullTerminator = true) {
   ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
-      MemoryBuffer::getFileOrSTDIN(Path);
+      MemoryBuffer::getFileOrSTDIN(Path, /*FileSize=*/-1,
+                                   RequiresNullTerminator);
   if (std::error_code EC = BufferOrErr.getError())
     return errorCodeToError(EC);
   return std::move(BufferOrErr.get());
@@ -90,8 +91,11 @@ InstrProfReader::create(std::unique_ptr<MemoryBuffer> Buffer) {
 
 Expected<std::unique_ptr<IndexedInstrProfReader>>
 IndexedInstrProfReader::create(const Twine &Path, const Twine &RemappingPath) {
-  // Set up the buffer to read.
-  auto BufferOrError = setupMemoryBuffer(Path);
+  // Set up the buffer to read. The indexed format needs no null terminator, so
+  // large profiles are always mapped rather than read in: only the pages of
+  // the header and of the functions that are looked up get touched.
+  auto BufferOrError =
+      setupMemoryBuffer(Path, /*RequiresNullTerminator=*/false);
   if (Error E = BufferOrError.takeError())
     return std::move(E);
 
@@ -665,8 +669,18 @@ public:
   }
 
   Error populateRemappings() override {
-    if (Error E = Remappings.read(*RemapBuffer))
-      return E;
+    // Only read the remapping file here. Matching it up with the names of the
+    // profile walks every key of the profile, so that is left to the first
+    // lookup of a name that is not in the profile as it is.
+    return Remappings.read(*RemapBuffer);
+  }
+
+  /// Map the equivalence classes of the remapping file to the names of the
+  /// profile that belong to them.
+  void populateMappedNames() {
+    if (MappedNamesPopulated)
+      return;
+    MappedNamesPopulated = true;
     for (StringRef Name : Underlying.HashTable->keys()) {
       StringRef RealName = extractName(Name);
       if (auto Key = Remappings.insert(RealName)) {
@@ -676,11 +690,25 @@ public:
         MappedNames.insert({Key, RealName});
       }
     }
-    return Error::success();
   }
 
   Error getRecords(StringRef FuncName,
                    ArrayRef<NamedInstrProfRecord> &Data) override {
+    // A name that is in the profile needs no remapping.
+    bool Unknown = false;
+    if (Error Unhandled = handleErrors(
+            Underlying.getRecords(FuncName, Data),
+            [&](std::unique_ptr<InstrProfError> Err) -> Error {
+              if (Err->get() != instrprof_error::unknown_function)
+                return Error(std::move(Err));
+              Unknown = true;
+              return Error::success();
+            }))
+      return Unhandled;
+    if (!Unknown)
+      return Error::success();
+
+    populateMappedNames();
     StringRef RealName = extractName(FuncName);
     if (auto Key = Remappings.lookup(RealName)) {
       StringRef Remapped = MappedNames.lookup(Key);
@@ -725,6 +753,9 @@ private:
   /// redoing lookup?
   DenseMap<SymbolRemappingReader::Key, StringRef> MappedNames;
 
+  /// Whether MappedNames was populated yet.
+  bool MappedNamesPopulated = false;
+
   /// The real profile data reader.
   InstrProfReaderIndex<HashTableImpl> &Underlying;
 };
@@ -284,7 +284,8 @@ static void setSummary(IndexedInstrProf::Summary *TheSummary,
     TheSummary->setEntry(I, Res[I]);
 }
 
-void InstrProfWriter::writeImpl(ProfOStream &OS) {
+void InstrProfWriter::writeImpl(ProfOStream &OS,
+                                ArrayRef<InstrProfWriter *> Shards) {
   using namespace IndexedInstrProf;
 
   OnDiskChainedHashTableGenerator<InstrProfRecordWriterTrait> Generator;
@@ -295,9 +296,13 @@ void InstrProfWriter::writeImpl(ProfOStream &OS) {
   InfoObj->CSSummaryBuilder = &CSISB;
 
   // Populate the hash table generator.
-  for (const auto &I : FunctionData)
-    if (shouldEncodeData(I.getValue()))
-      Generator.insert(I.getKey(), &I.getValue());
+  for (const InstrProfWriter *Shard : Shards) {
+    assert(Shard->ProfileKind == ProfileKind &&
+           "Shards should have the same profile kind");
+    for (const auto &I : Shard->FunctionData)
+      if (shouldEncodeData(I.getValue()))
+        Generator.insert(I.getKey(), &I.getValue());
+  }
   // Write the header.
   IndexedInstrProf::Header Header;
   Header.Magic = IndexedInstrProf::Magic;
@@ -377,7 +382,15 @@ void InstrProfWriter::writeImpl(ProfOStream &OS) {
 void InstrProfWriter::write(raw_fd_ostream &OS) {
   // Write the hash table.
   ProfOStream POS(OS);
-  writeImpl(POS);
+  writeImpl(POS, this);
+}
+
+void InstrProfWriter::writeShards(ArrayRef<InstrProfWriter *> Shards,
+                                  raw_fd_ostream &OS) {
+  assert(!Shards.empty() && "Expected at least one shard");
+  // Write the hash table of all the shards.
+  ProfOStream POS(OS);
+  Shards.front()->writeImpl(POS, Shards);
 }
 
 std::unique_ptr<MemoryBuffer> InstrProfWriter::writeBuffer() {
@@ -385,7 +398,7 @@ std::unique_ptr<MemoryBuffer> InstrProfWriter::writeBuffer() {
   raw_string_ostream OS(Data);
   ProfOStream POS(OS);
   // Write the hash table.
-  writeImpl(POS);
+  writeImpl(POS, this);
   // Return this in an aligned memory buffer.
   return MemoryBuffer::getMemBufferCopy(Data);
 }
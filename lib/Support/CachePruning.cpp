@@ -12,10 +12,14 @@
 
 #include "llvm/Support/CachePruning.h"
 
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Chrono.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Errc.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -41,6 +45,222 @@ struct FileInfo {
 };
 } // anonymous namespace
 
+/// The index of a cache directory is a text file with one line per use of an
+/// entry: "<time of use> <size> <entry name>". Uses are only ever appended, so
+/// an entry may appear several times; the latest use wins.
+///
+/// An append-only log is used rather than a memory-mapped table of records
+/// updated in place, because appends of whole lines are safe from several
+/// processes without a lock, and a torn append costs one record only. To keep
+/// the log bounded, it is compacted to one line per entry whenever the uses
+/// appended since it was last rewritten outweigh the records it was rewritten
+/// with. The log then stays within twice the size of its records, and reading
+/// it while pruning or compacting costs O(1) amortized per recorded use.
+///
+/// A pruner or compactor holds a LockFileManager lock on the index, i.e. the
+/// file "llvmcache.index.lock", while it moves the index aside and replaces
+/// it. "llvmcache.index.size" holds the size of the index when it was last
+/// rewritten. The modification time of "llvmcache.index.walk" is the time of
+/// the last directory walk that reconciled the index with the directory.
+static const char IndexFileName[] = "llvmcache.index";
+static const char IndexSizeFileName[] = "llvmcache.index.size";
+static const char IndexWalkFileName[] = "llvmcache.index.walk";
+
+/// An index smaller than this is never compacted when a use is recorded; it
+/// is left to the next pruning.
+static const uint64_t MinIndexCompactionSize = 64 * 1024;
+
+namespace {
+struct IndexRecord {
+  sys::TimePoint<> Time;
+  uint64_t Size;
+};
+} // anonymous namespace
+
+static void writeIndexRecord(raw_ostream &OS, sys::TimePoint<> Time,
+                             uint64_t Size, StringRef EntryName) {
+  OS << int64_t(sys::toTimeT(Time)) << ' ' << Size << ' ' << EntryName << '\n';
+}
+
+/// Read the records of the index file \p IndexFile into \p Records. Lines
+/// that cannot be parsed, e.g. because an append was torn, are ignored.
+static void readIndexFile(StringRef IndexFile,
+                          StringMap<IndexRecord> &Records) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
+      MemoryBuffer::getFile(IndexFile, /*FileSize=*/-1,
+                            /*RequiresNullTerminator=*/false);
+  if (!MBOrErr)
+    return;
+  StringRef Rest = (*MBOrErr)->getBuffer();
+  while (!Rest.empty()) {
+    StringRef Line;
+    std::tie(Line, Rest) = Rest.split('\n');
+    StringRef TimeStr, SizeStr, EntryName;
+    std::tie(TimeStr, Line) = Line.split(' ');
+    std::tie(SizeStr, EntryName) = Line.split(' ');
+    int64_t Time;
+    uint64_t Size;
+    // Only accept cache entries, as the directory walk does.
+    if (TimeStr.getAsInteger(10, Time) || SizeStr.getAsInteger(10, Size) ||
+        !EntryName.startswith("llvmcache-") ||
+        EntryName.find_first_of("/\\") != StringRef::npos)
+      continue;
+    IndexRecord Record{sys::toTimePoint(Time), Size};
+    auto Inserted = Records.try_emplace(EntryName, Record);
+    if (!Inserted.second && Inserted.first->second.Time <= Record.Time)
+      Inserted.first->second = Record;
+  }
+}
+
+/// Move the index \p IndexFile aside, start a new one right away, so that the
+/// uses recorded in the meantime are kept, and read the records of both into
+/// \p Records. The caller holds the lock of the index. Returns false if there
+/// was no index.
+static bool takeIndexRecords(StringRef IndexFile,
+                             StringMap<IndexRecord> &Records) {
+  SmallString<128> OldIndexFile(IndexFile);
+  OldIndexFile += ".prune";
+  bool HaveIndex = !sys::fs::rename(IndexFile, OldIndexFile);
+  int FD;
+  if (!sys::fs::openFileForWrite(IndexFile, FD, sys::fs::CD_OpenAlways,
+                                 sys::fs::OF_Append))
+    sys::fs::closeFile(FD);
+  if (!HaveIndex)
+    return false;
+  readIndexFile(OldIndexFile, Records);
+  readIndexFile(IndexFile, Records);
+  sys::fs::remove(OldIndexFile);
+  return true;
+}
+
+/// Record the size of the index of the cache directory \p Path, which was
+/// just rewritten, for recordCacheIndexUse() to tell when to compact it.
+static void writeIndexSize(StringRef Path) {
+  SmallString<128> IndexFile(Path);
+  sys::path::append(IndexFile, IndexFileName);
+  uint64_t Size;
+  if (sys::fs::file_size(IndexFile, Size))
+    return;
+  SmallString<128> IndexSizeFile(Path);
+  sys::path::append(IndexSizeFile, IndexSizeFileName);
+  std::error_code EC;
+  raw_fd_ostream OS(IndexSizeFile, EC, sys::fs::OF_None);
+  if (!EC)
+    OS << Size;
+}
+
+/// Return the size of the index of the cache directory \p Path when it was
+/// last rewritten, or 0 if it never was.
+static uint64_t readIndexSize(StringRef Path) {
+  SmallString<128> IndexSizeFile(Path);
+  sys::path::append(IndexSizeFile, IndexSizeFileName);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
+      MemoryBuffer::getFile(IndexSizeFile);
+  uint64_t Size;
+  if (!MBOrErr || (*MBOrErr)->getBuffer().getAsInteger(10, Size))
+    return 0;
+  return Size;
+}
+
+/// Rewrite the index of the cache directory \p Path with one record per
+/// entry, unless it is locked by a pruner or another compactor.
+static void compactIndex(StringRef Path) {
+  SmallString<128> IndexFile(Path);
+  sys::path::append(IndexFile, IndexFileName);
+  LockFileManager IndexLock(IndexFile);
+  if (IndexLock != LockFileManager::LFS_Owned)
+    return;
+  StringMap<IndexRecord> Records;
+  if (!takeIndexRecords(IndexFile, Records))
+    return;
+  int FD;
+  if (sys::fs::openFileForWrite(IndexFile, FD, sys::fs::CD_OpenExisting,
+                                sys::fs::OF_Append))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    for (const auto &Record : Records)
+      writeIndexRecord(OS, Record.getValue().Time, Record.getValue().Size,
+                       Record.getKey());
+  }
+  writeIndexSize(Path);
+}
+
+/// Walk the cache directory \p Path and return a record for every entry in
+/// it. The time of use is the later of the access time of the file and of its
+/// record in \p Indexed, if any.
+static StringMap<IndexRecord>
+walkCacheDirectory(StringRef Path, const StringMap<IndexRecord> &Indexed) {
+  StringMap<IndexRecord> Records;
+  std::error_code EC;
+  SmallString<128> CachePathNative;
+  sys::path::native(Path, CachePathNative);
+  // Walk all of the files within this directory.
+  for (sys::fs::directory_iterator File(CachePathNative, EC), FileEnd;
+       File != FileEnd && !EC; File.increment(EC)) {
+    // Ignore any files not beginning with the string "llvmcache-". This
+    // includes the timestamp file as well as any files created by the user.
+    // This acts as a safeguard against data loss if the user specifies the
+    // wrong directory as their cache directory.
+    StringRef EntryName = sys::path::filename(File->path());
+    if (!EntryName.startswith("llvmcache-"))
+      continue;
+
+    // Look at this file. If we can't stat it, there's nothing interesting
+    // there.
+    ErrorOr<sys::fs::basic_file_status> StatusOrErr = File->status();
+    if (!StatusOrErr) {
+      LLVM_DEBUG(dbgs() << "Ignore " << File->path() << " (can't stat)\n");
+      continue;
+    }
+
+    IndexRecord Record{StatusOrErr->getLastAccessedTime(),
+                       StatusOrErr->getSize()};
+    auto I = Indexed.find(EntryName);
+    if (I != Indexed.end())
+      Record.Time = std::max(Record.Time, I->second.Time);
+    Records[EntryName] = Record;
+  }
+  return Records;
+}
+
+void llvm::recordCacheIndexUse(StringRef Path, StringRef EntryName,
+                               uint64_t Size) {
+  SmallString<128> IndexFile(Path);
+  sys::path::append(IndexFile, IndexFileName);
+  // Opening for append creates missing files, so only create the index while
+  // a pruner holds the lock: it may have moved the index aside and not
+  // created the new one yet, and reads it before replacing it. A pruner
+  // creates the new index before releasing the lock, so if the lock is gone
+  // by now, the index is there again unless the cache has none.
+  if (!sys::fs::exists(IndexFile)) {
+    SmallString<128> LockFile(IndexFile);
+    LockFile += ".lock";
+    if (!sys::fs::exists(LockFile) && !sys::fs::exists(IndexFile))
+      return;
+  }
+  int FD;
+  if (sys::fs::openFileForWrite(IndexFile, FD, sys::fs::CD_OpenAlways,
+                                sys::fs::OF_Append))
+    return;
+  // Build the whole record first so that it is appended with a single write
+  // and does not interleave with the records of other processes.
+  SmallString<128> Record;
+  raw_svector_ostream RecordOS(Record);
+  writeIndexRecord(RecordOS, std::chrono::system_clock::now(), Size, EntryName);
+  sys::fs::file_status Status;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/false, /*unbuffered=*/true);
+    OS << Record;
+  }
+  std::error_code EC = sys::fs::status(FD, Status);
+  sys::fs::closeFile(FD);
+  if (EC || Status.getSize() < MinIndexCompactionSize ||
+      Status.getSize() <= 2 * readIndexSize(Path))
+    return;
+  compactIndex(Path);
+}
+
 /// Write a new timestamp file with the given path. This is used for the pruning
 /// interval option.
 static void writeTimestampFile(StringRef TimestampFile) {
@@ -131,6 +351,16 @@ llvm::parseCachePruningPolicy(StringRef PolicyStr) {
       if (Value.getAsInteger(0, Policy.MaxSizeFiles))
         return make_error<StringError>("'" + Value + "' not an integer",
                                        inconvertibleErrorCode());
+    } else if (Key == "cache_index") {
+      if (Value != "0" && Value != "1")
+        return make_error<StringError>("'" + Value + "' must be 0 or 1",
+                                       inconvertibleErrorCode());
+      Policy.UseIndex = Value == "1";
+    } else if (Key == "index_walk_interval") {
+      auto DurationOrErr = parseDuration(Value);
+      if (!DurationOrErr)
+        return DurationOrErr.takeError();
+      Policy.IndexWalkInterval = *DurationOrErr;
     } else {
       return make_error<StringError>("Unknown key: '" + Key + "'",
                                      inconvertibleErrorCode());
@@ -204,42 +434,64 @@ bool llvm::pruneCache(StringRef Path, CachePruningPolicy Policy) {
   std::set<FileInfo> FileInfos;
   uint64_t TotalSize = 0;
 
-  // Walk the entire directory cache, looking for unused files.
-  std::error_code EC;
-  SmallString<128> CachePathNative;
-  sys::path::native(Path, CachePathNative);
-  // Walk all of the files within this directory.
-  for (sys::fs::directory_iterator File(CachePathNative, EC), FileEnd;
-       File != FileEnd && !EC; File.increment(EC)) {
-    // Ignore any files not beginning with the string "llvmcache-". This
-    // includes the timestamp file as well as any files created by the user.
-    // This acts as a safeguard against data loss if the user specifies the
-    // wrong directory as their cache directory.
-    if (!sys::path::filename(File->path()).startswith("llvmcache-"))
-      continue;
-
-    // Look at this file. If we can't stat it, there's nothing interesting
-    // there.
-    ErrorOr<sys::fs::basic_file_status> StatusOrErr = File->status();
-    if (!StatusOrErr) {
-      LLVM_DEBUG(dbgs() << "Ignore " << File->path() << " (can't stat)\n");
-      continue;
-    }
-
+  auto AddFile = [&](sys::TimePoint<> FileAccessTime, uint64_t FileSize,
+                     std::string FilePath) {
     // If the file hasn't been used recently enough, delete it
-    const auto FileAccessTime = StatusOrErr->getLastAccessedTime();
     auto FileAge = CurrentTime - FileAccessTime;
     if (Policy.Expiration != seconds(0) && FileAge > Policy.Expiration) {
-      LLVM_DEBUG(dbgs() << "Remove " << File->path() << " ("
+      LLVM_DEBUG(dbgs() << "Remove " << FilePath << " ("
                         << duration_cast<seconds>(FileAge).count()
                         << "s old)\n");
-      sys::fs::remove(File->path());
-      continue;
+      sys::fs::remove(FilePath);
+      return;
     }
 
     // Leave it here for now, but add it to the list of size-based pruning.
-    TotalSize += StatusOrErr->getSize();
-    FileInfos.insert({FileAccessTime, StatusOrErr->getSize(), File->path()});
+    TotalSize += FileSize;
+    FileInfos.insert({FileAccessTime, FileSize, std::move(FilePath)});
+  };
+
+  // With an index, move the current one aside and start a new one right away,
+  // so that the uses recorded while we prune are kept. Pruners of the same
+  // directory exclude each other, so that only one moves the index at a time.
+  // Read the entries from the index, which costs a read of the index instead
+  // of a stat of every file in the directory.
+  SmallString<128> IndexFile(Path);
+  sys::path::append(IndexFile, IndexFileName);
+  Optional<LockFileManager> IndexLock;
+  StringMap<IndexRecord> Records;
+  bool HaveIndex = false;
+  if (Policy.UseIndex) {
+    IndexLock.emplace(IndexFile);
+    if (*IndexLock != LockFileManager::LFS_Owned) {
+      LLVM_DEBUG(dbgs() << "Index is locked, do not prune.\n");
+      return false;
+    }
+    HaveIndex = takeIndexRecords(IndexFile, Records);
+  }
+
+  // Walk the entire directory cache without an index, and from time to time
+  // with one, to pick up the entries whose uses were not recorded and to
+  // forget the ones that are gone.
+  bool Walk = !HaveIndex;
+  SmallString<128> IndexWalkFile(Path);
+  sys::path::append(IndexWalkFile, IndexWalkFileName);
+  if (HaveIndex && Policy.IndexWalkInterval) {
+    sys::fs::file_status WalkStatus;
+    Walk = sys::fs::status(IndexWalkFile, WalkStatus) ||
+           CurrentTime - WalkStatus.getLastModificationTime() >=
+               *Policy.IndexWalkInterval;
+  }
+  if (Walk) {
+    Records = walkCacheDirectory(Path, Records);
+    if (Policy.UseIndex)
+      writeTimestampFile(IndexWalkFile);
+  }
+
+  for (const auto &Record : Records) {
+    SmallString<128> FilePath(Path);
+    sys::path::append(FilePath, Record.getKey());
+    AddFile(Record.getValue().Time, Record.getValue().Size, FilePath.str());
   }
 
   auto FileInfo = FileInfos.begin();
@@ -288,5 +540,18 @@ bool llvm::pruneCache(StringRef Path, CachePruningPolicy Policy) {
     while (TotalSize > TotalSizeTarget && FileInfo != FileInfos.end())
       RemoveCacheFile();
   }
+
+  // Carry the entries that were kept over to the new index.
+  if (Policy.UseIndex) {
+    int FD;
+    if (!sys::fs::openFileForWrite(IndexFile, FD, sys::fs::CD_OpenExisting,
+                                   sys::fs::OF_Append)) {
+      raw_fd_ostream OS(FD, /*shouldClose=*/true);
+      for (; FileInfo != FileInfos.end(); ++FileInfo)
+        writeIndexRecord(OS, FileInfo->Time, FileInfo->Size,
+                         sys::path::filename(FileInfo->Path));
+    }
+    writeIndexSize(Path);
+  }
   return true;
 }
@@ -11,133 +11,78 @@
 
 #if LLVM_ENABLE_THREADS
 
-#include "llvm/Support/Threading.h"
+#include "llvm/Support/ThreadPool.h"
 
-#include <atomic>
-#include <stack>
-#include <thread>
+#include <deque>
 
 namespace llvm {
 namespace parallel {
 namespace detail {
 
-namespace {
-
-/// An abstract class that takes closures and runs them asynchronously.
-class Executor {
-public:
-  virtual ~Executor() = default;
-  virtual void add(std::function<void()> func) = 0;
-
-  static Executor *getDefaultExecutor();
-};
-
-#if defined(_MSC_VER)
-/// An Executor that runs tasks via ConcRT.
-class ConcRTExecutor : public Executor {
-  struct Taskish {
-    Taskish(std::function<void()> Task) : Task(Task) {}
-
-    std::function<void()> Task;
-
-    static void run(void *P) {
-      Taskish *Self = static_cast<Taskish *>(P);
-      Self->Task();
-      concurrency::Free(Self);
-    }
-  };
-
-public:
-  virtual void add(std::function<void()> F) {
-    Concurrency::CurrentScheduler::ScheduleTask(
-        Taskish::run, new (concurrency::Alloc(sizeof(Taskish))) Taskish(F));
+// Tasks run on the process-wide ThreadPool, shared with every other client of
+// the pool, so that nested parallel algorithms and concurrent users such as
+// the ThinLTO backends do not oversubscribe the machine.
+//
+// The pool is only given a ticket for each task. A ticket runs the first task
+// of the group still waiting when it starts, or nothing if sync() ran them all
+// in the meantime, which is why tickets share the ownership of the state.
+struct TaskGroup::State {
+  std::mutex Mutex;
+  std::condition_variable Cond;
+  std::deque<std::function<void()>> Queued;
+  /// Tasks spawned and not yet finished.
+  unsigned Pending = 0;
+
+  /// Run the first queued task, with \p Lock held on Mutex. Return false if
+  /// none is queued.
+  bool runQueued(std::unique_lock<std::mutex> &Lock) {
+    if (Queued.empty())
+      return false;
+    std::function<void()> F = std::move(Queued.front());
+    Queued.pop_front();
+    Lock.unlock();
+    F();
+    Lock.lock();
+    if (--Pending == 0)
+      Cond.notify_all();
+    return true;
   }
 };
 
-Executor *Executor::getDefaultExecutor() {
-  static ConcRTExecutor exec;
-  return &exec;
-}
+TaskGroup::TaskGroup() : S(std::make_shared<State>()) {}
 
-#else
-/// An implementation of an Executor that runs closures on a thread pool
-///   in filo order.
-class ThreadPoolExecutor : public Executor {
-public:
-  explicit ThreadPoolExecutor(unsigned ThreadCount = hardware_concurrency())
-      : Done(ThreadCount) {
-    // Spawn all but one of the threads in another thread as spawning threads
-    // can take a while.
-    std::thread([&, ThreadCount] {
-      for (size_t i = 1; i < ThreadCount; ++i) {
-        std::thread([=] { work(); }).detach();
-      }
-      work();
-    }).detach();
-  }
+TaskGroup::~TaskGroup() { sync(); }
 
-  ~ThreadPoolExecutor() override {
-    std::unique_lock<std::mutex> Lock(Mutex);
-    Stop = true;
-    Lock.unlock();
-    Cond.notify_all();
-    // Wait for ~Latch.
-  }
-
-  void add(std::function<void()> F) override {
-    std::unique_lock<std::mutex> Lock(Mutex);
-    WorkStack.push(F);
-    Lock.unlock();
-    Cond.notify_one();
-  }
-
-private:
-  void work() {
-    while (true) {
-      std::unique_lock<std::mutex> Lock(Mutex);
-      Cond.wait(Lock, [&] { return Stop || !WorkStack.empty(); });
-      if (Stop)
-        break;
-      auto Task = WorkStack.top();
-      WorkStack.pop();
-      Lock.unlock();
-      Task();
-    }
-    Done.dec();
+void TaskGroup::spawn(std::function<void()> F) {
+  {
+    std::lock_guard<std::mutex> Lock(S->Mutex);
+    S->Queued.push_back(std::move(F));
+    ++S->Pending;
   }
-
-  std::atomic<bool> Stop{false};
-  std::stack<std::function<void()>> WorkStack;
-  std::mutex Mutex;
-  std::condition_variable Cond;
-  parallel::detail::Latch Done;
-};
-
-Executor *Executor::getDefaultExecutor() {
-  static ThreadPoolExecutor exec;
-  return &exec;
+  // A thread of the pool blocked in sync() may run the task itself.
+  S->Cond.notify_all();
+
+  std::shared_ptr<State> Shared = S;
+  ThreadPool::getGlobal().async([Shared] {
+    std::unique_lock<std::mutex> Lock(Shared->Mutex);
+    Shared->runQueued(Lock);
+  });
 }
-#endif
-}
-
-static std::atomic<int> TaskGroupInstances;
 
-// Latch::sync() called by the dtor may cause one thread to block. If is a dead
-// lock if all threads in the default executor are blocked. To prevent the dead
-// lock, only allow the first TaskGroup to run tasks parallelly. In the scenario
-// of nested parallel_for_each(), only the outermost one runs parallelly.
-TaskGroup::TaskGroup() : Parallel(TaskGroupInstances++ == 0) {}
-TaskGroup::~TaskGroup() { --TaskGroupInstances; }
+void TaskGroup::sync() const {
+  std::unique_lock<std::mutex> Lock(S->Mutex);
+  if (!ThreadPool::getGlobal().isWorkerThread()) {
+    S->Cond.wait(Lock, [&] { return !S->Pending; });
+    return;
+  }
 
-void TaskGroup::spawn(std::function<void()> F) {
-  if (Parallel) {
-    L.inc();
-    Executor::getDefaultExecutor()->add([&, F] {
-      F();
-      L.dec();
-    });
-  } else {
-    F();
+  // On a thread of the pool, tasks of the group may be queued behind the one
+  // waiting here, and blocking would deadlock once every thread waits. Run
+  // them here instead, and only block while all of them have started on
+  // other threads, which may still spawn more.
+  while (S->Pending) {
+    if (!S->runQueued(Lock))
+      S->Cond.wait(Lock, [&] { return !S->Pending || !S->Queued.empty(); });
   }
 }
 
@@ -6,13 +6,15 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file implements a crude C++11 based thread pool.
+// This file implements a work-stealing C++11 based thread pool.
 //
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Support/ThreadPool.h"
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -20,90 +22,430 @@ using namespace llvm;
 
 #if LLVM_ENABLE_THREADS
 
+/// The pool and deque index of the current thread, if it is a pool thread.
+static LLVM_THREAD_LOCAL ThreadPool *CurrentPool = nullptr;
+static LLVM_THREAD_LOCAL unsigned CurrentQueue = 0;
+
+/// A Chase-Lev work-stealing deque (see "Correct and Efficient Work-Stealing
+/// for Weak Memory Models", Le et al., PPoPP 2013). Only the owning thread may
+/// push and pop at the bottom, any thread may steal from the top.
+class ThreadPool::WorkQueue {
+  using T = PackagedTaskTy;
+
+  class Buffer {
+    int64_t Mask;
+    std::unique_ptr<std::atomic<T *>[]> Slots;
+
+  public:
+    explicit Buffer(int64_t Capacity)
+        : Mask(Capacity - 1), Slots(new std::atomic<T *>[Capacity]) {}
+
+    int64_t capacity() const { return Mask + 1; }
+    T *get(int64_t I) const {
+      return Slots[I & Mask].load(std::memory_order_relaxed);
+    }
+    void put(int64_t I, T *X) {
+      Slots[I & Mask].store(X, std::memory_order_relaxed);
+    }
+  };
+
+  std::atomic<int64_t> Top{0};
+  std::atomic<int64_t> Bottom{0};
+  std::atomic<Buffer *> Current;
+
+  /// All buffers ever used by this deque. Thieves may still read from a
+  /// buffer which has been replaced, so they are only freed with the deque.
+  std::vector<std::unique_ptr<Buffer>> Buffers;
+
+  Buffer *grow(Buffer *Old, int64_t TopIdx, int64_t BottomIdx) {
+    Buffers.push_back(std::make_unique<Buffer>(Old->capacity() * 2));
+    Buffer *New = Buffers.back().get();
+    for (int64_t I = TopIdx; I != BottomIdx; ++I)
+      New->put(I, Old->get(I));
+    Current.store(New, std::memory_order_release);
+    return New;
+  }
+
+public:
+  WorkQueue() {
+    Buffers.push_back(std::make_unique<Buffer>(64));
+    Current.store(Buffers.back().get(), std::memory_order_relaxed);
+  }
+
+  /// Push a task at the bottom. Owner only.
+  void push(T *X) {
+    int64_t B = Bottom.load(std::memory_order_relaxed);
+    int64_t TopIdx = Top.load(std::memory_order_acquire);
+    Buffer *Buf = Current.load(std::memory_order_relaxed);
+    if (B - TopIdx > Buf->capacity() - 1)
+      Buf = grow(Buf, TopIdx, B);
+    Buf->put(B, X);
+    Bottom.store(B + 1, std::memory_order_release);
+  }
+
+  /// Pop the most recently pushed task. Owner only.
+  T *pop() {
+    int64_t B = Bottom.load(std::memory_order_relaxed) - 1;
+    Buffer *Buf = Current.load(std::memory_order_relaxed);
+    Bottom.store(B, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t TopIdx = Top.load(std::memory_order_relaxed);
+    if (TopIdx > B) {
+      // Empty.
+      Bottom.store(B + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T *X = Buf->get(B);
+    if (TopIdx == B) {
+      // Last task, race against thieves.
+      if (!Top.compare_exchange_strong(TopIdx, TopIdx + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        X = nullptr;
+      Bottom.store(B + 1, std::memory_order_relaxed);
+    }
+    return X;
+  }
+
+  /// Steal the oldest task. Return null if the deque is empty or another
+  /// thread won the race for the task.
+  T *steal() {
+    int64_t TopIdx = Top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t B = Bottom.load(std::memory_order_acquire);
+    if (TopIdx >= B)
+      return nullptr;
+    T *X = Current.load(std::memory_order_acquire)->get(TopIdx);
+    if (!Top.compare_exchange_strong(TopIdx, TopIdx + 1,
+                                     std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return X;
+  }
+
+  bool empty() const {
+    return Bottom.load(std::memory_order_seq_cst) <=
+           Top.load(std::memory_order_seq_cst);
+  }
+};
+
+/// The tasks of a pool built on a parent which have not started yet. The
+/// parent is given a ticket for each concurrency slot in use. A ticket runs the
+/// first task in line when it starts, or nothing if wait() ran them all in the
+/// meantime, which is why tickets share the ownership of this queue.
+struct ThreadPool::ForwardQueue {
+  ThreadPool &Parent;
+  /// The pool owning the tasks, alive as long as one of them is queued.
+  ThreadPool &Pool;
+  const unsigned MaxConcurrency;
+
+  std::mutex Lock;
+  std::deque<PackagedTaskTy *> Tasks[2];
+  std::atomic<unsigned> NumTasks{0};
+  /// Tickets submitted to the parent and not released yet.
+  unsigned NumTickets = 0;
+
+  ForwardQueue(ThreadPool &Parent, ThreadPool &Pool, unsigned MaxConcurrency)
+      : Parent(Parent), Pool(Pool), MaxConcurrency(MaxConcurrency) {}
+
+  /// Take the next task in line, with Lock held.
+  PackagedTaskTy *pop() {
+    for (Priority P : {Priority::High, Priority::Normal}) {
+      unsigned Idx = static_cast<unsigned>(P);
+      if (Tasks[Idx].empty())
+        continue;
+      PackagedTaskTy *Task = Tasks[Idx].front();
+      Tasks[Idx].pop_front();
+      NumTasks.fetch_sub(1, std::memory_order_relaxed);
+      return Task;
+    }
+    return nullptr;
+  }
+
+  static void submitTicket(const std::shared_ptr<ForwardQueue> &Q,
+                           Priority P) {
+    Q->Parent.async(P, [Q] { runTicket(Q); });
+  }
+
+  static void runTicket(const std::shared_ptr<ForwardQueue> &Q) {
+    PackagedTaskTy *Task;
+    {
+      std::lock_guard<std::mutex> LockGuard(Q->Lock);
+      Task = Q->pop();
+      if (!Task) {
+        --Q->NumTickets;
+        return;
+      }
+    }
+    (*Task)();
+    delete Task;
+
+    // Hand the ticket over to the next task in line, or release it.
+    bool HandOver = true;
+    Priority NextPriority = Priority::Normal;
+    {
+      std::lock_guard<std::mutex> LockGuard(Q->Lock);
+      if (!Q->Tasks[static_cast<unsigned>(Priority::High)].empty())
+        NextPriority = Priority::High;
+      else if (Q->Tasks[static_cast<unsigned>(Priority::Normal)].empty())
+        HandOver = false;
+      if (!HandOver)
+        --Q->NumTickets;
+    }
+    if (HandOver)
+      submitTicket(Q, NextPriority);
+    Q->Pool.finishTask();
+  }
+};
+
 // Default to hardware_concurrency
 ThreadPool::ThreadPool() : ThreadPool(hardware_concurrency()) {}
 
 ThreadPool::ThreadPool(unsigned ThreadCount)
-    : ActiveThreads(0), EnableFlag(true) {
-  // Create ThreadCount threads that will loop forever, wait on QueueCondition
-  // for tasks to be queued or the Pool to be destroyed.
+    : NumSharedTasks{{0}, {0}}, NumSleeping(0), PendingWakeups(0),
+      NumPendingTasks(0), EnableFlag(true) {
+  WorkQueues.reserve(ThreadCount);
+  for (unsigned ThreadID = 0; ThreadID < ThreadCount; ++ThreadID)
+    WorkQueues.push_back(std::make_unique<WorkQueue>());
+
+  // Create ThreadCount threads that will loop forever, looking for tasks and
+  // sleeping when none are available, until the Pool is destroyed.
   Threads.reserve(ThreadCount);
-  for (unsigned ThreadID = 0; ThreadID < ThreadCount; ++ThreadID) {
-    Threads.emplace_back([&] {
-      while (true) {
-        PackagedTaskTy Task;
-        {
-          std::unique_lock<std::mutex> LockGuard(QueueLock);
-          // Wait for tasks to be pushed in the queue
-          QueueCondition.wait(LockGuard,
-                              [&] { return !EnableFlag || !Tasks.empty(); });
-          // Exit condition
-          if (!EnableFlag && Tasks.empty())
-            return;
-          // Yeah, we have a task, grab it and release the lock on the queue
-
-          // We first need to signal that we are active before popping the queue
-          // in order for wait() to properly detect that even if the queue is
-          // empty, there is still a task in flight.
-          {
-            std::unique_lock<std::mutex> LockGuard(CompletionLock);
-            ++ActiveThreads;
-          }
-          Task = std::move(Tasks.front());
-          Tasks.pop();
-        }
-        // Run the task we just grabbed
-        Task();
-
-        {
-          // Adjust `ActiveThreads`, in case someone waits on ThreadPool::wait()
-          std::unique_lock<std::mutex> LockGuard(CompletionLock);
-          --ActiveThreads;
-        }
-
-        // Notify task completion, in case someone waits on ThreadPool::wait()
-        CompletionCondition.notify_all();
-      }
-    });
+  for (unsigned ThreadID = 0; ThreadID < ThreadCount; ++ThreadID)
+    Threads.emplace_back([this, ThreadID] { work(ThreadID); });
+}
+
+ThreadPool::ThreadPool(ThreadPool &Parent, unsigned MaxConcurrency)
+    : NumSharedTasks{{0}, {0}}, NumSleeping(0), PendingWakeups(0),
+      NumPendingTasks(0), EnableFlag(true),
+      Forwarded(std::make_shared<ForwardQueue>(
+          Parent, *this, MaxConcurrency ? MaxConcurrency : ~0U)) {}
+
+void ThreadPool::work(unsigned Index) {
+  CurrentPool = this;
+  CurrentQueue = Index;
+
+  while (true) {
+    PackagedTaskTy *Task = findTask(Index);
+    if (!Task) {
+      if (!sleep())
+        break;
+      continue;
+    }
+
+    // More work is queued, so get another thread going before starting on
+    // this task. This spreads a burst of submissions over the sleeping
+    // threads without waking all of them on every submission.
+    if (NumSleeping.load(std::memory_order_relaxed) &&
+        (!WorkQueues[Index]->empty() ||
+         NumSharedTasks[0].load(std::memory_order_relaxed) ||
+         NumSharedTasks[1].load(std::memory_order_relaxed)))
+      wakeOne();
+
+    runTask(Task);
+  }
+
+  CurrentPool = nullptr;
+}
+
+void ThreadPool::runTask(PackagedTaskTy *Task) {
+  (*Task)();
+  delete Task;
+  finishTask();
+}
+
+void ThreadPool::finishTask() {
+  if (!Forwarded) {
+    // Only the last completion has to notify, in case someone waits on
+    // ThreadPool::wait(). The threads are joined before the pool goes away,
+    // so taking the lock after the decrement is fine.
+    if (NumPendingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> LockGuard(CompletionLock);
+      CompletionCondition.notify_all();
+    }
+    return;
+  }
+
+  // A pool built on a parent may be destroyed as soon as wait() observes the
+  // last completion, hence the decrement has to happen under the lock.
+  std::lock_guard<std::mutex> LockGuard(CompletionLock);
+  if (NumPendingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    CompletionCondition.notify_all();
+}
+
+ThreadPool::PackagedTaskTy *ThreadPool::findTask(unsigned Index) {
+  auto PopShared = [&](Priority P) -> PackagedTaskTy * {
+    unsigned Idx = static_cast<unsigned>(P);
+    if (!NumSharedTasks[Idx].load(std::memory_order_acquire))
+      return nullptr;
+    std::lock_guard<std::mutex> LockGuard(QueueLock);
+    if (SharedTasks[Idx].empty())
+      return nullptr;
+    PackagedTaskTy *Task = SharedTasks[Idx].front();
+    SharedTasks[Idx].pop_front();
+    NumSharedTasks[Idx].fetch_sub(1, std::memory_order_relaxed);
+    return Task;
+  };
+
+  if (PackagedTaskTy *Task = PopShared(Priority::High))
+    return Task;
+  if (PackagedTaskTy *Task = WorkQueues[Index]->pop())
+    return Task;
+  if (PackagedTaskTy *Task = PopShared(Priority::Normal))
+    return Task;
+
+  unsigned NumQueues = WorkQueues.size();
+  for (unsigned I = 1; I < NumQueues; ++I)
+    if (PackagedTaskTy *Task = WorkQueues[(Index + I) % NumQueues]->steal())
+      return Task;
+  return nullptr;
+}
+
+bool ThreadPool::hasQueuedTasks() const {
+  if (NumSharedTasks[0].load(std::memory_order_seq_cst) ||
+      NumSharedTasks[1].load(std::memory_order_seq_cst))
+    return true;
+  return any_of(WorkQueues, [](const std::unique_ptr<WorkQueue> &Q) {
+    return !Q->empty();
+  });
+}
+
+bool ThreadPool::sleep() {
+  std::unique_lock<std::mutex> LockGuard(SleepLock);
+  // Announce that we are going to sleep before checking the queues one last
+  // time: a concurrent submission either finds NumSleeping non-zero and wakes
+  // us up, or its task is visible here.
+  NumSleeping.fetch_add(1, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool Continue = true;
+  if (!hasQueuedTasks()) {
+    if (EnableFlag.load())
+      SleepCondition.wait(LockGuard,
+                          [&] { return PendingWakeups || !EnableFlag; });
+    // Exit condition
+    Continue = PendingWakeups || hasQueuedTasks();
+    if (PendingWakeups)
+      --PendingWakeups;
   }
+  NumSleeping.fetch_sub(1, std::memory_order_relaxed);
+  return Continue;
+}
+
+void ThreadPool::wakeOne() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!NumSleeping.load(std::memory_order_seq_cst))
+    return;
+  {
+    std::lock_guard<std::mutex> LockGuard(SleepLock);
+    ++PendingWakeups;
+  }
+  SleepCondition.notify_one();
+}
+
+bool ThreadPool::isWorkerThread() const {
+  const ThreadPool *Root = this;
+  while (Root->Forwarded)
+    Root = &Root->Forwarded->Parent;
+  return CurrentPool == Root;
 }
 
 void ThreadPool::wait() {
-  // Wait for all threads to complete and the queue to be empty
+  // Wait for all the submitted tasks to complete, including the ones they
+  // submitted themselves.
+  auto Done = [&] { return !NumPendingTasks.load(std::memory_order_acquire); };
+
+  if (Forwarded && isWorkerThread()) {
+    // A task of the parent is waiting, and the tickets of our tasks may be
+    // queued behind it. Run the tasks that have not started yet here, and
+    // only block while the others run on other threads, which may still
+    // submit more.
+    while (true) {
+      PackagedTaskTy *Task;
+      {
+        std::lock_guard<std::mutex> LockGuard(Forwarded->Lock);
+        Task = Forwarded->pop();
+      }
+      if (Task) {
+        runTask(Task);
+        continue;
+      }
+      std::unique_lock<std::mutex> LockGuard(CompletionLock);
+      CompletionCondition.wait(LockGuard, [&] {
+        return Done() || Forwarded->NumTasks.load(std::memory_order_relaxed);
+      });
+      if (Done())
+        return;
+    }
+  }
+
   std::unique_lock<std::mutex> LockGuard(CompletionLock);
-  // The order of the checks for ActiveThreads and Tasks.empty() matters because
-  // any active threads might be modifying the Tasks queue, and this would be a
-  // race.
-  CompletionCondition.wait(LockGuard,
-                           [&] { return !ActiveThreads && Tasks.empty(); });
+  CompletionCondition.wait(LockGuard, Done);
 }
 
-std::shared_future<void> ThreadPool::asyncImpl(TaskTy Task) {
+std::shared_future<void> ThreadPool::asyncImpl(TaskTy Task, Priority P) {
   /// Wrap the Task in a packaged_task to return a future object.
-  PackagedTaskTy PackagedTask(std::move(Task));
-  auto Future = PackagedTask.get_future();
-  {
+  auto *PackagedTask = new PackagedTaskTy(std::move(Task));
+  auto Future = PackagedTask->get_future().share();
+  NumPendingTasks.fetch_add(1, std::memory_order_acq_rel);
+
+  if (Forwarded) {
+    // Queue the task, and give the parent a ticket for it if a concurrency
+    // slot is free. Otherwise the ticket of a running task is handed over.
+    bool NeedTicket;
+    {
+      std::lock_guard<std::mutex> LockGuard(Forwarded->Lock);
+      Forwarded->Tasks[static_cast<unsigned>(P)].push_back(PackagedTask);
+      Forwarded->NumTasks.fetch_add(1, std::memory_order_relaxed);
+      NeedTicket = Forwarded->NumTickets < Forwarded->MaxConcurrency;
+      if (NeedTicket)
+        ++Forwarded->NumTickets;
+    }
+    if (NeedTicket)
+      ForwardQueue::submitTicket(Forwarded, P);
+
+    // A thread of the parent blocked in wait() may run the task itself.
+    { std::lock_guard<std::mutex> LockGuard(CompletionLock); }
+    CompletionCondition.notify_all();
+    return Future;
+  }
+
+  if (P == Priority::Normal && CurrentPool == this) {
+    // Nested submission, keep it on the deque of this thread.
+    WorkQueues[CurrentQueue]->push(PackagedTask);
+  } else {
     // Lock the queue and push the new task
-    std::unique_lock<std::mutex> LockGuard(QueueLock);
+    std::lock_guard<std::mutex> LockGuard(QueueLock);
 
     // Don't allow enqueueing after disabling the pool
     assert(EnableFlag && "Queuing a thread during ThreadPool destruction");
 
-    Tasks.push(std::move(PackagedTask));
+    unsigned Idx = static_cast<unsigned>(P);
+    SharedTasks[Idx].push_back(PackagedTask);
+    NumSharedTasks[Idx].fetch_add(1, std::memory_order_release);
   }
-  QueueCondition.notify_one();
-  return Future.share();
+  wakeOne();
+  return Future;
 }
 
 // The destructor joins all threads, waiting for completion.
 ThreadPool::~ThreadPool() {
+  if (Forwarded) {
+    wait();
+    return;
+  }
+
   {
-    std::unique_lock<std::mutex> LockGuard(QueueLock);
+    std::lock_guard<std::mutex> LockGuard(SleepLock);
     EnableFlag = false;
   }
-  QueueCondition.notify_all();
-  for (auto &Worker : Threads)
-    Worker.join();
+  SleepCondition.notify_all();
+  for (auto &Worker : Threads) {
+    // The process may exit from within a task of the global pool.
+    if (Worker.get_id() == std::this_thread::get_id())
+      Worker.detach();
+    else
+      Worker.join();
+  }
 }
 
 #else // LLVM_ENABLE_THREADS Disabled
@@ -111,8 +453,7 @@ ThreadPool::~ThreadPool() {
 ThreadPool::ThreadPool() : ThreadPool(0) {}
 
 // No threads are launched, issue a warning if ThreadCount is not 0
-ThreadPool::ThreadPool(unsigned ThreadCount)
-    : ActiveThreads(0) {
+ThreadPool::ThreadPool(unsigned ThreadCount) {
   if (ThreadCount) {
     errs() << "Warning: request a ThreadPool with " << ThreadCount
            << " threads, but LLVM_ENABLE_THREADS has been turned off\n";
@@ -128,7 +469,7 @@ void ThreadPool::wait() {
   }
 }
 
-std::shared_future<void> ThreadPool::asyncImpl(TaskTy Task) {
+std::shared_future<void> ThreadPool::asyncImpl(TaskTy Task, Priority) {
   // Get a Future with launch::deferred execution using std::async
   auto Future = std::async(std::launch::deferred, std::move(Task)).share();
   // Wrap the future so that both ThreadPool::wait() can operate and the
@@ -138,8 +479,34 @@ std::shared_future<void> ThreadPool::asyncImpl(TaskTy Task) {
   return Future;
 }
 
+ThreadPool::ThreadPool(ThreadPool &, unsigned) {}
+
+bool ThreadPool::isWorkerThread() const { return false; }
+
 ThreadPool::~ThreadPool() {
   wait();
 }
 
 #endif
+
+static unsigned GlobalThreadCount = 0;
+static bool GlobalPoolCreated = false;
+
+void ThreadPool::setGlobalThreadCount(unsigned ThreadCount) {
+  assert(!GlobalPoolCreated && "The global pool already has its threads");
+  GlobalThreadCount = ThreadCount;
+}
+
+static unsigned takeGlobalThreadCount() {
+  GlobalPoolCreated = true;
+#if LLVM_ENABLE_THREADS
+  return GlobalThreadCount ? GlobalThreadCount : hardware_concurrency();
+#else
+  return 0;
+#endif
+}
+
+ThreadPool &ThreadPool::getGlobal() {
+  static ThreadPool Pool(takeGlobalThreadCount());
+  return Pool;
+}
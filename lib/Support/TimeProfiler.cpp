@@ -11,10 +11,14 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Support/TimeProfiler.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/JSON.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/Threading.h"
 #include <cassert>
 #include <chrono>
 #include <string>
@@ -24,7 +28,7 @@ using namespace std::chrono;
 
 namespace llvm {
 
-TimeTraceProfiler *TimeTraceProfilerInstance = nullptr;
+LLVM_THREAD_LOCAL TimeTraceProfiler *TimeTraceProfilerInstance = nullptr;
 
 typedef duration<steady_clock::rep, steady_clock::period> DurationType;
 typedef time_point<steady_clock> TimePointType;
@@ -58,8 +62,19 @@ struct Entry {
   }
 };
 
+namespace {
+// Profilers of secondary threads that finished recording, waiting to be
+// written out by the thread that owns the main profiler.
+struct FinishedThreads {
+  sys::Mutex Lock;
+  std::vector<std::unique_ptr<TimeTraceProfiler>> Profilers;
+};
+} // end anonymous namespace
+
+static ManagedStatic<FinishedThreads> Finished;
+
 struct TimeTraceProfiler {
-  TimeTraceProfiler() {
+  TimeTraceProfiler() : Tid(get_threadid()) {
     StartTime = steady_clock::now();
   }
 
@@ -111,28 +126,52 @@ struct TimeTraceProfiler {
     J.attributeBegin("traceEvents");
     J.arrayBegin();
 
+    auto WriteEntries = [&](const TimeTraceProfiler &P, int Tid) {
+      for (const auto &E : P.Entries) {
+        auto StartUs = E.getFlameGraphStartUs(StartTime);
+        auto DurUs = E.getFlameGraphDurUs();
+
+        J.object([&]{
+          J.attribute("pid", 1);
+          J.attribute("tid", Tid);
+          J.attribute("ph", "X");
+          J.attribute("ts", StartUs);
+          J.attribute("dur", DurUs);
+          J.attribute("name", E.Name);
+          J.attributeObject("args", [&] { J.attribute("detail", E.Detail); });
+        });
+      }
+    };
+
     // Emit all events for the main flame graph.
-    for (const auto &E : Entries) {
-      auto StartUs = E.getFlameGraphStartUs(StartTime);
-      auto DurUs = E.getFlameGraphDurUs();
+    WriteEntries(*this, 0);
 
-      J.object([&]{
-        J.attribute("pid", 1);
-        J.attribute("tid", 0);
-        J.attribute("ph", "X");
-        J.attribute("ts", StartUs);
-        J.attribute("dur", DurUs);
-        J.attribute("name", E.Name);
-        J.attributeObject("args", [&] { J.attribute("detail", E.Detail); });
-      });
+    // Emit the events of finished secondary threads, one track per thread,
+    // and fold their totals into ours.
+    int Tid = 1;
+    StringMap<CountAndDurationType> AllCountAndTotalPerName =
+        CountAndTotalPerName;
+    {
+      std::lock_guard<sys::Mutex> Lock(Finished->Lock);
+      DenseMap<uint64_t, int> ThreadTids;
+      for (const auto &P : Finished->Profilers) {
+        auto Inserted = ThreadTids.try_emplace(P->Tid, Tid);
+        if (Inserted.second)
+          ++Tid;
+        WriteEntries(*P, Inserted.first->second);
+        for (const auto &E : P->CountAndTotalPerName) {
+          auto &CountAndTotal = AllCountAndTotalPerName[E.getKey()];
+          CountAndTotal.first += E.getValue().first;
+          CountAndTotal.second += E.getValue().second;
+        }
+      }
     }
 
     // Emit totals by section name as additional "thread" events, sorted from
     // longest one.
-    int Tid = 1;
     std::vector<NameAndCountAndDurationType> SortedTotals;
-    SortedTotals.reserve(CountAndTotalPerName.size());
-    for (const auto &E : CountAndTotalPerName)
+    SortedTotals.reserve(AllCountAndTotalPerName.size());
+    for (const auto &E : AllCountAndTotalPerName)
       SortedTotals.emplace_back(E.getKey(), E.getValue());
 
     llvm::sort(SortedTotals.begin(), SortedTotals.end(),
@@ -142,7 +181,7 @@ struct TimeTraceProfiler {
                });
     for (const auto &E : SortedTotals) {
       auto DurUs = duration_cast<microseconds>(E.second.second).count();
-      auto Count = CountAndTotalPerName[E.first].first;
+      auto Count = E.second.first;
 
       J.object([&]{
         J.attribute("pid", 1);
@@ -180,6 +219,7 @@ struct TimeTraceProfiler {
   SmallVector<Entry, 128> Entries;
   StringMap<CountAndDurationType> CountAndTotalPerName;
   TimePointType StartTime;
+  uint64_t Tid;
 
   // Minimum time granularity (in microseconds)
   unsigned TimeTraceGranularity;
@@ -195,6 +235,18 @@ void timeTraceProfilerInitialize(unsigned TimeTraceGranularity) {
 void timeTraceProfilerCleanup() {
   delete TimeTraceProfilerInstance;
   TimeTraceProfilerInstance = nullptr;
+  std::lock_guard<sys::Mutex> Lock(Finished->Lock);
+  Finished->Profilers.clear();
+}
+
+void timeTraceProfilerFinishThread() {
+  if (TimeTraceProfilerInstance == nullptr)
+    return;
+  assert(TimeTraceProfilerInstance->Stack.empty() &&
+         "All profiler sections should be ended when finishing a thread");
+  std::lock_guard<sys::Mutex> Lock(Finished->Lock);
+  Finished->Profilers.emplace_back(TimeTraceProfilerInstance);
+  TimeTraceProfilerInstance = nullptr;
 }
 
 void timeTraceProfilerWrite(raw_pwrite_stream &OS) {
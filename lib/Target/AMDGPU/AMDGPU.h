@@ -247,9 +247,16 @@ extern char &GCNRegBankReassignID;
 void initializeGCNNSAReassignPass(PassRegistry &);
 extern char &GCNNSAReassignID;
 
+FunctionPass *createGCNPreRARematerializePass();
+void initializeGCNPreRARematerializePass(PassRegistry &);
+extern char &GCNPreRARematerializeID;
+
 FunctionPass *createAMDGPUPromotePointerKernArgsToGlobalPass();
 void initializeAMDGPUPromotePointerKernArgsToGlobalPass(PassRegistry &);
 
+ModulePass *createAMDGPUPromotePointerArgsToGlobalPass();
+void initializeAMDGPUPromotePointerArgsToGlobalPass(PassRegistry &);
+
 namespace AMDGPU {
 enum TargetIndex {
   TI_CONSTDATA_START,
@@ -10,6 +10,12 @@
 /// This pass optimizes atomic operations by using a single lane of a wavefront
 /// to perform the atomic operation, thus reducing contention on that memory
 /// location.
+///
+/// Integer add/sub atomics are handled, as well as the bitwise and integer
+/// min/max atomics. Floating point add/sub atomics are only handled with
+/// unsafe math: the sum of the lanes is computed with a multiply or a
+/// reassociated scan, which in general does not round like any sequence of
+/// the individual atomic additions would.
 //
 //===----------------------------------------------------------------------===//
 
@@ -45,10 +51,11 @@ private:
   DominatorTree *DT;
   const GCNSubtarget *ST;
   bool IsPixelShader;
+  bool HasUnsafeFPMath;
 
   Value *buildScan(IRBuilder<> &B, AtomicRMWInst::BinOp Op, Value *V,
-                   Value *const Identity) const;
-  Value *buildShiftRight(IRBuilder<> &B, Value *V, Value *const Identity) const;
+                   Value *Identity) const;
+  Value *buildShiftRight(IRBuilder<> &B, Value *V, Value *Identity) const;
   void optimizeAtomic(Instruction &I, AtomicRMWInst::BinOp Op, unsigned ValIdx,
                       bool ValDivergent) const;
 
@@ -89,6 +96,8 @@ bool AMDGPUAtomicOptimizer::runOnFunction(Function &F) {
   const TargetMachine &TM = TPC.getTM<TargetMachine>();
   ST = &TM.getSubtarget<GCNSubtarget>(F);
   IsPixelShader = F.getCallingConv() == CallingConv::AMDGPU_PS;
+  HasUnsafeFPMath =
+      F.getFnAttribute("unsafe-fp-math").getValueAsString() == "true";
 
   visit(F);
 
@@ -128,6 +137,16 @@ void AMDGPUAtomicOptimizer::visitAtomicRMWInst(AtomicRMWInst &I) {
   case AtomicRMWInst::UMax:
   case AtomicRMWInst::UMin:
     break;
+  case AtomicRMWInst::FAdd:
+  case AtomicRMWInst::FSub:
+    // Combining the lanes reassociates the additions.
+    if (!HasUnsafeFPMath)
+      return;
+    // Only single and double precision values can be moved between lanes as
+    // integers.
+    if (!I.getType()->isFloatTy() && !I.getType()->isDoubleTy())
+      return;
+    break;
   }
 
   const unsigned PtrIdx = 0;
@@ -259,6 +278,10 @@ static Value *buildNonAtomicBinOp(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
     return B.CreateBinOp(Instruction::Or, LHS, RHS);
   case AtomicRMWInst::Xor:
     return B.CreateBinOp(Instruction::Xor, LHS, RHS);
+  case AtomicRMWInst::FAdd:
+    return B.CreateFAdd(LHS, RHS);
+  case AtomicRMWInst::FSub:
+    return B.CreateFSub(LHS, RHS);
 
   case AtomicRMWInst::Max:
     Pred = CmpInst::ICMP_SGT;
@@ -280,35 +303,43 @@ static Value *buildNonAtomicBinOp(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
 // Use the builder to create an inclusive scan of V across the wavefront, with
 // all lanes active.
 Value *AMDGPUAtomicOptimizer::buildScan(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
-                                        Value *V, Value *const Identity) const {
+                                        Value *V, Value *Identity) const {
   Type *const Ty = V->getType();
+  // The lane intrinsics only move integers, so floating point values are
+  // scanned as integers of the same size and converted back for each op.
+  Type *const IntTy = B.getIntNTy(Ty->getPrimitiveSizeInBits());
+  auto buildIntBinOp = [&](Value *LHS, Value *RHS) {
+    return B.CreateBitCast(buildNonAtomicBinOp(B, Op, B.CreateBitCast(LHS, Ty),
+                                               B.CreateBitCast(RHS, Ty)),
+                           IntTy);
+  };
+  V = B.CreateBitCast(V, IntTy);
+  Identity = B.CreateBitCast(Identity, IntTy);
+
   Module *M = B.GetInsertBlock()->getModule();
   Function *UpdateDPP =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_update_dpp, Ty);
+      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_update_dpp, IntTy);
   Function *PermLaneX16 =
       Intrinsic::getDeclaration(M, Intrinsic::amdgcn_permlanex16, {});
   Function *ReadLane =
       Intrinsic::getDeclaration(M, Intrinsic::amdgcn_readlane, {});
 
   for (unsigned Idx = 0; Idx < 4; Idx++) {
-    V = buildNonAtomicBinOp(
-        B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::ROW_SHR0 | 1 << Idx),
-                      B.getInt32(0xf), B.getInt32(0xf), B.getFalse()}));
+    V = buildIntBinOp(
+        V, B.CreateCall(UpdateDPP,
+                        {Identity, V, B.getInt32(DPP::ROW_SHR0 | 1 << Idx),
+                         B.getInt32(0xf), B.getInt32(0xf), B.getFalse()}));
   }
   if (ST->hasDPPBroadcasts()) {
     // GFX9 has DPP row broadcast operations.
-    V = buildNonAtomicBinOp(
-        B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::BCAST15), B.getInt32(0xa),
-                      B.getInt32(0xf), B.getFalse()}));
-    V = buildNonAtomicBinOp(
-        B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::BCAST31), B.getInt32(0xc),
-                      B.getInt32(0xf), B.getFalse()}));
+    V = buildIntBinOp(
+        V, B.CreateCall(UpdateDPP,
+                        {Identity, V, B.getInt32(DPP::BCAST15), B.getInt32(0xa),
+                         B.getInt32(0xf), B.getFalse()}));
+    V = buildIntBinOp(
+        V, B.CreateCall(UpdateDPP,
+                        {Identity, V, B.getInt32(DPP::BCAST31), B.getInt32(0xc),
+                         B.getInt32(0xf), B.getFalse()}));
   } else {
     // On GFX10 all DPP operations are confined to a single row. To get cross-
     // row operations we have to use permlane or readlane.
@@ -318,32 +349,36 @@ Value *AMDGPUAtomicOptimizer::buildScan(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
     Value *const PermX =
         B.CreateCall(PermLaneX16, {V, V, B.getInt32(-1), B.getInt32(-1),
                                    B.getFalse(), B.getFalse()});
-    V = buildNonAtomicBinOp(
-        B, Op, V,
+    V = buildIntBinOp(
+        V,
         B.CreateCall(UpdateDPP,
                      {Identity, PermX, B.getInt32(DPP::QUAD_PERM_ID),
                       B.getInt32(0xa), B.getInt32(0xf), B.getFalse()}));
     if (!ST->isWave32()) {
       // Combine lane 31 into lanes 32..63.
       Value *const Lane31 = B.CreateCall(ReadLane, {V, B.getInt32(31)});
-      V = buildNonAtomicBinOp(
-          B, Op, V,
+      V = buildIntBinOp(
+          V,
           B.CreateCall(UpdateDPP,
                        {Identity, Lane31, B.getInt32(DPP::QUAD_PERM_ID),
                         B.getInt32(0xc), B.getInt32(0xf), B.getFalse()}));
     }
   }
-  return V;
+  return B.CreateBitCast(V, Ty);
 }
 
 // Use the builder to create a shift right of V across the wavefront, with all
 // lanes active, to turn an inclusive scan into an exclusive scan.
 Value *AMDGPUAtomicOptimizer::buildShiftRight(IRBuilder<> &B, Value *V,
-                                              Value *const Identity) const {
+                                              Value *Identity) const {
   Type *const Ty = V->getType();
+  Type *const IntTy = B.getIntNTy(Ty->getPrimitiveSizeInBits());
+  V = B.CreateBitCast(V, IntTy);
+  Identity = B.CreateBitCast(Identity, IntTy);
+
   Module *M = B.GetInsertBlock()->getModule();
   Function *UpdateDPP =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_update_dpp, Ty);
+      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_update_dpp, IntTy);
   Function *ReadLane =
       Intrinsic::getDeclaration(M, Intrinsic::amdgcn_readlane, {});
   Function *WriteLane =
@@ -379,11 +414,12 @@ Value *AMDGPUAtomicOptimizer::buildShiftRight(IRBuilder<> &B, Value *V,
     }
   }
 
-  return V;
+  return B.CreateBitCast(V, Ty);
 }
 
-static APInt getIdentityValueForAtomicOp(AtomicRMWInst::BinOp Op,
-                                         unsigned BitWidth) {
+static Constant *getIdentityValueForAtomicOp(AtomicRMWInst::BinOp Op,
+                                            Type *Ty) {
+  const unsigned BitWidth = Ty->getPrimitiveSizeInBits();
   switch (Op) {
   default:
     llvm_unreachable("Unhandled atomic op");
@@ -392,14 +428,17 @@ static APInt getIdentityValueForAtomicOp(AtomicRMWInst::BinOp Op,
   case AtomicRMWInst::Or:
   case AtomicRMWInst::Xor:
   case AtomicRMWInst::UMax:
-    return APInt::getMinValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getMinValue(BitWidth));
   case AtomicRMWInst::And:
   case AtomicRMWInst::UMin:
-    return APInt::getMaxValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getMaxValue(BitWidth));
   case AtomicRMWInst::Max:
-    return APInt::getSignedMinValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getSignedMinValue(BitWidth));
   case AtomicRMWInst::Min:
-    return APInt::getSignedMaxValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getSignedMaxValue(BitWidth));
+  case AtomicRMWInst::FAdd:
+  case AtomicRMWInst::FSub:
+    return ConstantFP::getNegativeZero(Ty);
   }
 }
 
@@ -437,6 +476,7 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
 
   Type *const Ty = I.getType();
   const unsigned TyBitWidth = DL->getTypeSizeInBits(Ty);
+  Type *const IntTy = B.getIntNTy(TyBitWidth);
   Type *const VecTy = VectorType::get(B.getInt32Ty(), 2);
 
   // This is the value in the atomic operation we need to combine in order to
@@ -467,9 +507,9 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
     Mbcnt =
         B.CreateIntrinsic(Intrinsic::amdgcn_mbcnt_hi, {}, {ExtractHi, Mbcnt});
   }
-  Mbcnt = B.CreateIntCast(Mbcnt, Ty, false);
+  Mbcnt = B.CreateIntCast(Mbcnt, IntTy, false);
 
-  Value *const Identity = B.getInt(getIdentityValueForAtomicOp(Op, TyBitWidth));
+  Value *const Identity = getIdentityValueForAtomicOp(Op, Ty);
 
   Value *ExclScan = nullptr;
   Value *NewV = nullptr;
@@ -479,10 +519,16 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
   if (ValDivergent) {
     // First we need to set all inactive invocations to the identity value, so
     // that they can correctly contribute to the final result.
-    NewV = B.CreateIntrinsic(Intrinsic::amdgcn_set_inactive, Ty, {V, Identity});
-
-    const AtomicRMWInst::BinOp ScanOp =
-        Op == AtomicRMWInst::Sub ? AtomicRMWInst::Add : Op;
+    NewV = B.CreateIntrinsic(
+        Intrinsic::amdgcn_set_inactive, IntTy,
+        {B.CreateBitCast(V, IntTy), B.CreateBitCast(Identity, IntTy)});
+    NewV = B.CreateBitCast(NewV, Ty);
+
+    AtomicRMWInst::BinOp ScanOp = Op;
+    if (Op == AtomicRMWInst::Sub)
+      ScanOp = AtomicRMWInst::Add;
+    else if (Op == AtomicRMWInst::FSub)
+      ScanOp = AtomicRMWInst::FAdd;
     NewV = buildScan(B, ScanOp, NewV, Identity);
     ExclScan = buildShiftRight(B, NewV, Identity);
 
@@ -491,9 +537,10 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
     // will provide to the atomic operation.
     Value *const LastLaneIdx = B.getInt32(ST->getWavefrontSize() - 1);
     if (TyBitWidth == 64) {
-      Value *const ExtractLo = B.CreateTrunc(NewV, B.getInt32Ty());
+      Value *const IntV = B.CreateBitCast(NewV, IntTy);
+      Value *const ExtractLo = B.CreateTrunc(IntV, B.getInt32Ty());
       Value *const ExtractHi =
-          B.CreateTrunc(B.CreateLShr(NewV, 32), B.getInt32Ty());
+          B.CreateTrunc(B.CreateLShr(IntV, 32), B.getInt32Ty());
       CallInst *const ReadLaneLo = B.CreateIntrinsic(
           Intrinsic::amdgcn_readlane, {}, {ExtractLo, LastLaneIdx});
       CallInst *const ReadLaneHi = B.CreateIntrinsic(
@@ -505,7 +552,8 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
       NewV = B.CreateBitCast(Insert, Ty);
     } else if (TyBitWidth == 32) {
       NewV = B.CreateIntrinsic(Intrinsic::amdgcn_readlane, {},
-                               {NewV, LastLaneIdx});
+                               {B.CreateBitCast(NewV, IntTy), LastLaneIdx});
+      NewV = B.CreateBitCast(NewV, Ty);
     } else {
       llvm_unreachable("Unhandled atomic bit width");
     }
@@ -527,6 +575,16 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
       break;
     }
 
+    case AtomicRMWInst::FAdd:
+    case AtomicRMWInst::FSub: {
+      // As above, but the product is only an approximation of adding the
+      // value once per lane.
+      Value *const Ctpop = B.CreateUIToFP(
+          B.CreateUnaryIntrinsic(Intrinsic::ctpop, Ballot), Ty);
+      NewV = B.CreateFMul(V, Ctpop);
+      break;
+    }
+
     case AtomicRMWInst::And:
     case AtomicRMWInst::Or:
     case AtomicRMWInst::Max:
@@ -590,9 +648,10 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
     Value *BroadcastI = nullptr;
 
     if (TyBitWidth == 64) {
-      Value *const ExtractLo = B.CreateTrunc(PHI, B.getInt32Ty());
+      Value *const IntPHI = B.CreateBitCast(PHI, IntTy);
+      Value *const ExtractLo = B.CreateTrunc(IntPHI, B.getInt32Ty());
       Value *const ExtractHi =
-          B.CreateTrunc(B.CreateLShr(PHI, 32), B.getInt32Ty());
+          B.CreateTrunc(B.CreateLShr(IntPHI, 32), B.getInt32Ty());
       CallInst *const ReadFirstLaneLo =
           B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {}, ExtractLo);
       CallInst *const ReadFirstLaneHi =
@@ -603,8 +662,9 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
           B.CreateInsertElement(PartialInsert, ReadFirstLaneHi, B.getInt32(1));
       BroadcastI = B.CreateBitCast(Insert, Ty);
     } else if (TyBitWidth == 32) {
-
-      BroadcastI = B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {}, PHI);
+      BroadcastI = B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {},
+                                     B.CreateBitCast(PHI, IntTy));
+      BroadcastI = B.CreateBitCast(BroadcastI, Ty);
     } else {
       llvm_unreachable("Unhandled atomic bit width");
     }
@@ -624,6 +684,10 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
       case AtomicRMWInst::Sub:
         LaneOffset = B.CreateMul(V, Mbcnt);
         break;
+      case AtomicRMWInst::FAdd:
+      case AtomicRMWInst::FSub:
+        LaneOffset = B.CreateFMul(V, B.CreateUIToFP(Mbcnt, Ty));
+        break;
       case AtomicRMWInst::And:
       case AtomicRMWInst::Or:
       case AtomicRMWInst::Max:
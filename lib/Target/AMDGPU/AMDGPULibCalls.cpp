@@ -48,6 +48,12 @@ static cl::list<std::string> UseNative("amdgpu-use-native",
   cl::CommaSeparated, cl::ValueOptional,
   cl::Hidden);
 
+static cl::opt<bool> PackLibCalls("amdgpu-pack-libcalls",
+  cl::desc("Combine pairs of scalar half precision math library calls into "
+           "packed calls"),
+  cl::init(true),
+  cl::Hidden);
+
 #define MATH_PI     3.14159265358979323846264338327950288419716939937511
 #define MATH_E      2.71828182845904523536028747135266249775724709369996
 #define MATH_SQRT2  1.41421356237309504880168872420969807856967187537695
@@ -142,6 +148,9 @@ private:
   // llvm.amdgcn.wavefrontsize
   bool fold_wavefrontsize(CallInst *CI, IRBuilder<> &B);
 
+  // pack two independent scalar half calls into one v2f16 call
+  bool fold_pack(CallInst *CI, IRBuilder<> &B, const FuncInfo &FInfo);
+
   // Get insertion point at entry.
   BasicBlock::iterator getEntryIns(CallInst * UI);
   // Insert an Alloc instruction.
@@ -704,7 +713,9 @@ bool AMDGPULibCalls::fold(CallInst *CI, AliasAnalysis *AA) {
   case AMDGPULibFunc::EI_POW:
   case AMDGPULibFunc::EI_POWR:
   case AMDGPULibFunc::EI_POWN:
-    return fold_pow(CI, B, FInfo);
+    if (fold_pow(CI, B, FInfo))
+      return true;
+    break;
 
   case AMDGPULibFunc::EI_ROOTN:
     // skip vector function
@@ -736,7 +747,7 @@ bool AMDGPULibCalls::fold(CallInst *CI, AliasAnalysis *AA) {
     break;
   }
 
-  return false;
+  return fold_pack(CI, B, FInfo);
 }
 
 bool AMDGPULibCalls::TDOFold(CallInst *CI, const FuncInfo &FInfo) {
@@ -1412,6 +1423,92 @@ bool AMDGPULibCalls::fold_wavefrontsize(CallInst *CI, IRBuilder<> &B) {
   return true;
 }
 
+// fold f(a0, b0), f(a1, b1) -> f(<a0, a1>, <b0, b1>) for half f.
+bool AMDGPULibCalls::fold_pack(CallInst *CI, IRBuilder<> &B,
+                               const FuncInfo &FInfo) {
+  if (!PackLibCalls || !TM ||
+      TM->getTargetTriple().getArch() != Triple::amdgcn)
+    return false;
+
+  // Only half precision has packed instructions to implement the vector
+  // variants with.
+  if (!FInfo.isMangled() || getVecSize(FInfo) != 1 ||
+      getArgType(FInfo) != AMDGPULibFunc::F16 || !CI->getType()->isHalfTy())
+    return false;
+  for (Value *Arg : CI->arg_operands())
+    if (!Arg->getType()->isHalfTy())
+      return false;
+
+  const GCNSubtarget &ST = TM->getSubtarget<GCNSubtarget>(*CI->getFunction());
+  if (!ST.hasVOP3PInsts())
+    return false;
+
+  // Look for an earlier call of the same function whose result does not feed
+  // into the arguments of this one. The packed call is placed at the earlier
+  // call, so all arguments of this one must already be available there.
+  BasicBlock *const CBB = CI->getParent();
+  Function *Callee = CI->getCalledFunction();
+  SmallPtrSet<const Instruction *, 16> InBetween;
+  CallInst *UI = nullptr;
+  int const MaxScan = 30;
+  BasicBlock::iterator BBI = CI->getIterator();
+  for (int I = MaxScan; I > 0 && BBI != CBB->begin(); --I) {
+    --BBI;
+    CallInst *XI = dyn_cast<CallInst>(&*BBI);
+    if (XI && XI->getCalledFunction() == Callee &&
+        llvm::none_of(CI->arg_operands(), [&](const Value *Arg) {
+          auto *ArgI = dyn_cast<Instruction>(Arg);
+          return ArgI && (ArgI == XI || InBetween.count(ArgI));
+        })) {
+      UI = XI;
+      break;
+    }
+    InBetween.insert(&*BBI);
+  }
+
+  if (!UI)
+    return false;
+
+  FuncInfo PackedInfo(FInfo);
+  PackedInfo.getLeads()[0].VectorSize = 2;
+  FunctionCallee FPacked = getFunction(CI->getModule(), PackedInfo);
+  if (!FPacked)
+    return false;
+
+  Type *PackedTy = VectorType::get(CI->getType(), 2);
+  FunctionType *FTy = FPacked.getFunctionType();
+  if (FTy->getReturnType() != PackedTy ||
+      FTy->getNumParams() != CI->getNumArgOperands() ||
+      llvm::any_of(FTy->params(),
+                   [=](const Type *Ty) { return Ty != PackedTy; }))
+    return false;
+
+  // The packed call may only assume what both calls allow.
+  FastMathFlags FMF = CI->getFastMathFlags();
+  FMF &= UI->getFastMathFlags();
+  B.setFastMathFlags(FMF);
+  B.SetInsertPoint(UI);
+  SmallVector<Value *, 3> Args;
+  for (unsigned I = 0, E = CI->getNumArgOperands(); I != E; ++I) {
+    Value *V = UndefValue::get(PackedTy);
+    V = B.CreateInsertElement(V, UI->getArgOperand(I), (uint64_t)0);
+    V = B.CreateInsertElement(V, CI->getArgOperand(I), (uint64_t)1);
+    Args.push_back(V);
+  }
+  CallInst *Call = B.CreateCall(FPacked, Args, "__packed");
+  Call->setCallingConv(CI->getCallingConv());
+  Call->setAttributes(CI->getAttributes());
+
+  LLVM_DEBUG(errs() << "AMDIC: fold_pack (" << *UI << ", " << *CI << ") with "
+                    << *Call << "\n");
+
+  UI->replaceAllUsesWith(B.CreateExtractElement(Call, (uint64_t)0));
+  CI->replaceAllUsesWith(B.CreateExtractElement(Call, (uint64_t)1));
+  UI->eraseFromParent();
+  CI->eraseFromParent();
+  return true;
+}
+
 // Get insertion point at entry.
 BasicBlock::iterator AMDGPULibCalls::getEntryIns(CallInst * UI) {
   Function * Func = UI->getParent()->getParent();
@@ -10,6 +10,12 @@
 /// \brief Analyzes if a function potentially memory bound and if a kernel
 /// kernel may benefit from limiting number of waves to reduce cache thrashing.
 ///
+/// Instructions are weighted by the estimated number of times they execute per
+/// call of the function, so that a hot inner loop dominates the classification.
+/// The estimate comes from BlockFrequencyInfo, which follows profile branch
+/// weights when present. Without a profile, loops with a trip count known to
+/// ScalarEvolution use that trip count instead of the static loop estimate.
+///
 //===----------------------------------------------------------------------===//
 
 #include "AMDGPU.h"
@@ -17,17 +23,25 @@
 #include "Utils/AMDGPUBaseInfo.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/CodeGen/TargetLowering.h"
 #include "llvm/CodeGen/TargetPassConfig.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueMap.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
 
 using namespace llvm;
 
@@ -53,24 +67,48 @@ static cl::opt<unsigned>
     LargeStrideThresh("amdgpu-large-stride-threshold", cl::init(64), cl::Hidden,
                       cl::desc("Large stride memory access threshold"));
 
+static cl::opt<bool>
+    UseFrequency("amdgpu-perf-hint-use-frequency", cl::init(true), cl::Hidden,
+                 cl::desc("Weight instructions by their estimated execution "
+                          "frequency"));
+
 STATISTIC(NumMemBound, "Number of functions marked as memory bound");
 STATISTIC(NumLimitWave, "Number of functions marked as needing limit wave");
 
 char llvm::AMDGPUPerfHintAnalysis::ID = 0;
 char &llvm::AMDGPUPerfHintAnalysisID = AMDGPUPerfHintAnalysis::ID;
 
-INITIALIZE_PASS(AMDGPUPerfHintAnalysis, DEBUG_TYPE,
-                "Analysis if a function is memory bound", true, true)
+INITIALIZE_PASS_BEGIN(AMDGPUPerfHintAnalysis, DEBUG_TYPE,
+                      "Analysis if a function is memory bound", true, true)
+INITIALIZE_PASS_DEPENDENCY(TargetLibraryInfoWrapperPass)
+INITIALIZE_PASS_END(AMDGPUPerfHintAnalysis, DEBUG_TYPE,
+                    "Analysis if a function is memory bound", true, true)
 
 namespace {
 
+// Weight of an instruction executed once per call.
+static const uint64_t BlockWeightScale = 16;
+
+// Bound on weights and weighted counts, low enough that the threshold
+// computations below cannot overflow.
+static const uint64_t MaxBlockWeight = UINT64_C(1) << 30;
+static const uint64_t MaxWeightedCount = UINT64_C(1) << 40;
+
+// Adds N instructions of a block of the given weight to Count. Cold code is
+// rounded up rather than down, so that it is never dropped entirely.
+static void addWeighted(uint64_t &Count, uint64_t N, uint64_t Weight) {
+  uint64_t Product = SaturatingMultiply(N, Weight);
+  uint64_t Add = Product / BlockWeightScale + (Product % BlockWeightScale != 0);
+  Count = std::min(SaturatingAdd(Count, Add), MaxWeightedCount);
+}
+
 struct AMDGPUPerfHint {
   friend AMDGPUPerfHintAnalysis;
 
 public:
   AMDGPUPerfHint(AMDGPUPerfHintAnalysis::FuncInfoMap &FIM_,
-                 const TargetLowering *TLI_)
-      : FIM(FIM_), DL(nullptr), TLI(TLI_) {}
+                 const TargetLowering *TLI_, TargetLibraryInfo &LibInfo_)
+      : FIM(FIM_), DL(nullptr), TLI(TLI_), LibInfo(LibInfo_) {}
 
   bool runOnFunction(Function &F);
 
@@ -101,7 +139,19 @@ private:
 
   const TargetLowering *TLI;
 
+  TargetLibraryInfo &LibInfo;
+
+  /// Estimated executions per call of each block of the function being
+  /// visited, in units of 1/BlockWeightScale. Empty if every block has weight
+  /// BlockWeightScale.
+  DenseMap<const BasicBlock *, uint64_t> BlockWeights;
+
+  void computeBlockWeights(Function &F);
+  uint64_t getBlockWeight(const BasicBlock &BB) const;
+
   AMDGPUPerfHintAnalysis::FuncInfo *visit(const Function &F);
+  void emitRemark(Function &F, const AMDGPUPerfHintAnalysis::FuncInfo &FI,
+                  bool MemBound, bool LimitWave) const;
   static bool isMemBound(const AMDGPUPerfHintAnalysis::FuncInfo &F);
   static bool needLimitWave(const AMDGPUPerfHintAnalysis::FuncInfo &F);
 
@@ -203,6 +253,62 @@ bool AMDGPUPerfHint::isIndirectAccess(const Instruction *Inst) const {
   return false;
 }
 
+void AMDGPUPerfHint::computeBlockWeights(Function &F) {
+  BlockWeights.clear();
+  if (!UseFrequency)
+    return;
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  if (LI.empty() && !F.hasProfileData())
+    return;
+
+  BranchProbabilityInfo BPI(F, LI, &LibInfo);
+  BlockFrequencyInfo BFI(F, BPI, LI);
+  double EntryFreq = BFI.getEntryFreq();
+
+  // Static branch probabilities assume a fixed number of iterations for every
+  // loop. Without a profile, scale each loop by the ratio of the trip count
+  // known to ScalarEvolution to that static estimate.
+  DenseMap<const Loop *, double> LoopScale;
+  if (!F.hasProfileData()) {
+    AssumptionCache AC(F);
+    ScalarEvolution SE(F, LibInfo, AC, DT, LI);
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      BasicBlock *Preheader = L->getLoopPreheader();
+      unsigned TripCount = SE.getSmallConstantTripCount(L);
+      if (!Preheader || !TripCount)
+        continue;
+      double Estimate =
+          double(BFI.getBlockFreq(L->getHeader()).getFrequency()) /
+          std::max<uint64_t>(BFI.getBlockFreq(Preheader).getFrequency(), 1);
+      if (Estimate > 0)
+        LoopScale[L] = TripCount / Estimate;
+    }
+  }
+
+  for (const BasicBlock &BB : F) {
+    double Weight = BFI.getBlockFreq(&BB).getFrequency() / EntryFreq;
+    for (const Loop *L = LI.getLoopFor(&BB); L; L = L->getParentLoop()) {
+      auto Scale = LoopScale.find(L);
+      if (Scale != LoopScale.end())
+        Weight *= Scale->second;
+    }
+    // Blocks that are colder than 1/BlockWeightScale of the entry still get
+    // the smallest weight, so that their instructions are down-weighted
+    // rather than ignored.
+    Weight = std::min(Weight * BlockWeightScale, double(MaxBlockWeight));
+    BlockWeights[&BB] = std::max(uint64_t(Weight), uint64_t(1));
+  }
+}
+
+uint64_t AMDGPUPerfHint::getBlockWeight(const BasicBlock &BB) const {
+  auto Weight = BlockWeights.find(&BB);
+  if (Weight == BlockWeights.end())
+    return BlockWeightScale;
+  return Weight->second;
+}
+
 AMDGPUPerfHintAnalysis::FuncInfo *AMDGPUPerfHint::visit(const Function &F) {
   AMDGPUPerfHintAnalysis::FuncInfo &FI = FIM[&F];
 
@@ -210,21 +316,22 @@ AMDGPUPerfHintAnalysis::FuncInfo *AMDGPUPerfHint::visit(const Function &F) {
 
   for (auto &B : F) {
     LastAccess = MemAccessInfo();
+    uint64_t W = getBlockWeight(B);
     for (auto &I : B) {
       if (getMemoryInstrPtr(&I)) {
         if (isIndirectAccess(&I))
-          ++FI.IAMInstCount;
+          addWeighted(FI.IAMInstCount, BlockWeightScale, W);
         if (isLargeStride(&I))
-          ++FI.LSMInstCount;
-        ++FI.MemInstCount;
-        ++FI.InstCount;
+          addWeighted(FI.LSMInstCount, BlockWeightScale, W);
+        addWeighted(FI.MemInstCount, BlockWeightScale, W);
+        addWeighted(FI.InstCount, BlockWeightScale, W);
         continue;
       }
       CallSite CS(const_cast<Instruction *>(&I));
       if (CS) {
         Function *Callee = CS.getCalledFunction();
         if (!Callee || Callee->isDeclaration()) {
-          ++FI.InstCount;
+          addWeighted(FI.InstCount, BlockWeightScale, W);
           continue;
         }
         if (&F == Callee) // Handle immediate recursion
@@ -234,10 +341,10 @@ AMDGPUPerfHintAnalysis::FuncInfo *AMDGPUPerfHint::visit(const Function &F) {
         if (Loc == FIM.end())
           continue;
 
-        FI.MemInstCount += Loc->second.MemInstCount;
-        FI.InstCount += Loc->second.InstCount;
-        FI.IAMInstCount += Loc->second.IAMInstCount;
-        FI.LSMInstCount += Loc->second.LSMInstCount;
+        addWeighted(FI.MemInstCount, Loc->second.MemInstCount, W);
+        addWeighted(FI.InstCount, Loc->second.InstCount, W);
+        addWeighted(FI.IAMInstCount, Loc->second.IAMInstCount, W);
+        addWeighted(FI.LSMInstCount, Loc->second.LSMInstCount, W);
       } else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
         TargetLoweringBase::AddrMode AM;
         auto *Ptr = GetPointerBaseWithConstantOffset(GEP, AM.BaseOffs, *DL);
@@ -247,9 +354,9 @@ AMDGPUPerfHintAnalysis::FuncInfo *AMDGPUPerfHint::visit(const Function &F) {
                                        GEP->getPointerAddressSpace()))
           // Offset will likely be folded into load or store
           continue;
-        ++FI.InstCount;
+        addWeighted(FI.InstCount, BlockWeightScale, W);
       } else {
-        ++FI.InstCount;
+        addWeighted(FI.InstCount, BlockWeightScale, W);
       }
     }
   }
@@ -265,6 +372,7 @@ bool AMDGPUPerfHint::runOnFunction(Function &F) {
       F.hasFnAttribute("amdgpu-memory-bound"))
     return false;
 
+  computeBlockWeights(F);
   const AMDGPUPerfHintAnalysis::FuncInfo *Info = visit(F);
 
   LLVM_DEBUG(dbgs() << F.getName() << " MemInst: " << Info->MemInstCount
@@ -273,26 +381,60 @@ bool AMDGPUPerfHint::runOnFunction(Function &F) {
                     << " LSMInst: " << Info->LSMInstCount << '\n'
                     << " TotalInst: " << Info->InstCount << '\n');
 
-  if (isMemBound(*Info)) {
+  bool MemBound = isMemBound(*Info);
+  if (MemBound) {
     LLVM_DEBUG(dbgs() << F.getName() << " is memory bound\n");
     NumMemBound++;
     F.addFnAttr("amdgpu-memory-bound", "true");
   }
 
-  if (AMDGPU::isEntryFunctionCC(F.getCallingConv()) && needLimitWave(*Info)) {
-    LLVM_DEBUG(dbgs() << F.getName() << " needs limit wave\n");
-    NumLimitWave++;
-    F.addFnAttr("amdgpu-wave-limiter", "true");
+  if (AMDGPU::isEntryFunctionCC(F.getCallingConv())) {
+    bool LimitWave = needLimitWave(*Info);
+    if (LimitWave) {
+      LLVM_DEBUG(dbgs() << F.getName() << " needs limit wave\n");
+      NumLimitWave++;
+      F.addFnAttr("amdgpu-wave-limiter", "true");
+    }
+    emitRemark(F, *Info, MemBound, LimitWave);
   }
 
   return true;
 }
 
+void AMDGPUPerfHint::emitRemark(Function &F,
+                                const AMDGPUPerfHintAnalysis::FuncInfo &FI,
+                                bool MemBound, bool LimitWave) const {
+  OptimizationRemarkEmitter ORE(&F);
+  ORE.emit([&]() {
+    // Arithmetic intensity is estimated as the number of non-memory
+    // instructions executed per memory instruction, or per call when there
+    // is no memory access.
+    uint64_t ALUInstCount = FI.InstCount - std::min(FI.MemInstCount,
+                                                    FI.InstCount);
+    float Intensity = FI.MemInstCount
+                          ? float(ALUInstCount) / float(FI.MemInstCount)
+                          : float(ALUInstCount) / BlockWeightScale;
+    return OptimizationRemarkAnalysis(DEBUG_TYPE, "ArithmeticIntensity",
+                                      F.getSubprogram(), &F.getEntryBlock())
+           << "estimated arithmetic intensity "
+           << ore::NV("ArithmeticIntensity", Intensity) << " (memory "
+           << ore::NV("MemInstPercent",
+                      unsigned(FI.MemInstCount * 100 /
+                               std::max<uint64_t>(FI.InstCount, 1)))
+           << "%), memory bound: " << ore::NV("MemoryBound", MemBound)
+           << ", wave limiter: " << ore::NV("WaveLimiter", LimitWave);
+  });
+}
+
 bool AMDGPUPerfHint::isMemBound(const AMDGPUPerfHintAnalysis::FuncInfo &FI) {
+  if (!FI.InstCount)
+    return false;
   return FI.MemInstCount * 100 / FI.InstCount > MemBoundThresh;
 }
 
 bool AMDGPUPerfHint::needLimitWave(const AMDGPUPerfHintAnalysis::FuncInfo &FI) {
+  if (!FI.InstCount)
+    return false;
   return ((FI.MemInstCount + FI.IAMInstCount * IAWeight +
            FI.LSMInstCount * LSWeight) *
           100 / FI.InstCount) > LimitWaveThresh;
@@ -378,7 +520,9 @@ bool AMDGPUPerfHintAnalysis::runOnSCC(CallGraphSCC &SCC) {
       continue;
 
     const TargetSubtargetInfo *ST = TM.getSubtargetImpl(*F);
-    AMDGPUPerfHint Analyzer(FIM, ST->getTargetLowering());
+    TargetLibraryInfo &LibInfo =
+        getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(*F);
+    AMDGPUPerfHint Analyzer(FIM, ST->getTargetLowering(), LibInfo);
 
     if (Analyzer.runOnFunction(*F))
       Changed = true;
@@ -16,6 +16,7 @@
 #define LLVM_LIB_TARGET_AMDGPU_MDGPUPERFHINTANALYSIS_H
 
 #include "llvm/Analysis/CallGraphSCCPass.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/ValueMap.h"
 #include "llvm/Pass.h"
 
@@ -30,6 +31,7 @@ public:
   bool runOnSCC(CallGraphSCC &SCC) override;
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetLibraryInfoWrapperPass>();
     AU.setPreservesAll();
   }
 
@@ -37,11 +39,14 @@ public:
 
   bool needsWaveLimiter(const Function *F) const;
 
+  /// Instruction counts of a function. Unless frequency weighting is
+  /// disabled, each instruction is counted by its estimated number of
+  /// executions per call, in units of 1/BlockWeightScale.
   struct FuncInfo {
-    unsigned MemInstCount;
-    unsigned InstCount;
-    unsigned IAMInstCount; // Indirect access memory instruction count
-    unsigned LSMInstCount; // Large stride memory instruction count
+    uint64_t MemInstCount;
+    uint64_t InstCount;
+    uint64_t IAMInstCount; // Indirect access memory instruction count
+    uint64_t LSMInstCount; // Large stride memory instruction count
     FuncInfo() : MemInstCount(0), InstCount(0), IAMInstCount(0),
                  LSMInstCount(0) {}
   };
@@ -9,6 +9,11 @@
 // This pass eliminates allocas by either converting them into vectors or
 // by migrating them to local address space.
 //
+// Allocas that can only be migrated to local memory compete for the local
+// memory a kernel may use without dropping below its occupancy target. They
+// are ranked by the scratch accesses they are estimated to save per byte of
+// local memory, so that the most profitable ones are promoted first.
+//
 //===----------------------------------------------------------------------===//
 
 #include "AMDGPU.h"
@@ -21,6 +26,7 @@
 #include "llvm/ADT/Triple.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/CodeGen/TargetPassConfig.h"
 #include "llvm/IR/Attributes.h"
@@ -29,6 +35,7 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/GlobalVariable.h"
@@ -108,6 +115,26 @@ private:
   /// Check whether we have enough local memory for promotion.
   bool hasSufficientLocalMem(const Function &F);
 
+  /// An alloca that can be promoted to local memory.
+  struct LDSCandidate {
+    AllocaInst *Alloca;
+    /// Values derived from the alloca when it was selected. Only used to
+    /// estimate the benefit, since promoting another candidate may replace
+    /// some of them.
+    std::vector<Value *> WorkList;
+    /// Local memory needed for the whole work group.
+    uint32_t Size;
+    unsigned Align;
+    /// Estimated number of scratch accesses saved by the promotion.
+    uint64_t Benefit = 0;
+  };
+
+  /// Pick the candidates that fit into the available local memory, most
+  /// profitable first, and promote them.
+  bool promoteCandidatesToLDS(Function &F,
+                              SmallVectorImpl<LDSCandidate> &Candidates);
+  bool promoteAllocaToLDS(LDSCandidate &C);
+
 public:
   static char ID;
 
@@ -118,7 +145,8 @@ public:
 
   StringRef getPassName() const override { return "AMDGPU Promote Alloca"; }
 
-  bool handleAlloca(AllocaInst &I, bool SufficientLDS);
+  bool handleAlloca(AllocaInst &I, bool SufficientLDS,
+                    SmallVectorImpl<LDSCandidate> &Candidates);
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.setPreservesCFG();
@@ -169,11 +197,15 @@ bool AMDGPUPromoteAlloca::runOnFunction(Function &F) {
       Allocas.push_back(AI);
   }
 
+  SmallVector<LDSCandidate, 8> Candidates;
   for (AllocaInst *AI : Allocas) {
-    if (handleAlloca(*AI, SufficientLDS))
+    if (handleAlloca(*AI, SufficientLDS, Candidates))
       Changed = true;
   }
 
+  if (!Candidates.empty() && promoteCandidatesToLDS(F, Candidates))
+    Changed = true;
+
   return Changed;
 }
 
@@ -645,6 +677,21 @@ bool AMDGPUPromoteAlloca::hasSufficientLocalMem(const Function &F) {
 
   const DataLayout &DL = Mod->getDataLayout();
 
+  // Local memory used by the functions F calls is allocated with F's.
+  SmallPtrSet<const Function *, 8> Reachable;
+  SmallVector<const Function *, 8> Worklist;
+  Reachable.insert(&F);
+  Worklist.push_back(&F);
+  while (!Worklist.empty()) {
+    const Function *Caller = Worklist.pop_back_val();
+    for (const BasicBlock &BB : *Caller)
+      for (const Instruction &I : BB)
+        if (const auto *Call = dyn_cast<CallBase>(&I))
+          if (const Function *Callee = Call->getCalledFunction())
+            if (!Callee->isDeclaration() && Reachable.insert(Callee).second)
+              Worklist.push_back(Callee);
+  }
+
   // Check how much local memory is being used by global objects
   CurrentLocalMemUsage = 0;
   for (GlobalVariable &GV : Mod->globals()) {
@@ -656,7 +703,7 @@ bool AMDGPUPromoteAlloca::hasSufficientLocalMem(const Function &F) {
       if (!Use)
         continue;
 
-      if (Use->getParent()->getParent() == &F) {
+      if (Reachable.count(Use->getParent()->getParent())) {
         unsigned Align = GV.getAlignment();
         if (Align == 0)
           Align = DL.getABITypeAlignment(GV.getValueType());
@@ -713,15 +760,16 @@ bool AMDGPUPromoteAlloca::hasSufficientLocalMem(const Function &F) {
   return true;
 }
 
-// FIXME: Should try to pick the most likely to be profitable allocas first.
-bool AMDGPUPromoteAlloca::handleAlloca(AllocaInst &I, bool SufficientLDS) {
+// Returns true if the alloca was promoted to a vector. Allocas that can be
+// promoted to local memory are appended to \p Candidates instead.
+bool AMDGPUPromoteAlloca::handleAlloca(
+    AllocaInst &I, bool SufficientLDS,
+    SmallVectorImpl<LDSCandidate> &Candidates) {
   // Array allocations are probably not worth handling, since an allocation of
   // the array type is the canonical form.
   if (!I.isStaticAlloca() || I.isArrayAllocation())
     return false;
 
-  IRBuilder<> Builder(&I);
-
   // First try to replace the alloca with a vector
   Type *AllocaTy = I.getAllocatedType();
 
@@ -763,34 +811,110 @@ bool AMDGPUPromoteAlloca::handleAlloca(AllocaInst &I, bool SufficientLDS) {
   if (Align == 0)
     Align = DL.getABITypeAlignment(I.getAllocatedType());
 
+  uint64_t AllocSize = WorkGroupSize * DL.getTypeAllocSize(AllocaTy);
+  if (AllocSize > LocalMemLimit - CurrentLocalMemUsage) {
+    LLVM_DEBUG(dbgs() << "  " << AllocSize
+                      << " bytes of local memory not available to promote\n");
+    return false;
+  }
+
+  std::vector<Value*> WorkList;
+
+  if (!collectUsesWithPtrTypes(&I, &I, WorkList)) {
+    LLVM_DEBUG(dbgs() << " Do not know how to convert all uses\n");
+    return false;
+  }
+
+  LLVM_DEBUG(dbgs() << "Candidate for promotion to local memory\n");
+  Candidates.push_back(
+      LDSCandidate{&I, std::move(WorkList), uint32_t(AllocSize), Align});
+  return false;
+}
+
+// Weight of an access in a loop of the given depth, assuming a few iterations
+// per loop.
+static uint64_t getLoopDepthWeight(unsigned Depth) {
+  return UINT64_C(1) << (3 * std::min(Depth, 4u));
+}
+
+bool AMDGPUPromoteAlloca::promoteCandidatesToLDS(
+    Function &F, SmallVectorImpl<LDSCandidate> &Candidates) {
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+
+  for (LDSCandidate &C : Candidates) {
+    auto CountAccesses = [&](Value *V) {
+      for (User *U : V->users()) {
+        auto *UI = dyn_cast<Instruction>(U);
+        if (!UI)
+          continue;
+        if ((isa<LoadInst>(UI) && UI->getOperand(0) == V) ||
+            (isa<StoreInst>(UI) && UI->getOperand(1) == V) ||
+            isa<AtomicRMWInst>(UI) || isa<AtomicCmpXchgInst>(UI) ||
+            isa<MemIntrinsic>(UI))
+          C.Benefit += getLoopDepthWeight(LI.getLoopDepth(UI->getParent()));
+      }
+    };
+    CountAccesses(C.Alloca);
+    for (Value *V : C.WorkList)
+      CountAccesses(V);
+  }
+
+  // Rank by saved accesses per byte of local memory, then by program order.
+  SmallVector<LDSCandidate *, 8> Ranked;
+  for (LDSCandidate &C : Candidates)
+    Ranked.push_back(&C);
+  std::stable_sort(Ranked.begin(), Ranked.end(),
+                   [](const LDSCandidate *A, const LDSCandidate *B) {
+                     return A->Benefit * B->Size > B->Benefit * A->Size;
+                   });
+
   // FIXME: This computed padding is likely wrong since it depends on inverse
   // usage order.
   //
   // FIXME: It is also possible that if we're allowed to use all of the memory
   // could could end up using more than the maximum due to alignment padding.
-
-  uint32_t NewSize = alignTo(CurrentLocalMemUsage, Align);
-  uint32_t AllocSize = WorkGroupSize * DL.getTypeAllocSize(AllocaTy);
-  NewSize += AllocSize;
-
-  if (NewSize > LocalMemLimit) {
-    LLVM_DEBUG(dbgs() << "  " << AllocSize
-                      << " bytes of local memory not available to promote\n");
-    return false;
+  SmallPtrSet<AllocaInst *, 8> Selected;
+  for (LDSCandidate *C : Ranked) {
+    uint32_t NewSize = alignTo(CurrentLocalMemUsage, C->Align) + C->Size;
+    if (NewSize > LocalMemLimit) {
+      LLVM_DEBUG(dbgs() << "  " << C->Size << " bytes of local memory not "
+                        << "available to promote " << *C->Alloca << '\n');
+      continue;
+    }
+    LLVM_DEBUG(dbgs() << "  Selected " << *C->Alloca << " saving about "
+                      << C->Benefit << " scratch accesses\n");
+    CurrentLocalMemUsage = NewSize;
+    Selected.insert(C->Alloca);
   }
 
-  CurrentLocalMemUsage = NewSize;
+  // Promote in program order to keep the layout of local memory predictable.
+  bool Changed = false;
+  for (LDSCandidate &C : Candidates)
+    if (Selected.count(C.Alloca))
+      Changed |= promoteAllocaToLDS(C);
 
-  std::vector<Value*> WorkList;
+  return Changed;
+}
+
+bool AMDGPUPromoteAlloca::promoteAllocaToLDS(LDSCandidate &C) {
+  AllocaInst &I = *C.Alloca;
 
+  // Collect the uses again: a memory intrinsic shared with a candidate that
+  // was already promoted has been replaced by a new call.
+  std::vector<Value *> WorkList;
   if (!collectUsesWithPtrTypes(&I, &I, WorkList)) {
     LLVM_DEBUG(dbgs() << " Do not know how to convert all uses\n");
     return false;
   }
 
+  IRBuilder<> Builder(&I);
+
   LLVM_DEBUG(dbgs() << "Promoting alloca to local memory\n");
 
   Function *F = I.getParent()->getParent();
+  const AMDGPUSubtarget &ST = AMDGPUSubtarget::get(*TM, *F);
+  unsigned WorkGroupSize = ST.getFlatWorkGroupSizes(*F).second;
 
   Type *GVTy = ArrayType::get(I.getAllocatedType(), WorkGroupSize);
   GlobalVariable *GV = new GlobalVariable(
@@ -933,6 +1057,7 @@ bool AMDGPUPromoteAlloca::handleAlloca(AllocaInst &I, bool SufficientLDS) {
       llvm_unreachable("Don't know how to promote alloca intrinsic use.");
     }
   }
+
   return true;
 }
 
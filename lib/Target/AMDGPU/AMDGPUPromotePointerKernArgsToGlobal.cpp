@@ -8,18 +8,44 @@
 //
 /// \file
 /// Generic pointer kernel arguments need promoting to global ones.
+///
+/// It can run in two modes: as a function or module pass. A function pass
+/// only rewrites the generic pointer arguments of kernels. A module pass also
+/// propagates the address space through calls: a generic pointer argument of
+/// a non-entry function is promoted when every call site passes a pointer
+/// known to be global. If only some call sites do, or the function may have
+/// callers outside the module, an internal clone specialized for those call
+/// sites is created instead. InferAddressSpaces has to run after either mode.
 //
 //===----------------------------------------------------------------------===//
 
 #include "AMDGPU.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "amdgpu-promote-pointer-kernargs"
 
+STATISTIC(NumArgsPromoted, "Number of generic pointer arguments promoted");
+STATISTIC(NumCalleesCloned, "Number of callees cloned for global pointers");
+
+static cl::opt<unsigned> MaxClonesPerFunction(
+  "amdgpu-promote-pointer-args-max-clones",
+  cl::desc("Maximum number of address space specialized clones created for a "
+           "single function"),
+  cl::init(4), cl::Hidden);
+
 namespace {
 
 class AMDGPUPromotePointerKernArgsToGlobal : public FunctionPass {
@@ -31,6 +57,23 @@ public:
   bool runOnFunction(Function &F) override;
 };
 
+class AMDGPUPromotePointerArgsToGlobal : public ModulePass {
+  // Clones keyed by the original function and the mask of the arguments
+  // promoted in them.
+  DenseMap<std::pair<Function *, uint64_t>, Function *> Clones;
+  DenseMap<Function *, unsigned> NumClones;
+
+  Function *getOrCreateClone(Function &F, uint64_t Mask);
+  bool promoteCallee(Function &F, SetVector<Function *> &Worklist);
+
+public:
+  static char ID;
+
+  AMDGPUPromotePointerArgsToGlobal() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override;
+};
+
 } // End anonymous namespace
 
 char AMDGPUPromotePointerKernArgsToGlobal::ID = 0;
@@ -38,35 +81,223 @@ char AMDGPUPromotePointerKernArgsToGlobal::ID = 0;
 INITIALIZE_PASS(AMDGPUPromotePointerKernArgsToGlobal, DEBUG_TYPE,
                 "Lower intrinsics", false, false)
 
-bool AMDGPUPromotePointerKernArgsToGlobal::runOnFunction(Function &F) {
-  // Skip non-entry function.
-  if (F.getCallingConv() != CallingConv::AMDGPU_KERNEL)
+char AMDGPUPromotePointerArgsToGlobal::ID = 0;
+
+INITIALIZE_PASS(AMDGPUPromotePointerArgsToGlobal,
+                "amdgpu-promote-pointer-args",
+                "Promote generic pointer arguments through calls",
+                false, false)
+
+static bool isGenericPointerArg(const Argument &Arg) {
+  auto PtrTy = dyn_cast<PointerType>(Arg.getType());
+  return PtrTy && PtrTy->getPointerAddressSpace() == AMDGPUAS::FLAT_ADDRESS;
+}
+
+// Check whether the argument has already been promoted, i.e. it is only used
+// to form global pointers. This keeps repeated runs from stacking casts.
+static bool isPromoted(const Argument &Arg) {
+  return all_of(Arg.users(), [](const User *U) {
+    auto ASC = dyn_cast<AddrSpaceCastInst>(U);
+    return ASC && ASC->getDestAddressSpace() == AMDGPUAS::GLOBAL_ADDRESS;
+  });
+}
+
+// Rewrite all uses of a generic pointer argument to go through a cast to the
+// global address space and back, which InferAddressSpaces then folds away.
+static bool promoteArg(Argument &Arg, IRBuilder<> &IRB) {
+  if (!isGenericPointerArg(Arg) || isPromoted(Arg))
     return false;
 
+  auto PtrTy = cast<PointerType>(Arg.getType());
+  auto GlobalPtr =
+      IRB.CreateAddrSpaceCast(&Arg,
+                              PointerType::get(PtrTy->getPointerElementType(),
+                                               AMDGPUAS::GLOBAL_ADDRESS),
+                              Arg.getName());
+  auto NewFlatPtr = IRB.CreateAddrSpaceCast(GlobalPtr, PtrTy, Arg.getName());
+  Arg.replaceAllUsesWith(NewFlatPtr);
+  // Fix the global pointer itself.
+  cast<Instruction>(GlobalPtr)->setOperand(0, &Arg);
+  ++NumArgsPromoted;
+  return true;
+}
+
+static bool promoteArgs(Function &F, uint64_t Mask) {
   auto &Entry = F.getEntryBlock();
   IRBuilder<> IRB(&Entry, Entry.begin());
 
   bool Changed = false;
   for (auto &Arg : F.args()) {
-    auto PtrTy = dyn_cast<PointerType>(Arg.getType());
-    if (!PtrTy || PtrTy->getPointerAddressSpace() != AMDGPUAS::FLAT_ADDRESS)
+    // Arguments past the width of the mask are only promoted by an all-ones
+    // mask, as used for kernels.
+    unsigned ArgNo = Arg.getArgNo();
+    if (ArgNo < 64 ? (Mask >> ArgNo) & 1 : Mask == ~UINT64_C(0))
+      Changed |= promoteArg(Arg, IRB);
+  }
+  return Changed;
+}
+
+// Look through GEPs and bitcasts for a cast from the global address space.
+// Promoted arguments are only reachable through such casts, so this also
+// recognizes pointers derived from already promoted arguments.
+static bool isKnownGlobalPointer(const Value *V) {
+  while (true) {
+    if (V->getType()->getPointerAddressSpace() == AMDGPUAS::GLOBAL_ADDRESS)
+      return true;
+    if (Operator::getOpcode(V) == Instruction::AddrSpaceCast)
+      return cast<Operator>(V)->getOperand(0)->getType()
+                 ->getPointerAddressSpace() == AMDGPUAS::GLOBAL_ADDRESS;
+    if (auto GEP = dyn_cast<GEPOperator>(V))
+      V = GEP->getPointerOperand();
+    else if (auto BC = dyn_cast<BitCastOperator>(V))
+      V = BC->getOperand(0);
+    else
+      return false;
+  }
+}
+
+// Mask of the generic pointer arguments which receive a global pointer at
+// this call site.
+static uint64_t getGlobalArgMask(const CallBase &CB, const Function &F) {
+  uint64_t Mask = 0;
+  for (auto &Arg : F.args()) {
+    unsigned ArgNo = Arg.getArgNo();
+    if (ArgNo >= 64)
+      break;
+    if (isGenericPointerArg(Arg) &&
+        isKnownGlobalPointer(CB.getArgOperand(ArgNo)))
+      Mask |= UINT64_C(1) << ArgNo;
+  }
+  return Mask;
+}
+
+static void addCallees(Function &F, SetVector<Function *> &Worklist) {
+  for (auto &I : instructions(F)) {
+    if (auto CB = dyn_cast<CallBase>(&I)) {
+      if (auto Callee = dyn_cast_or_null<Function>(
+            CB->getCalledValue()->stripPointerCasts()))
+        Worklist.insert(Callee);
+    }
+  }
+}
+
+bool AMDGPUPromotePointerKernArgsToGlobal::runOnFunction(Function &F) {
+  // Skip non-entry function.
+  if (F.getCallingConv() != CallingConv::AMDGPU_KERNEL)
+    return false;
+
+  return promoteArgs(F, ~UINT64_C(0));
+}
+
+Function *AMDGPUPromotePointerArgsToGlobal::getOrCreateClone(Function &F,
+                                                             uint64_t Mask) {
+  auto It = Clones.find({&F, Mask});
+  if (It != Clones.end())
+    return It->second;
+
+  unsigned &Count = NumClones[&F];
+  if (Count >= MaxClonesPerFunction)
+    return nullptr;
+  ++Count;
+
+  ValueToValueMapTy VMap;
+  Function *NewF = CloneFunction(&F, VMap);
+  NewF->setName(F.getName() + ".global");
+  NewF->setLinkage(GlobalValue::InternalLinkage);
+  NewF->setVisibility(GlobalValue::DefaultVisibility);
+  NewF->setComdat(nullptr);
+  promoteArgs(*NewF, Mask);
+  ++NumCalleesCloned;
+
+  LLVM_DEBUG(dbgs() << "Cloned " << F.getName() << " as " << NewF->getName()
+                    << '\n');
+
+  Clones[{&F, Mask}] = NewF;
+  return NewF;
+}
+
+bool AMDGPUPromotePointerArgsToGlobal::promoteCallee(
+    Function &F, SetVector<Function *> &Worklist) {
+  if (F.isDeclaration() || F.getCallingConv() == CallingConv::AMDGPU_KERNEL ||
+      none_of(F.args(), isGenericPointerArg))
+    return false;
+
+  SmallVector<std::pair<CallBase *, uint64_t>, 8> CallSites;
+  bool HasOtherUses = false;
+  for (Use &U : F.uses()) {
+    auto CB = dyn_cast<CallBase>(U.getUser());
+    if (!CB || !CB->isCallee(&U) ||
+        CB->getFunctionType() != F.getFunctionType()) {
+      HasOtherUses = true;
+      continue;
+    }
+    CallSites.push_back({CB, getGlobalArgMask(*CB, F)});
+  }
+
+  if (CallSites.empty())
+    return false;
+
+  // If all callers are known, promote the arguments common to every call
+  // site in place.
+  uint64_t CommonMask = ~UINT64_C(0);
+  for (auto &CS : CallSites)
+    CommonMask &= CS.second;
+
+  bool Changed = false;
+  if (F.hasLocalLinkage() && !HasOtherUses && CommonMask != 0 &&
+      promoteArgs(F, CommonMask)) {
+    addCallees(F, Worklist);
+    Changed = true;
+  }
+
+  // Specialize the remaining call sites which pass additional global
+  // pointers.
+  uint64_t InPlaceMask = (F.hasLocalLinkage() && !HasOtherUses) ?
+                         CommonMask : 0;
+  for (auto &CS : CallSites) {
+    uint64_t Mask = CS.second;
+    if ((Mask & ~InPlaceMask) == 0)
       continue;
 
-    auto GlobalPtr =
-        IRB.CreateAddrSpaceCast(&Arg,
-                                PointerType::get(PtrTy->getPointerElementType(),
-                                                 AMDGPUAS::GLOBAL_ADDRESS),
-                                Arg.getName());
-    auto NewFlatPtr = IRB.CreateAddrSpaceCast(GlobalPtr, PtrTy, Arg.getName());
-    Arg.replaceAllUsesWith(NewFlatPtr);
-    // Fix the global pointer itself.
-    cast<Instruction>(GlobalPtr)->setOperand(0, &Arg);
+    Function *NewF = getOrCreateClone(F, Mask);
+    if (!NewF)
+      continue;
+
+    CS.first->setCalledFunction(NewF);
+    Worklist.insert(NewF);
+    addCallees(*NewF, Worklist);
     Changed = true;
   }
 
   return Changed;
 }
 
+bool AMDGPUPromotePointerArgsToGlobal::runOnModule(Module &M) {
+  Clones.clear();
+  NumClones.clear();
+
+  // Kernels seed the propagation, the rest is discovered through calls until
+  // no more arguments can be promoted.
+  SetVector<Function *> Worklist;
+  bool Changed = false;
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+    if (F.getCallingConv() == CallingConv::AMDGPU_KERNEL)
+      Changed |= promoteArgs(F, ~UINT64_C(0));
+    Worklist.insert(&F);
+  }
+
+  while (!Worklist.empty())
+    Changed |= promoteCallee(*Worklist.pop_back_val(), Worklist);
+
+  return Changed;
+}
+
 FunctionPass *llvm::createAMDGPUPromotePointerKernArgsToGlobalPass() {
   return new AMDGPUPromotePointerKernArgsToGlobal();
 }
+
+ModulePass *llvm::createAMDGPUPromotePointerArgsToGlobalPass() {
+  return new AMDGPUPromotePointerArgsToGlobal();
+}
@@ -170,6 +170,14 @@ static cl::opt<bool> EnableSIModeRegisterPass(
   cl::init(true),
   cl::Hidden);
 
+// Move cheap defs to their uses to increase occupancy
+static cl::opt<bool> EnablePreRARemat(
+  "amdgpu-remat-for-occupancy",
+  cl::desc("Rematerialize defs before register allocation to increase "
+           "occupancy"),
+  cl::init(false),
+  cl::Hidden);
+
 // Option is used in lit tests to prevent deadcoding of patterns inspected.
 static cl::opt<bool>
 EnableDCEInRA("amdgpu-dce-in-ra",
@@ -182,6 +190,13 @@ static cl::opt<bool> EnableScalarIRPasses(
   cl::init(true),
   cl::Hidden);
 
+// Propagate global pointer arguments from kernels into non-inlined callees
+static cl::opt<bool> EnablePromotePointerArgsIPO(
+  "amdgpu-promote-pointer-args-ipo",
+  cl::desc("Promote generic pointer arguments of callees to global"),
+  cl::init(false),
+  cl::Hidden);
+
 extern "C" void LLVMInitializeAMDGPUTarget() {
   // Register the target
   RegisterTargetMachine<R600TargetMachine> X(getTheAMDGPUTarget());
@@ -218,6 +233,7 @@ extern "C" void LLVMInitializeAMDGPUTarget() {
   initializeAMDGPUOpenCLEnqueuedBlockLoweringPass(*PR);
   initializeAMDGPUPromoteAllocaPass(*PR);
   initializeAMDGPUPromotePointerKernArgsToGlobalPass(*PR);
+  initializeAMDGPUPromotePointerArgsToGlobalPass(*PR);
   initializeAMDGPUCodeGenPreparePass(*PR);
   initializeAMDGPUPropagateAttributesEarlyPass(*PR);
   initializeAMDGPUPropagateAttributesLatePass(*PR);
@@ -243,6 +259,7 @@ extern "C" void LLVMInitializeAMDGPUTarget() {
   initializeAMDGPULowerKernelCallsPass(*PR);
   initializeGCNRegBankReassignPass(*PR);
   initializeGCNNSAReassignPass(*PR);
+  initializeGCNPreRARematerializePass(*PR);
 }
 
 static std::unique_ptr<TargetLoweringObjectFile> createTLOF(const Triple &TT) {
@@ -291,6 +308,16 @@ createIterativeILPMachineScheduler(MachineSchedContext *C) {
   return DAG;
 }
 
+static ScheduleDAGInstrs *
+createIterativeBestOfMachineScheduler(MachineSchedContext *C) {
+  auto DAG = new GCNIterativeScheduler(C,
+    GCNIterativeScheduler::SCHEDULE_BESTOF);
+  DAG->addMutation(createLoadClusterDAGMutation(DAG->TII, DAG->TRI));
+  DAG->addMutation(createStoreClusterDAGMutation(DAG->TII, DAG->TRI));
+  DAG->addMutation(createAMDGPUMacroFusionDAGMutation());
+  return DAG;
+}
+
 static MachineSchedRegistry
 R600SchedRegistry("r600", "Run R600's custom scheduler",
                    createR600MachineScheduler);
@@ -319,6 +346,12 @@ GCNILPSchedRegistry("gcn-ilp",
   "Run GCN iterative scheduler for ILP scheduling (experimental)",
   createIterativeILPMachineScheduler);
 
+static MachineSchedRegistry
+GCNBestOfSchedRegistry("gcn-best-of",
+  "Run GCN iterative scheduler keeping the best of its strategies per region "
+  "(experimental)",
+  createIterativeBestOfMachineScheduler);
+
 static StringRef computeDataLayout(const Triple &TT) {
   if (TT.getArch() == Triple::r600) {
     // 32-bit pointers.
@@ -384,6 +417,14 @@ StringRef AMDGPUTargetMachine::getFeatureString(const Function &F) const {
     FSAttr.getValueAsString();
 }
 
+// Local memory is laid out for each kernel from the variables used by the
+// kernel and its callees.
+bool AMDGPUTargetMachine::isAllocatedPerEntryPoint(
+    const GlobalValue &GV) const {
+  return isa<GlobalVariable>(GV) &&
+         GV.getAddressSpace() == AMDGPUAS::LOCAL_ADDRESS;
+}
+
 /// Predicate for Internalize pass.
 static bool mustPreserveGV(const GlobalValue &GV) {
   if (const Function *F = dyn_cast<Function>(&GV))
@@ -400,6 +441,7 @@ void AMDGPUTargetMachine::adjustPassManager(PassManagerBuilder &Builder) {
   bool EarlyInline = EarlyInlineAll && EnableOpt && !EnableFunctionCalls;
   bool AMDGPUAA = EnableAMDGPUAliasAnalysis && EnableOpt;
   bool LibCallSimplify = EnableLibCallSimplify && EnableOpt;
+  bool PromotePointerArgsIPO = EnablePromotePointerArgsIPO && EnableOpt;
 
   if (EnableFunctionCalls) {
     delete Builder.Inliner;
@@ -454,6 +496,17 @@ void AMDGPUTargetMachine::adjustPassManager(PassManagerBuilder &Builder) {
       // and before other cleanup optimizations.
       PM.add(createAMDGPULowerKernelAttributesPass());
   });
+
+  if (PromotePointerArgsIPO) {
+    Builder.addExtension(
+      PassManagerBuilder::EP_OptimizerLast,
+      [](const PassManagerBuilder &, legacy::PassManagerBase &PM) {
+        // Only callees that survived inlining are left, propagate the global
+        // address space of their pointer arguments from the call sites.
+        PM.add(llvm::createAMDGPUPromotePointerArgsToGlobalPass());
+        PM.add(createInferAddressSpacesPass());
+    });
+  }
 }
 
 //===----------------------------------------------------------------------===//
@@ -941,6 +994,9 @@ void GCNPassConfig::addFastRegAlloc() {
 }
 
 void GCNPassConfig::addOptimizedRegAlloc() {
+  if (EnablePreRARemat)
+    insertPass(&MachineSchedulerID, &GCNPreRARematerializeID);
+
   if (OptExecMaskPreRA) {
     insertPass(&MachineSchedulerID, &SIOptimizeExecMaskingPreRAID);
     insertPass(&SIOptimizeExecMaskingPreRAID, &SIFormMemoryClausesID);
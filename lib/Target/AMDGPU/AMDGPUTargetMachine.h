@@ -55,6 +55,8 @@ public:
 
   void adjustPassManager(PassManagerBuilder &) override;
 
+  bool isAllocatedPerEntryPoint(const GlobalValue &GV) const override;
+
   /// Get the integer value of a null pointer in the given address space.
   uint64_t getNullPointerValue(unsigned AddrSpace) const {
     return (AddrSpace == AMDGPUAS::LOCAL_ADDRESS ||
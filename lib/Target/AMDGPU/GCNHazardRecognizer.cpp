@@ -24,6 +24,7 @@
 #include "llvm/CodeGen/MachineOperand.h"
 #include "llvm/CodeGen/ScheduleDAG.h"
 #include "llvm/MC/MCInstrDesc.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include <algorithm>
 #include <cassert>
@@ -33,6 +34,16 @@
 
 using namespace llvm;
 
+static cl::opt<bool> EnableDefTracking(
+    "amdgpu-hazard-def-tracking",
+    cl::desc("Look up wait states since register defs in a table maintained "
+             "while the hazard recognizer walks a block"),
+    cl::init(true), cl::Hidden);
+
+// Defs further back than this are dropped from the table, and queries with a
+// larger limit walk the instructions instead.
+static const int MaxTrackedWaitStates = 32;
+
 //===----------------------------------------------------------------------===//
 // Hazard Recoginizer Implementation
 //===----------------------------------------------------------------------===//
@@ -440,6 +451,100 @@ int GCNHazardRecognizer::getWaitStatesSince(IsHazardFn IsHazard, int Limit) {
   return std::numeric_limits<int>::max();
 }
 
+void GCNHazardRecognizer::trackDef(MachineInstr &MI) {
+  // Count wait states the same way as getWaitStatesSince().
+  if (MI.isBundle())
+    return;
+  if (!MI.isInlineAsm() && !MI.isImplicitDef() && !MI.isDebugInstr())
+    TrackedWaitStates += SIInstrInfo::getNumWaitStates(MI);
+
+  const TrackedDef Def = {&MI, TrackedWaitStates};
+  auto Push = [this, &Def](SmallVectorImpl<TrackedDef> &Defs) {
+    if (!Defs.empty() && Defs.back().MI == Def.MI)
+      return;
+    if (Defs.size() >= 8)
+      Defs.erase(Defs.begin(),
+                 llvm::find_if(Defs, [this](const TrackedDef &D) {
+                   return TrackedWaitStates - D.End < MaxTrackedWaitStates;
+                 }));
+    Defs.push_back(Def);
+  };
+
+  for (const MachineOperand &MO : MI.operands()) {
+    if (MO.isRegMask()) {
+      Push(RecentRegMaskDefs);
+      continue;
+    }
+    if (!MO.isReg() || !MO.isDef() ||
+        !Register::isPhysicalRegister(MO.getReg()))
+      continue;
+    for (MCRegUnitIterator Unit(MO.getReg(), &TRI); Unit.isValid(); ++Unit)
+      Push(RecentDefs[*Unit]);
+  }
+}
+
+// Add the instructions of MI's block before MI to the def table. This relies
+// on the hazard recognizer only inserting instructions in front of the
+// instruction it is looking at, and visiting the instructions of a block in
+// order.
+void GCNHazardRecognizer::trackDefsBefore(MachineInstr *MI) {
+  MachineBasicBlock *MBB = MI->getParent();
+  if (MBB != TrackedMBB) {
+    TrackedMBB = MBB;
+    LastTracked = nullptr;
+    TrackedWaitStates = 0;
+    RecentDefs.clear();
+    RecentRegMaskDefs.clear();
+  }
+
+  MachineBasicBlock::instr_iterator I =
+      LastTracked ? std::next(LastTracked->getIterator()) : MBB->instr_begin();
+  for (MachineBasicBlock::instr_iterator E = MI->getIterator(); I != E; ++I) {
+    if (I == MBB->instr_end()) {
+      // MI is not after the tracked instructions, start over.
+      TrackedMBB = nullptr;
+      return trackDefsBefore(MI);
+    }
+    trackDef(*I);
+    LastTracked = &*I;
+  }
+}
+
+Optional<int>
+GCNHazardRecognizer::getTrackedWaitStatesSinceDef(unsigned Reg,
+                                                  IsHazardFn IsHazardDef,
+                                                  int Limit) {
+  trackDefsBefore(CurrCycleInstr);
+
+  // getWaitStatesSince() returns at the latest hazard it reaches before
+  // running out of wait states.
+  int LatestEnd = -1;
+  auto FindLatest = [&](ArrayRef<TrackedDef> Defs, bool IsRegMask) {
+    for (const TrackedDef &D : reverse(Defs)) {
+      if (TrackedWaitStates - D.End >= Limit || D.End <= LatestEnd)
+        break;
+      if ((!IsRegMask || D.MI->modifiesRegister(Reg, &TRI)) &&
+          IsHazardDef(D.MI)) {
+        LatestEnd = D.End;
+        break;
+      }
+    }
+  };
+  for (MCRegUnitIterator Unit(Reg, &TRI); Unit.isValid(); ++Unit) {
+    auto It = RecentDefs.find(*Unit);
+    if (It != RecentDefs.end())
+      FindLatest(It->second, false);
+  }
+  FindLatest(RecentRegMaskDefs, true);
+
+  if (LatestEnd >= 0)
+    return TrackedWaitStates - LatestEnd;
+  if (TrackedWaitStates >= Limit)
+    return std::numeric_limits<int>::max();
+  // The hazard may be in a predecessor.
+  return None;
+}
+
 int GCNHazardRecognizer::getWaitStatesSinceDef(unsigned Reg,
                                                IsHazardFn IsHazardDef,
                                                int Limit) {
@@ -449,6 +554,18 @@ int GCNHazardRecognizer::getWaitStatesSinceDef(unsigned Reg,
     return IsHazardDef(MI) && MI->modifiesRegister(Reg, TRI);
   };
 
+  if (IsHazardRecognizerMode && EnableDefTracking && Limit > 0 &&
+      Limit <= MaxTrackedWaitStates && Register::isPhysicalRegister(Reg)) {
+    if (Optional<int> WaitStates =
+            getTrackedWaitStatesSinceDef(Reg, IsHazardDef, Limit)) {
+#ifdef EXPENSIVE_CHECKS
+      assert(*WaitStates == getWaitStatesSince(IsHazardFn, Limit) &&
+             "def table out of sync with the instructions");
+#endif
+      return *WaitStates;
+    }
+  }
+
   return getWaitStatesSince(IsHazardFn, Limit);
 }
 
@@ -1267,8 +1384,14 @@ int GCNHazardRecognizer::checkMAIHazards(MachineInstr *MI) {
       return TRI.regsOverlap(DstReg, Reg);
     };
 
-    int WaitStatesSinceDef = getWaitStatesSinceDef(Reg, IsOverlappedMFMAFn,
-                                                   MaxWaitStates);
+    // IsOverlappedMFMAFn looks at every MFMA in the window, not only the
+    // ones defining Reg, so this cannot use the def table.
+    auto IsOverlappedMFMADefFn = [&IsOverlappedMFMAFn, Reg, this]
+                                 (MachineInstr *MI) {
+      return IsOverlappedMFMAFn(MI) && MI->modifiesRegister(Reg, &TRI);
+    };
+    int WaitStatesSinceDef = getWaitStatesSince(IsOverlappedMFMADefFn,
+                                                MaxWaitStates);
     int NeedWaitStates = MFMAWritesAGPROverlappedSrcABWaitStates;
     int SrcCIdx = AMDGPU::getNamedOperandIdx(Opc, AMDGPU::OpName::src2);
     int OpNo = MI->getOperandNo(&Op);
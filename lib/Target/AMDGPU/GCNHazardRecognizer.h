@@ -14,13 +14,17 @@
 #define LLVM_LIB_TARGET_AMDGPUHAZARDRECOGNIZERS_H
 
 #include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/CodeGen/ScheduleHazardRecognizer.h"
 #include "llvm/CodeGen/TargetSchedule.h"
 #include <list>
 
 namespace llvm {
 
+class MachineBasicBlock;
 class MachineFunction;
 class MachineInstr;
 class MachineOperand;
@@ -62,6 +66,32 @@ private:
 
   void addClauseInst(const MachineInstr &MI);
 
+  /// A def of a register unit by an instruction of the current block.
+  struct TrackedDef {
+    MachineInstr *MI;
+    /// Wait states from the start of the block to the end of MI.
+    int End;
+  };
+
+  /// In hazard recognizer mode the instructions of the current block before
+  /// CurrCycleInstr are added to a table of recent defs once, so that the
+  /// wait states since a def can be looked up instead of walking back over
+  /// the block for every query.
+  const MachineBasicBlock *TrackedMBB = nullptr;
+  MachineInstr *LastTracked = nullptr;
+  /// Wait states from the start of the block to the end of LastTracked.
+  int TrackedWaitStates = 0;
+  /// Recent defs by register unit, oldest first.
+  DenseMap<unsigned, SmallVector<TrackedDef, 4>> RecentDefs;
+  /// Recent instructions with a register mask operand, oldest first.
+  SmallVector<TrackedDef, 4> RecentRegMaskDefs;
+
+  void trackDef(MachineInstr &MI);
+  void trackDefsBefore(MachineInstr *MI);
+  Optional<int> getTrackedWaitStatesSinceDef(unsigned Reg,
+                                             IsHazardFn IsHazardDef,
+                                             int Limit);
+
   // Advance over a MachineInstr bundle. Look for hazards in the bundled
   // instructions.
   void processBundle();
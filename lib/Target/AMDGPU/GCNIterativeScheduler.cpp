@@ -14,12 +14,14 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/LiveIntervals.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/RegisterPressure.h"
 #include "llvm/CodeGen/ScheduleDAG.h"
 #include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
@@ -35,6 +37,19 @@ using namespace llvm;
 
 #define DEBUG_TYPE "machine-scheduler"
 
+static cl::opt<unsigned> SearchBudget(
+    "amdgpu-sched-search-budget", cl::Hidden, cl::init(50000),
+    cl::desc("Number of instructions the best-of scheduler may schedule "
+             "with alternative strategies per function"));
+
+STATISTIC(NumSearchedRegions, "Number of regions scheduled by strategy search");
+STATISTIC(NumOverBudgetRegions,
+          "Number of regions scheduled without search due to the budget");
+STATISTIC(NumLegacyRegions, "Number of regions keeping the legacy schedule");
+STATISTIC(NumOriginalRegions, "Number of regions keeping the original order");
+STATISTIC(NumILPRegions, "Number of regions using the ILP schedule");
+STATISTIC(NumMinRegRegions, "Number of regions using the minreg schedule");
+
 namespace llvm {
 
 std::vector<const SUnit *> makeMinRegSchedule(ArrayRef<const SUnit *> TopRoots,
@@ -328,6 +343,7 @@ void GCNIterativeScheduler::finalizeSchedule() { // overriden
   case SCHEDULE_MINREGFORCED: scheduleMinReg(true); break;
   case SCHEDULE_LEGACYMAXOCCUPANCY: scheduleLegacyMaxOccupancy(); break;
   case SCHEDULE_ILP: scheduleILP(false); break;
+  case SCHEDULE_BESTOF: scheduleBestOfStrategies(); break;
   }
 }
 
@@ -612,3 +628,123 @@ void GCNIterativeScheduler::scheduleILP(
   }
   MFI->limitOccupancy(FinalOccupancy);
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Best of strategies
+
+// Estimates the number of cycles a schedule of the current DAG takes when one
+// instruction issues per cycle and each waits for the latency of its
+// dependencies, as given by the scheduling model.
+unsigned GCNIterativeScheduler::estimateLatency(ScheduleRef Schedule) const {
+  std::vector<unsigned> IssueCycle(SUnits.size(), 0);
+  unsigned Cycle = 0;
+  unsigned Length = 0;
+  for (const SUnit *SU : Schedule) {
+    unsigned Issue = Cycle;
+    for (const SDep &Pred : SU->Preds) {
+      const SUnit *PredSU = Pred.getSUnit();
+      if (PredSU->isBoundaryNode())
+        continue;
+      Issue = std::max(Issue, IssueCycle[PredSU->NodeNum] + Pred.getLatency());
+    }
+    IssueCycle[SU->NodeNum] = Issue;
+    Cycle = Issue + 1;
+    Length = std::max(Length, Issue + SU->Latency);
+  }
+  return Length;
+}
+
+// Tries the original order, the ILP and the minreg schedules and the legacy
+// max occupancy strategy on every region, and keeps the schedule with the
+// best occupancy and estimated latency. Once the search budget is spent, the
+// remaining regions only use the legacy strategy.
+void GCNIterativeScheduler::scheduleBestOfStrategies() {
+  const auto &ST = MF.getSubtarget<GCNSubtarget>();
+  SIMachineFunctionInfo *MFI = MF.getInfo<SIMachineFunctionInfo>();
+  const auto TgtOcc = MFI->getMinAllowedOccupancy();
+  sortRegionsByPressure(TgtOcc);
+
+  GCNMaxOccupancySchedStrategy LStrgy(Context);
+  unsigned FinalOccupancy = MFI->getOccupancy();
+  unsigned Spent = 0;
+  for (auto R : Regions) {
+    std::unique_ptr<TentativeSchedule> Best;
+    ScheduleScore BestScore;
+    StringRef BestName;
+    auto consider = [&](ScheduleRef Schedule, const GCNRegPressure &RP,
+                        StringRef Name) {
+      ScheduleScore Score{RP.getOccupancy(ST), estimateLatency(Schedule)};
+      LLVM_DEBUG(dbgs() << Name << ": occupancy " << Score.Occupancy
+                        << ", latency " << Score.Latency << '\n');
+      if (Best && !Score.isBetterThan(BestScore, TgtOcc))
+        return;
+      Best.reset(new TentativeSchedule{detachSchedule(Schedule), RP});
+      BestScore = Score;
+      BestName = Name;
+    };
+
+    // The ILP and minreg schedulers modify the SUnits, so every candidate
+    // gets a DAG of its own.
+    const unsigned Cost = 2 * R->NumRegionInstrs;
+    if (Spent + Cost <= SearchBudget) {
+      Spent += Cost;
+      ++NumSearchedRegions;
+      LLVM_DEBUG(dbgs() << "\nSearching schedules for ";
+                 printRegion(dbgs(), R->Begin, R->End, LIS, 2));
+      {
+        BuildDAG DAG(*R, *this);
+        std::vector<const SUnit *> Original;
+        Original.reserve(SUnits.size());
+        for (const SUnit &SU : SUnits)
+          Original.push_back(&SU);
+        consider(Original, R->MaxPressure, "original");
+      }
+      {
+        BuildDAG DAG(*R, *this);
+        const auto ILPSchedule =
+            makeGCNILPScheduler(DAG.getBottomRoots(), *this);
+        consider(ILPSchedule, getSchedulePressure(*R, ILPSchedule), "ilp");
+      }
+      {
+        BuildDAG DAG(*R, *this);
+        const auto MinSchedule = makeMinRegSchedule(DAG.getTopRoots(), *this);
+        consider(MinSchedule, getSchedulePressure(*R, MinSchedule), "minreg");
+      }
+    } else {
+      ++NumOverBudgetRegions;
+    }
+
+    // The legacy strategy schedules in place, so it goes last and is undone
+    // if another schedule is better. It wins ties, being the default.
+    OverrideLegacyStrategy Ovr(*R, LStrgy, *this);
+    Ovr.schedule();
+    const auto RP = getRegionPressure(*R);
+    std::vector<const SUnit *> LegacySchedule;
+    for (MachineInstr &MI : make_range(R->Begin, R->End))
+      if (SUnit *SU = getSUnit(&MI))
+        LegacySchedule.push_back(SU);
+    ScheduleScore LegacyScore{RP.getOccupancy(ST),
+                              estimateLatency(LegacySchedule)};
+    LLVM_DEBUG(dbgs() << "legacy: occupancy " << LegacyScore.Occupancy
+                      << ", latency " << LegacyScore.Latency << '\n');
+
+    if (!Best || !BestScore.isBetterThan(LegacyScore, TgtOcc)) {
+      ++NumLegacyRegions;
+      R->MaxPressure = RP;
+      FinalOccupancy = std::min(FinalOccupancy, LegacyScore.Occupancy);
+      continue;
+    }
+
+    LLVM_DEBUG(dbgs() << "Using the " << BestName << " schedule\n");
+    if (BestName == "original")
+      ++NumOriginalRegions;
+    else if (BestName == "ilp")
+      ++NumILPRegions;
+    else
+      ++NumMinRegRegions;
+    Ovr.restoreOrder();
+    scheduleRegion(*R, Best->Schedule, Best->MaxPressure);
+    FinalOccupancy = std::min(FinalOccupancy, BestScore.Occupancy);
+  }
+  MFI->limitOccupancy(FinalOccupancy);
+}
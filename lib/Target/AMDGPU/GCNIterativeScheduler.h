@@ -14,6 +14,7 @@
 #include "llvm/CodeGen/MachineBasicBlock.h"
 #include "llvm/CodeGen/MachineScheduler.h"
 #include "llvm/Support/Allocator.h"
+#include <algorithm>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -32,7 +33,8 @@ public:
     SCHEDULE_MINREGONLY,
     SCHEDULE_MINREGFORCED,
     SCHEDULE_LEGACYMAXOCCUPANCY,
-    SCHEDULE_ILP
+    SCHEDULE_ILP,
+    SCHEDULE_BESTOF
   };
 
   GCNIterativeScheduler(MachineSchedContext *C,
@@ -55,6 +57,23 @@ protected:
     GCNRegPressure MaxPressure;
   };
 
+  // Quality of a region schedule, used to pick between strategies.
+  struct ScheduleScore {
+    unsigned Occupancy = 0;
+    unsigned Latency = 0;
+
+    // Occupancy up to the target comes first, then estimated latency.
+    bool isBetterThan(const ScheduleScore &O, unsigned TargetOcc) const {
+      unsigned Occ = std::min(Occupancy, TargetOcc);
+      unsigned OOcc = std::min(O.Occupancy, TargetOcc);
+      if (Occ != OOcc)
+        return Occ > OOcc;
+      if (Latency != O.Latency)
+        return Latency < O.Latency;
+      return Occupancy > O.Occupancy;
+    }
+  };
+
   struct Region {
     // Fields except for BestSchedule are supposed to reflect current IR state
     // `const` fields are to emphasize they shouldn't change for any schedule.
@@ -109,6 +128,9 @@ protected:
   void scheduleLegacyMaxOccupancy(bool TryMaximizeOccupancy = true);
   void scheduleMinReg(bool force = false);
   void scheduleILP(bool TryMaximizeOccupancy = true);
+  void scheduleBestOfStrategies();
+
+  unsigned estimateLatency(ScheduleRef Schedule) const;
 
   void printRegions(raw_ostream &OS) const;
   void printSchedResult(raw_ostream &OS,
@@ -0,0 +1,330 @@
+//===-- GCNPreRARematerialize.cpp - Rematerialize defs for occupancy ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// \brief Try to reach the next occupancy threshold before register allocation
+/// by moving trivially rematerializable defs right before their uses.
+///
+/// The instructions where register pressure limits occupancy are found with
+/// GCNRPTracker. A def of an immediate which is live across such a point but
+/// only used further down in a single block is moved to its first use, so it
+/// no longer counts at the point. The defs are only moved if this brings all
+/// the limiting points under the next occupancy threshold.
+///
+//===----------------------------------------------------------------------===//
+
+#include "AMDGPU.h"
+#include "AMDGPUSubtarget.h"
+#include "GCNRegPressure.h"
+#include "SIInstrInfo.h"
+#include "SIMachineFunctionInfo.h"
+#include "SIRegisterInfo.h"
+#include "MCTargetDesc/AMDGPUMCTargetDesc.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/LiveIntervals.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "amdgpu-pre-ra-remat"
+
+STATISTIC(NumRematerialized, "Number of defs moved to their uses");
+STATISTIC(NumOccupancyIncreased,
+          "Number of functions with occupancy increased by rematerialization");
+
+namespace {
+
+class GCNPreRARematerialize : public MachineFunctionPass {
+public:
+  static char ID;
+
+  GCNPreRARematerialize() : MachineFunctionPass(ID) {
+    initializeGCNPreRARematerializePass(*PassRegistry::getPassRegistry());
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  StringRef getPassName() const override {
+    return "GCN Pre-RA Rematerialize";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<LiveIntervals>();
+    AU.addPreserved<LiveIntervals>();
+    AU.addPreserved<SlotIndexes>();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addPreserved<MachineLoopInfo>();
+    AU.addRequired<MachineOptimizationRemarkEmitterPass>();
+    AU.setPreservesCFG();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  // A def which can be moved right before the first of its uses, all of which
+  // are in the same block.
+  struct Candidate {
+    MachineInstr *Def;
+    MachineInstr *FirstUse;
+    MachineInstr *LastUse;
+  };
+
+  bool isRematerializable(const MachineInstr &MI) const;
+  bool collectCandidate(unsigned Reg);
+  bool isLiveAfterMove(const Candidate &C, const MachineInstr &MI) const;
+  unsigned getMaxPressureOccupancy(const MachineFunction &MF) const;
+  bool selectDefsToMove(const MachineFunction &MF, unsigned TargetOccupancy);
+  void moveDef(unsigned Reg, Candidate &C);
+
+  const GCNSubtarget *ST;
+  const SIInstrInfo *TII;
+  const SIRegisterInfo *TRI;
+  MachineRegisterInfo *MRI;
+  LiveIntervals *LIS;
+  MachineLoopInfo *MLI;
+
+  MapVector<unsigned, Candidate> Candidates;
+  SetVector<unsigned> DefsToMove;
+};
+
+} // End anonymous namespace.
+
+INITIALIZE_PASS_BEGIN(GCNPreRARematerialize, DEBUG_TYPE,
+                      "GCN Pre-RA Rematerialize", false, false)
+INITIALIZE_PASS_DEPENDENCY(LiveIntervals)
+INITIALIZE_PASS_DEPENDENCY(MachineLoopInfo)
+INITIALIZE_PASS_DEPENDENCY(MachineOptimizationRemarkEmitterPass)
+INITIALIZE_PASS_END(GCNPreRARematerialize, DEBUG_TYPE,
+                    "GCN Pre-RA Rematerialize", false, false)
+
+char GCNPreRARematerialize::ID = 0;
+
+char &llvm::GCNPreRARematerializeID = GCNPreRARematerialize::ID;
+
+FunctionPass *llvm::createGCNPreRARematerializePass() {
+  return new GCNPreRARematerialize();
+}
+
+// Moves of immediates read exec only to select the lanes they write, so they
+// can be moved as long as exec is the same at the new place and at the uses.
+bool GCNPreRARematerialize::isRematerializable(const MachineInstr &MI) const {
+  if (MI.getNumExplicitDefs() != 1 || MI.getOperand(0).getSubReg())
+    return false;
+
+  switch (MI.getOpcode()) {
+  case AMDGPU::V_MOV_B32_e32:
+  case AMDGPU::V_MOV_B32_e64:
+  case AMDGPU::V_MOV_B64_PSEUDO:
+    break;
+  default:
+    if (!TII->isTriviallyReMaterializable(MI))
+      return false;
+    break;
+  }
+
+  for (const MachineOperand &MO : MI.operands()) {
+    if (MO.isReg() && MO.isUse() && MO.getReg() != AMDGPU::EXEC)
+      return false;
+    if (MO.isReg() && MO.isDef() && &MO != &MI.getOperand(0))
+      return false;
+  }
+  return true;
+}
+
+// Record Reg as a candidate if its only def can be moved to its uses.
+bool GCNPreRARematerialize::collectCandidate(unsigned Reg) {
+  if (!MRI->hasOneDef(Reg) || MRI->use_nodbg_empty(Reg))
+    return false;
+
+  MachineInstr *Def = MRI->getVRegDef(Reg);
+  if (!isRematerializable(*Def))
+    return false;
+
+  MachineBasicBlock *UseMBB = nullptr;
+  MachineInstr *FirstUse = nullptr, *LastUse = nullptr;
+  for (MachineInstr &UseMI : MRI->use_nodbg_instructions(Reg)) {
+    if (UseMBB && UseMI.getParent() != UseMBB)
+      return false;
+    UseMBB = UseMI.getParent();
+    SlotIndex Idx = LIS->getInstructionIndex(UseMI);
+    if (!FirstUse || Idx < LIS->getInstructionIndex(*FirstUse))
+      FirstUse = &UseMI;
+    if (!LastUse || Idx > LIS->getInstructionIndex(*LastUse))
+      LastUse = &UseMI;
+  }
+
+  // Do not move the def into a loop.
+  if (MLI->getLoopDepth(UseMBB) > MLI->getLoopDepth(Def->getParent()))
+    return false;
+
+  // The def is already where it would be moved.
+  if (Def->getParent() == UseMBB &&
+      std::next(Def->getIterator()) == FirstUse->getIterator())
+    return false;
+
+  // All lanes read by the uses must be written by the moved def.
+  if (Def->readsRegister(AMDGPU::EXEC, TRI)) {
+    for (auto I = FirstUse->getIterator(), E = LastUse->getIterator(); I != E;
+         ++I)
+      if (I->modifiesRegister(AMDGPU::EXEC, TRI))
+        return false;
+  }
+
+  Candidates[Reg] = {Def, FirstUse, LastUse};
+  return true;
+}
+
+// Returns whether the register of C would still be live at MI after moving its
+// def to the first use.
+bool GCNPreRARematerialize::isLiveAfterMove(const Candidate &C,
+                                            const MachineInstr &MI) const {
+  if (MI.getParent() != C.FirstUse->getParent())
+    return false;
+  SlotIndex Idx = LIS->getInstructionIndex(MI);
+  return LIS->getInstructionIndex(*C.FirstUse) <= Idx &&
+         Idx <= LIS->getInstructionIndex(*C.LastUse);
+}
+
+unsigned GCNPreRARematerialize::getMaxPressureOccupancy(
+    const MachineFunction &MF) const {
+  GCNRegPressure MaxPressure;
+  GCNDownwardRPTracker RPT(*LIS);
+  for (const MachineBasicBlock &MBB : MF) {
+    if (MBB.empty() || !RPT.reset(MBB.front()))
+      continue;
+    RPT.advance(MBB.end());
+    MaxPressure = max(MaxPressure, RPT.moveMaxPressure());
+  }
+  return MaxPressure.getOccupancy(*ST);
+}
+
+// Walk the instructions where pressure is too high for TargetOccupancy and
+// select the candidates that are live across them. Returns false if moving
+// the candidates is not enough to reach TargetOccupancy at all of them.
+bool GCNPreRARematerialize::selectDefsToMove(const MachineFunction &MF,
+                                             unsigned TargetOccupancy) {
+  GCNDownwardRPTracker RPT(*LIS);
+  for (const MachineBasicBlock &MBB : MF) {
+    if (MBB.empty() || !RPT.reset(MBB.front()))
+      continue;
+    while (RPT.advance()) {
+      GCNRegPressure Pressure = RPT.moveMaxPressure();
+      if (Pressure.getOccupancy(*ST) >= TargetOccupancy)
+        continue;
+
+      const MachineInstr &MI = *RPT.getLastTrackedMI();
+      for (const auto &LiveReg : RPT.getLiveRegs()) {
+        auto C = Candidates.find(LiveReg.first);
+        if (C == Candidates.end() || isLiveAfterMove(C->second, MI))
+          continue;
+        Pressure.inc(LiveReg.first, LiveReg.second, LaneBitmask::getNone(),
+                     *MRI);
+        DefsToMove.insert(LiveReg.first);
+      }
+
+      if (Pressure.getOccupancy(*ST) < TargetOccupancy) {
+        LLVM_DEBUG(dbgs() << "Cannot reach occupancy " << TargetOccupancy
+                          << " at " << MI);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void GCNPreRARematerialize::moveDef(unsigned Reg, Candidate &C) {
+  MachineBasicBlock &MBB = *C.FirstUse->getParent();
+  LLVM_DEBUG(dbgs() << "Moving " << *C.Def << "  to " << printMBBReference(MBB)
+                    << " before " << *C.FirstUse);
+
+  TII->reMaterialize(MBB, C.FirstUse->getIterator(), Reg, 0, *C.Def, *TRI);
+  MachineInstr &NewMI = *std::prev(C.FirstUse->getIterator());
+  LIS->RemoveMachineInstrFromMaps(*C.Def);
+  C.Def->eraseFromParent();
+  LIS->InsertMachineInstrInMaps(NewMI);
+
+  // Debug uses in other blocks would refer to an undefined value.
+  for (auto I = MRI->reg_begin(Reg), E = MRI->reg_end(); I != E;) {
+    MachineOperand &MO = *I++;
+    if (MO.isDebug() && MO.getParent()->getParent() != &MBB)
+      MO.setReg(0);
+  }
+
+  LIS->removeInterval(Reg);
+  LIS->createAndComputeVirtRegInterval(Reg);
+  ++NumRematerialized;
+}
+
+bool GCNPreRARematerialize::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(MF.getFunction()))
+    return false;
+
+  ST = &MF.getSubtarget<GCNSubtarget>();
+  TII = ST->getInstrInfo();
+  TRI = ST->getRegisterInfo();
+  MRI = &MF.getRegInfo();
+  LIS = &getAnalysis<LiveIntervals>();
+  MLI = &getAnalysis<MachineLoopInfo>();
+  SIMachineFunctionInfo *MFI = MF.getInfo<SIMachineFunctionInfo>();
+  auto &ORE = getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
+
+  unsigned MaxOccupancy = std::min(MFI->getMaxWavesPerEU(),
+                                   ST->getOccupancyWithLocalMemSize(MF));
+  unsigned Occupancy = getMaxPressureOccupancy(MF);
+  if (Occupancy >= MaxOccupancy)
+    return false;
+
+  unsigned TargetOccupancy = Occupancy + 1;
+  LLVM_DEBUG(dbgs() << "Trying to increase occupancy of " << MF.getName()
+                    << " from " << Occupancy << " to " << TargetOccupancy
+                    << '\n');
+
+  Candidates.clear();
+  DefsToMove.clear();
+  for (unsigned I = 0, E = MRI->getNumVirtRegs(); I != E; ++I) {
+    unsigned Reg = Register::index2VirtReg(I);
+    if (LIS->hasInterval(Reg))
+      collectCandidate(Reg);
+  }
+
+  if (Candidates.empty() || !selectDefsToMove(MF, TargetOccupancy) ||
+      DefsToMove.empty()) {
+    ORE.emit([&]() {
+      return MachineOptimizationRemarkMissed(DEBUG_TYPE, "OccupancyNotIncreased",
+                                             MF.getFunction().getSubprogram(),
+                                             &MF.front())
+             << "cannot rematerialize enough defs to increase occupancy from "
+             << ore::NV("Occupancy", Occupancy);
+    });
+    return false;
+  }
+
+  for (unsigned Reg : DefsToMove)
+    moveDef(Reg, Candidates[Reg]);
+
+  unsigned NewOccupancy = std::min(getMaxPressureOccupancy(MF), MaxOccupancy);
+  LLVM_DEBUG(dbgs() << "Occupancy is " << NewOccupancy << " after moving "
+                    << DefsToMove.size() << " defs\n");
+  if (NewOccupancy > Occupancy) {
+    MFI->increaseOccupancy(MF, NewOccupancy);
+    ++NumOccupancyIncreased;
+    ORE.emit([&]() {
+      return MachineOptimizationRemark(DEBUG_TYPE, "Rematerialized",
+                                       MF.getFunction().getSubprogram(),
+                                       &MF.front())
+             << "rematerialized " << ore::NV("NumDefs", DefsToMove.size())
+             << " defs to increase occupancy from "
+             << ore::NV("OldOccupancy", Occupancy) << " to "
+             << ore::NV("NewOccupancy", NewOccupancy);
+    });
+  }
+  return true;
+}
@@ -35,6 +35,8 @@
 #include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
@@ -44,6 +46,7 @@
 #include "llvm/CodeGen/MachineOperand.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/IR/DebugLoc.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/DebugCounter.h"
@@ -73,6 +76,17 @@ static cl::opt<bool> ForceEmitZeroFlag(
   cl::desc("Force all waitcnt instrs to be emitted as s_waitcnt vmcnt(0) expcnt(0) lgkmcnt(0)"),
   cl::init(false), cl::Hidden);
 
+static cl::opt<bool> WaitcntStats(
+  "amdgpu-waitcnt-stats",
+  cl::desc("Emit a remark per function with the waits inserted"),
+  cl::init(false), cl::Hidden);
+
+STATISTIC(NumCounterWaits, "Number of counter waits inserted");
+STATISTIC(NumPartialWaits, "Number of counter waits with a nonzero count");
+STATISTIC(NumRelaxedWaits,
+          "Number of nonzero counter waits that a pending flat operation "
+          "would have forced to zero if it could access LDS");
+
 namespace {
 
 template <typename EnumT>
@@ -183,6 +197,21 @@ void addWait(AMDGPU::Waitcnt &Wait, InstCounterType T, unsigned Count) {
   }
 }
 
+unsigned getWait(const AMDGPU::Waitcnt &Wait, InstCounterType T) {
+  switch (T) {
+  case VM_CNT:
+    return Wait.VmCnt;
+  case EXP_CNT:
+    return Wait.ExpCnt;
+  case LGKM_CNT:
+    return Wait.LgkmCnt;
+  case VS_CNT:
+    return Wait.VsCnt;
+  default:
+    llvm_unreachable("bad InstCounterType");
+  }
+}
+
 // This objects maintains the current score brackets of each wait counter, and
 // a per-register scoreboard for each wait counter.
 //
@@ -296,6 +325,15 @@ public:
     LastFlat[LGKM_CNT] = ScoreUBs[LGKM_CNT];
   }
 
+  // A flat operation that cannot access LDS, only because the function has
+  // none, is only tracked to count the waits this relaxes.
+  bool hasPendingFlatWithoutLDS() const {
+    return LastFlatWithoutLDS > ScoreLBs[VM_CNT] &&
+           LastFlatWithoutLDS <= ScoreUBs[VM_CNT];
+  }
+
+  void setPendingFlatWithoutLDS() { LastFlatWithoutLDS = ScoreUBs[VM_CNT]; }
+
   void print(raw_ostream &);
   void dump() { print(dbgs()); }
 
@@ -354,6 +392,8 @@ private:
   bool MixedPendingEvents[NUM_INST_CNTS] = {false};
   // Remember the last flat memory operation.
   uint32_t LastFlat[NUM_INST_CNTS] = {0};
+  // VM_CNT score of the last flat memory operation without LDS.
+  uint32_t LastFlatWithoutLDS = 0;
   // wait_cnt scores for every vgpr.
   // Keep track of the VgprUB and SgprUB to make merge at join efficient.
   int32_t VgprUB = 0;
@@ -374,9 +414,17 @@ private:
   DenseSet<MachineInstr *> TrackedWaitcntSet;
   DenseSet<MachineInstr *> VCCZBugHandledSet;
 
+  // Counter waits required in a block, as of its latest visit.
+  struct WaitStats {
+    unsigned CounterWaits = 0;
+    unsigned PartialWaits = 0;
+    unsigned RelaxedWaits = 0;
+  };
+
   struct BlockInfo {
     MachineBasicBlock *MBB;
     std::unique_ptr<WaitcntBrackets> Incoming;
+    WaitStats Stats;
     bool Dirty = true;
 
     explicit BlockInfo(MachineBasicBlock *MBB) : MBB(MBB) {}
@@ -390,6 +438,9 @@ private:
   bool ForceEmitZeroWaitcnts;
   bool ForceEmitWaitcnt[NUM_INST_CNTS];
 
+  // Whether flat memory operations of the function may access LDS at all.
+  bool FlatMayAccessLDS;
+
 public:
   static char ID;
 
@@ -447,11 +498,13 @@ public:
   bool mayAccessLDSThroughFlat(const MachineInstr &MI) const;
   bool generateWaitcntInstBefore(MachineInstr &MI,
                                  WaitcntBrackets &ScoreBrackets,
-                                 MachineInstr *OldWaitcntInstr);
+                                 MachineInstr *OldWaitcntInstr,
+                                 WaitStats &Stats);
   void updateEventWaitcntAfter(MachineInstr &Inst,
                                WaitcntBrackets *ScoreBrackets);
   bool insertWaitcntInBlock(MachineFunction &MF, MachineBasicBlock &Block,
-                            WaitcntBrackets &ScoreBrackets);
+                            WaitcntBrackets &ScoreBrackets, WaitStats &Stats);
+  void emitWaitcntStats(MachineFunction &MF);
 };
 
 } // end anonymous namespace
@@ -834,7 +887,7 @@ static bool callWaitsOnFunctionReturn(const MachineInstr &MI) {
 ///  scores (*_score_LB and *_score_ub respectively).
 bool SIInsertWaitcnts::generateWaitcntInstBefore(
     MachineInstr &MI, WaitcntBrackets &ScoreBrackets,
-    MachineInstr *OldWaitcntInstr) {
+    MachineInstr *OldWaitcntInstr, WaitStats &Stats) {
   setForceEmitWaitcnt();
   bool IsForceEmitWaitcnt = isForceEmitWaitcnt();
 
@@ -1072,6 +1125,20 @@ bool SIInsertWaitcnts::generateWaitcntInstBefore(
     return Modified;
   }
 
+  for (auto T : inst_counter_types()) {
+    unsigned Count = getWait(Wait, T);
+    if (Count == ~0u)
+      continue;
+    ++Stats.CounterWaits;
+    if (Count != 0) {
+      ++Stats.PartialWaits;
+      if ((T == VM_CNT || T == LGKM_CNT) &&
+          ScoreBrackets.hasPendingFlatWithoutLDS() &&
+          !ST->hasFlatLgkmVMemCountInOrder())
+        ++Stats.RelaxedWaits;
+    }
+  }
+
   if (ForceEmitZeroWaitcnts)
     Wait = AMDGPU::Waitcnt::allZero(IV);
 
@@ -1165,6 +1232,46 @@ bool SIInsertWaitcnts::generateWaitcntInstBefore(
   return Modified;
 }
 
+// Returns whether a flat address in \p MF may point to LDS. A kernel can only
+// reach the LDS it allocates, either statically or through an LDS pointer
+// argument, so without any and without calls that could be passed such a
+// pointer, its flat addresses can only point to memory.
+static bool flatMayAccessLDS(const MachineFunction &MF) {
+  const Function &F = MF.getFunction();
+  if (!AMDGPU::isKernel(F.getCallingConv()) || MF.getFrameInfo().hasCalls() ||
+      MF.getInfo<SIMachineFunctionInfo>()->getLDSSize() != 0)
+    return true;
+
+  auto IsLDSPointer = [](const Value *V) {
+    Type *Ty = V->getType()->getScalarType();
+    return Ty->isPointerTy() &&
+           Ty->getPointerAddressSpace() == AMDGPUAS::LOCAL_ADDRESS;
+  };
+  for (const Argument &Arg : F.args())
+    if (IsLDSPointer(&Arg))
+      return true;
+
+  // Look for LDS pointers anywhere in the body, including LDS variables that
+  // are only referenced in constant expressions, e.g. casts to flat.
+  SmallVector<const Value *, 16> Worklist;
+  SmallPtrSet<const Constant *, 16> Visited;
+  for (const Instruction &I : instructions(F)) {
+    if (isa<CallBase>(I) && !isa<IntrinsicInst>(I))
+      return true;
+    Worklist.push_back(&I);
+    Worklist.append(I.op_begin(), I.op_end());
+    while (!Worklist.empty()) {
+      const Value *V = Worklist.pop_back_val();
+      if (IsLDSPointer(V))
+        return true;
+      if (const Constant *C = dyn_cast<Constant>(V))
+        if (!isa<GlobalValue>(C) && Visited.insert(C).second)
+          Worklist.append(C->op_begin(), C->op_end());
+    }
+  }
+  return false;
+}
+
 // This is a flat memory operation. Check to see if it has memory
 // tokens for both LDS and Memory, and if so mark it as a flat.
 bool SIInsertWaitcnts::mayAccessLDSThroughFlat(const MachineInstr &MI) const {
@@ -1212,9 +1319,14 @@ void SIInsertWaitcnts::updateEventWaitcntAfter(MachineInstr &Inst,
 
       // This is a flat memory operation, so note it - it will require
       // that both the VM and LGKM be flushed to zero if it is pending when
-      // a VM or LGKM dependency occurs.
-      if (mayAccessLDSThroughFlat(Inst))
-        ScoreBrackets->setPendingFlat();
+      // a VM or LGKM dependency occurs. Without LDS in the function, it can
+      // only access memory, and completes in order like a global operation.
+      if (mayAccessLDSThroughFlat(Inst)) {
+        if (FlatMayAccessLDS)
+          ScoreBrackets->setPendingFlat();
+        else
+          ScoreBrackets->setPendingFlatWithoutLDS();
+      }
     }
   } else if (SIInstrInfo::isVMEM(Inst) &&
              // TODO: get a better carve out.
@@ -1319,6 +1431,9 @@ bool WaitcntBrackets::merge(const WaitcntBrackets &Other) {
     ScoreLBs[T] = std::min(M.OldLB + M.MyShift, M.OtherLB + M.OtherShift);
 
     StrictDom |= mergeScore(M, LastFlat[T], Other.LastFlat[T]);
+    if (T == VM_CNT)
+      StrictDom |=
+          mergeScore(M, LastFlatWithoutLDS, Other.LastFlatWithoutLDS);
 
     bool RegStrictDom = false;
     for (int J = 0, E = std::max(getMaxVGPR(), Other.getMaxVGPR()) + 1; J != E;
@@ -1346,8 +1461,10 @@ bool WaitcntBrackets::merge(const WaitcntBrackets &Other) {
 // Generate s_waitcnt instructions where needed.
 bool SIInsertWaitcnts::insertWaitcntInBlock(MachineFunction &MF,
                                             MachineBasicBlock &Block,
-                                            WaitcntBrackets &ScoreBrackets) {
+                                            WaitcntBrackets &ScoreBrackets,
+                                            WaitStats &Stats) {
   bool Modified = false;
+  Stats = WaitStats();
 
   LLVM_DEBUG({
     dbgs() << "*** Block" << Block.getNumber() << " ***";
@@ -1386,7 +1503,8 @@ bool SIInsertWaitcnts::insertWaitcntInBlock(MachineFunction &MF,
 
     // Generate an s_waitcnt instruction to be placed before
     // cur_Inst, if needed.
-    Modified |= generateWaitcntInstBefore(Inst, ScoreBrackets, OldWaitcntInstr);
+    Modified |= generateWaitcntInstBefore(Inst, ScoreBrackets, OldWaitcntInstr,
+                                          Stats);
     OldWaitcntInstr = nullptr;
 
     updateEventWaitcntAfter(Inst, &ScoreBrackets);
@@ -1427,6 +1545,33 @@ bool SIInsertWaitcnts::insertWaitcntInBlock(MachineFunction &MF,
   return Modified;
 }
 
+// Record the waits required once the fix point is reached, and report them if
+// requested.
+void SIInsertWaitcnts::emitWaitcntStats(MachineFunction &MF) {
+  WaitStats Total;
+  for (const BlockInfo &BI : BlockInfos) {
+    Total.CounterWaits += BI.Stats.CounterWaits;
+    Total.PartialWaits += BI.Stats.PartialWaits;
+    Total.RelaxedWaits += BI.Stats.RelaxedWaits;
+  }
+  NumCounterWaits += Total.CounterWaits;
+  NumPartialWaits += Total.PartialWaits;
+  NumRelaxedWaits += Total.RelaxedWaits;
+
+  if (!WaitcntStats)
+    return;
+
+  const Function &F = MF.getFunction();
+  OptimizationRemarkAnalysis R(OptimizationRemarkAnalysis::AlwaysPrint,
+                               "WaitcntStats", F.getSubprogram(),
+                               &F.getEntryBlock());
+  R << ore::NV("CounterWaits", Total.CounterWaits) << " counter waits, "
+    << ore::NV("PartialWaits", Total.PartialWaits) << " with a nonzero count, "
+    << ore::NV("RelaxedWaits", Total.RelaxedWaits)
+    << " relaxed from zero because flat operations cannot access LDS";
+  F.getContext().diagnose(R);
+}
+
 bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
   ST = &MF.getSubtarget<GCNSubtarget>();
   TII = ST->getInstrInfo();
@@ -1439,6 +1584,8 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
   for (auto T : inst_counter_types())
     ForceEmitWaitcnt[T] = false;
 
+  FlatMayAccessLDS = flatMayAccessLDS(MF);
+
   HardwareLimits.VmcntMax = AMDGPU::getVmcntBitMask(IV);
   HardwareLimits.ExpcntMax = AMDGPU::getExpcntBitMask(IV);
   HardwareLimits.LgkmcntMax = AMDGPU::getLgkmcntBitMask(IV);
@@ -1493,7 +1640,7 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
           Brackets->clear();
       }
 
-      Modified |= insertWaitcntInBlock(MF, *BI.MBB, *Brackets);
+      Modified |= insertWaitcntInBlock(MF, *BI.MBB, *Brackets, BI.Stats);
       BI.Dirty = false;
 
       if (Brackets->hasPending()) {
@@ -1522,6 +1669,8 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
     }
   } while (Repeat);
 
+  emitWaitcntStats(MF);
+
   SmallVector<MachineBasicBlock *, 4> EndPgmBlocks;
 
   bool HaveScalarStores = false;
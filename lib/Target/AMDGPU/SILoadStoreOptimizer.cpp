@@ -40,6 +40,13 @@
 //  global_load_dwordx2 v[5:6], v[5:6], off
 //  global_load_dwordx2 v[0:1], v[5:6], off offset:2048
 //
+// Optionally, instructions that could be merged with an instruction in a
+// dominating block are first hoisted into that block, if the two blocks are
+// control equivalent and every path between them is free of conflicting
+// memory accesses and EXEC changes. This catches accesses that only ended up
+// in different blocks because of uniform branches in between, e.g. guards
+// left behind by unrolling.
+//
 // Future improvements:
 //
 // - This currently relies on the scheduler to place loads and stores next to
@@ -67,15 +74,20 @@
 #include "SIRegisterInfo.h"
 #include "Utils/AMDGPUBaseInfo.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
 #include "llvm/CodeGen/MachineOperand.h"
+#include "llvm/CodeGen/MachinePostDominators.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/Pass.h"
@@ -92,6 +104,22 @@ using namespace llvm;
 
 #define DEBUG_TYPE "si-load-store-opt"
 
+STATISTIC(NumMergedPairs, "Number of memory instruction pairs merged");
+STATISTIC(NumHoisted,
+          "Number of memory instructions hoisted into a dominating block");
+
+static cl::opt<bool> EnableCrossBlockMerge(
+    "amdgpu-load-store-opt-cross-block",
+    cl::desc("Hoist mergeable memory instructions from control equivalent "
+             "blocks into their dominator before merging"),
+    cl::init(false), cl::Hidden);
+
+static cl::opt<unsigned> CrossBlockRegionLimit(
+    "amdgpu-load-store-opt-region-limit",
+    cl::desc("Maximum number of blocks between two control equivalent blocks "
+             "for hoisting mergeable memory instructions"),
+    cl::init(16), cl::Hidden);
+
 namespace {
 enum InstClassEnum {
   UNKNOWN,
@@ -249,6 +277,14 @@ private:
                   std::list<std::list<CombineInfo> > &MergeableInsts) const;
   bool collectMergeableInsts(MachineBasicBlock &MBB,
                   std::list<std::list<CombineInfo> > &MergeableInsts) const;
+  bool getMergeableInfo(MachineInstr &MI, CombineInfo &CI) const;
+  /// Hoist instructions from the immediate post-dominator of \p MBB into
+  /// \p MBB, if they could be merged with an instruction in \p MBB. Returns
+  /// the number of hoisted instructions.
+  unsigned hoistFromPostDominator(
+      MachineBasicBlock &MBB, const DomTreeBase<MachineBasicBlock> &DT,
+      const PostDomTreeBase<MachineBasicBlock> &PDT,
+      const LoopInfoBase<MachineBasicBlock, MachineLoop> &LI);
 
 public:
   static char ID;
@@ -1573,18 +1609,8 @@ bool SILoadStoreOptimizer::collectMergeableInsts(MachineBasicBlock &MBB,
     if (promoteConstantOffsetToImm(MI, Visited, AnchorList))
       Modified = true;
 
-    const InstClassEnum InstClass = getInstClass(MI.getOpcode(), *TII);
-    if (InstClass == UNKNOWN)
-      continue;
-
-    // Don't combine if volatile.
-    if (MI.hasOrderedMemoryRef())
-      continue;
-
     CombineInfo CI;
-    CI.setMI(MI, *TII, *STM);
-
-    if (!CI.hasMergeableAddress(*MRI))
+    if (!getMergeableInfo(MI, CI))
       continue;
 
     addInstToMergeableList(CI, MergeableInsts);
@@ -1649,6 +1675,7 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
     case DS_READ:
       if (findMatchingInst(CI)) {
         Modified = true;
+        ++NumMergedPairs;
         removeCombinedInst(MergeList, *CI.Paired);
         MachineBasicBlock::iterator NewMI = mergeRead2Pair(CI);
         CI.setMI(NewMI, *TII, *STM);
@@ -1657,6 +1684,7 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
     case DS_WRITE:
       if (findMatchingInst(CI)) {
         Modified = true;
+        ++NumMergedPairs;
         removeCombinedInst(MergeList, *CI.Paired);
         MachineBasicBlock::iterator NewMI = mergeWrite2Pair(CI);
         CI.setMI(NewMI, *TII, *STM);
@@ -1665,6 +1693,7 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
     case S_BUFFER_LOAD_IMM:
       if (findMatchingInst(CI)) {
         Modified = true;
+        ++NumMergedPairs;
         removeCombinedInst(MergeList, *CI.Paired);
         MachineBasicBlock::iterator NewMI = mergeSBufferLoadImmPair(CI);
         CI.setMI(NewMI, *TII, *STM);
@@ -1677,6 +1706,7 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
     case BUFFER_LOAD_OFFSET_exact:
       if (findMatchingInst(CI)) {
         Modified = true;
+        ++NumMergedPairs;
         removeCombinedInst(MergeList, *CI.Paired);
         MachineBasicBlock::iterator NewMI = mergeBufferLoadPair(CI);
         CI.setMI(NewMI, *TII, *STM);
@@ -1689,6 +1719,7 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
     case BUFFER_STORE_OFFSET_exact:
       if (findMatchingInst(CI)) {
         Modified = true;
+        ++NumMergedPairs;
         removeCombinedInst(MergeList, *CI.Paired);
         MachineBasicBlock::iterator NewMI = mergeBufferStorePair(CI);
         CI.setMI(NewMI, *TII, *STM);
@@ -1705,6 +1736,160 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
   return Modified;
 }
 
+bool SILoadStoreOptimizer::getMergeableInfo(MachineInstr &MI,
+                                            CombineInfo &CI) const {
+  if (getInstClass(MI.getOpcode(), *TII) == UNKNOWN)
+    return false;
+
+  // Don't combine if volatile.
+  if (MI.hasOrderedMemoryRef())
+    return false;
+
+  CI.setMI(MI, *TII, *STM);
+  return CI.hasMergeableAddress(*MRI);
+}
+
+// Returns true if memory instructions cannot be moved across \p MI. Branches
+// are fine, since we only move instructions between control equivalent
+// blocks, but anything that changes EXEC changes which lanes would execute the
+// moved instruction.
+static bool isCodeMotionBarrier(const MachineInstr &MI,
+                                const SIRegisterInfo *TRI) {
+  if (MI.modifiesRegister(AMDGPU::EXEC, TRI))
+    return true;
+  return !MI.isBranch() && (MI.hasUnmodeledSideEffects() || MI.isCall());
+}
+
+unsigned SILoadStoreOptimizer::hoistFromPostDominator(
+    MachineBasicBlock &MBB, const DomTreeBase<MachineBasicBlock> &DT,
+    const PostDomTreeBase<MachineBasicBlock> &PDT,
+    const LoopInfoBase<MachineBasicBlock, MachineLoop> &LI) {
+  const MachineDomTreeNode *Node = PDT.getNode(&MBB);
+  if (!Node || !Node->getIDom())
+    return 0;
+
+  // The virtual root of the post-dominator tree has no block. Blocks in
+  // different loops are not executed the same number of times.
+  MachineBasicBlock *Succ = Node->getIDom()->getBlock();
+  if (!Succ || Succ == &MBB || !DT.dominates(&MBB, Succ) ||
+      LI.getLoopFor(&MBB) != LI.getLoopFor(Succ))
+    return 0;
+
+  // Instructions in MBB that hoisted instructions could be merged with.
+  SmallVector<CombineInfo, 8> Anchors;
+  for (MachineInstr &MI : MBB) {
+    CombineInfo CI;
+    if (getMergeableInfo(MI, CI))
+      Anchors.push_back(CI);
+  }
+  if (Anchors.empty())
+    return 0;
+
+  // Collect the instructions executed between the end of MBB and Succ that
+  // a hoisted instruction would need to move across.
+  SmallVector<MachineInstr *, 16> Between;
+  auto addBetween = [&](MachineInstr &MI) {
+    if (MI.mayLoadOrStore() ||
+        llvm::any_of(MI.defs(), [](const MachineOperand &Def) {
+          return Register::isPhysicalRegister(Def.getReg());
+        }))
+      Between.push_back(&MI);
+  };
+
+  for (MachineInstr &MI : MBB.terminators()) {
+    if (isCodeMotionBarrier(MI, TRI))
+      return 0;
+    addBetween(MI);
+  }
+
+  SmallPtrSet<MachineBasicBlock *, 8> Region;
+  SmallVector<MachineBasicBlock *, 8> Worklist(MBB.succ_begin(),
+                                               MBB.succ_end());
+  while (!Worklist.empty()) {
+    MachineBasicBlock *Block = Worklist.pop_back_val();
+    if (Block == Succ || !Region.insert(Block).second)
+      continue;
+    // A path back to MBB that avoids Succ is a loop MBB runs more often in.
+    if (Block == &MBB || Region.size() > CrossBlockRegionLimit)
+      return 0;
+    for (MachineInstr &MI : *Block) {
+      if (isCodeMotionBarrier(MI, TRI))
+        return 0;
+      addBetween(MI);
+    }
+    Worklist.append(Block->succ_begin(), Block->succ_end());
+  }
+
+  auto canHoist = [&](MachineInstr &MI) {
+    CombineInfo CI;
+    if (!getMergeableInfo(MI, CI))
+      return false;
+
+    const bool IsDS = CI.InstClass == DS_READ || CI.InstClass == DS_WRITE;
+    if (llvm::none_of(Anchors, [&](CombineInfo &Anchor) {
+          return Anchor.InstClass == CI.InstClass &&
+                 (!IsDS || Anchor.I->getOpcode() == MI.getOpcode()) &&
+                 Anchor.hasSameBaseAddress(MI);
+        }))
+      return false;
+
+    for (const MachineOperand &MO : MI.operands()) {
+      if (!MO.isReg() || !MO.getReg())
+        continue;
+      Register Reg = MO.getReg();
+      if (Register::isPhysicalRegister(Reg)) {
+        if (MO.isDef())
+          return false;
+        for (MachineInstr *Other : Between)
+          if (Other->modifiesRegister(Reg, TRI))
+            return false;
+        continue;
+      }
+      if (!MO.readsReg())
+        continue;
+      // Every value used must be available at the end of MBB.
+      MachineInstr *Def = MRI->getVRegDef(Reg);
+      if (!Def || !DT.dominates(Def->getParent(), &MBB) ||
+          (Def->getParent() == &MBB && Def->isTerminator()))
+        return false;
+    }
+
+    for (MachineInstr *Other : Between)
+      if (Other->mayLoadOrStore() && !memAccessesCanBeReordered(MI, *Other, AA))
+        return false;
+    return true;
+  };
+
+  SmallVector<MachineInstr *, 8> ToHoist;
+  for (MachineBasicBlock::iterator I = Succ->getFirstNonPHI(),
+                                   E = Succ->getFirstTerminator();
+       I != E; ++I) {
+    MachineInstr &MI = *I;
+    if (MI.isDebugInstr())
+      continue;
+    if (isCodeMotionBarrier(MI, TRI))
+      break;
+    if (canHoist(MI))
+      ToHoist.push_back(&MI);
+    else
+      addBetween(MI);
+  }
+
+  MachineBasicBlock::iterator InsertPt = MBB.getFirstTerminator();
+  for (MachineInstr *MI : ToHoist) {
+    LLVM_DEBUG(dbgs() << "Hoisting into " << printMBBReference(MBB) << ": "
+                      << *MI);
+    MBB.splice(InsertPt, Succ, MI);
+    // The hoisted instruction now reads its operands before any other use
+    // left in Succ, and after the uses in MBB, so kills of them are stale.
+    for (const MachineOperand &MO : MI->uses())
+      if (MO.isReg() && Register::isVirtualRegister(MO.getReg()))
+        MRI->clearKillFlags(MO.getReg());
+  }
+  NumHoisted += ToHoist.size();
+  return ToHoist.size();
+}
+
 bool SILoadStoreOptimizer::runOnMachineFunction(MachineFunction &MF) {
   if (skipFunction(MF.getFunction()))
     return false;
@@ -1725,6 +1910,25 @@ bool SILoadStoreOptimizer::runOnMachineFunction(MachineFunction &MF) {
 
   bool Modified = false;
 
+  if (EnableCrossBlockMerge) {
+    DomTreeBase<MachineBasicBlock> DT;
+    DT.recalculate(MF);
+    PostDomTreeBase<MachineBasicBlock> PDT;
+    PDT.recalculate(MF);
+    LoopInfoBase<MachineBasicBlock, MachineLoop> LI;
+    LI.analyze(DT);
+
+    // Visit successors first, so that instructions can move up a chain of
+    // control equivalent blocks.
+    unsigned NumFunctionHoisted = 0;
+    for (MachineBasicBlock *MBB : post_order(&MF))
+      NumFunctionHoisted += hoistFromPostDominator(*MBB, DT, PDT, LI);
+
+    LLVM_DEBUG(dbgs() << "Hoisted " << NumFunctionHoisted
+                      << " instructions into dominating blocks in "
+                      << MF.getName() << '\n');
+    Modified |= NumFunctionHoisted != 0;
+  }
 
   for (MachineBasicBlock &MBB : MF) {
     std::list<std::list<CombineInfo> > MergeableInsts;
@@ -9,13 +9,18 @@
 //
 // This file declares and defines a pass which selects only code which is
 // expected to be run by an accelerator i.e. referenced directly or indirectly
-// (through a fully inlineable call-chain) by a [[hc]] function. To support
+// (through a fully inlineable call-chain) by a [[hc]] function. Functions
+// whose address flows into accelerator code, either from an instruction or
+// from the initializer of a global it uses, are conservatively treated as
+// reachable since they may be the target of an indirect call. To support
 // subsequent processing, it also marks all identified functions as AlwaysInline
 // thus making it possible to use only the AlwaysInliner without resorting to a
 // more expensive full Inliner pass.
 //
 //===----------------------------------------------------------------------===//
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/InlineCost.h"
 #include "llvm/IR/Attributes.h"
 #include "llvm/IR/Constants.h"
@@ -30,23 +35,105 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "hc-select"
+
+STATISTIC(NumKernels, "Number of kernels used as reachability roots");
+STATISTIC(NumReachable, "Number of functions reachable from kernels");
+STATISTIC(NumAddressTaken, "Number of functions reachable via their address");
+STATISTIC(NumBodiesDeleted, "Number of non-accelerator bodies deleted");
+STATISTIC(NumFunctionsErased, "Number of dead function declarations erased");
+STATISTIC(NumGlobalsErased, "Number of dead global variables erased");
+STATISTIC(NumAliasesErased, "Number of dead aliases erased");
+
 namespace {
 class SelectAcceleratorCode : public ModulePass {
     SmallPtrSet<const Function*, 8u> HCCallees_;
 
-    void findAllHCCallees_(const Function &F, Module &M)
+    // Marks every function referred to by K as reachable. Function pointers
+    // reach code through constant expressions, aggregates, aliases and global
+    // initializers (e.g. dispatch tables), so all of these are looked through.
+    // This is a conservative escape analysis: any function whose address can
+    // flow into accelerator code is a potential indirect call target.
+    void enqueueReferencedFunctions_(
+        const Constant &K,
+        SmallVectorImpl<const Function*> &Worklist,
+        SmallPtrSetImpl<const Constant*> &Visited,
+        bool IsDirectCallee = false)
     {
-        for (auto&& BB : F) {
-            for (auto&& I : BB) {
-                if (auto CI = dyn_cast<CallInst>(&I)) {
-                    auto V = CI->getCalledValue()->stripPointerCasts();
-                    if (auto Callee = dyn_cast<Function>(V)) {
-                        auto Tmp = HCCallees_.insert(Callee);
-                        if (Tmp.second) findAllHCCallees_(*Callee, M);
+        SmallVector<const Constant*, 8u> Pending{&K};
+        while (!Pending.empty()) {
+            const Constant *C = Pending.pop_back_val();
+            if (C->getNumOperands() == 0 && !isa<GlobalValue>(C)) continue;
+            if (!Visited.insert(C).second) continue;
+
+            if (auto F = dyn_cast<Function>(C)) {
+                if (HCCallees_.insert(F).second) {
+                    Worklist.push_back(F);
+                    if (!IsDirectCallee) ++NumAddressTaken;
+                }
+                continue;
+            }
+            if (auto GVar = dyn_cast<GlobalVariable>(C)) {
+                if (GVar->hasInitializer()) {
+                    Pending.push_back(GVar->getInitializer());
+                }
+                continue;
+            }
+            if (auto GA = dyn_cast<GlobalAlias>(C)) {
+                if (GA->getAliasee()) Pending.push_back(GA->getAliasee());
+                continue;
+            }
+            if (isa<GlobalValue>(C)) continue;
+
+            // Not every operand is a constant: the basic block of a
+            // blockaddress is not, and cannot lead to another function.
+            for (auto&& Op : C->operands()) {
+                if (auto KOp = dyn_cast<Constant>(Op)) Pending.push_back(KOp);
+            }
+        }
+    }
+
+    // Iterative, so that deep call chains cannot exhaust the stack; each
+    // function is scanned at most once. Every constant operand of a reachable
+    // function is followed, which covers direct calls and invokes (including
+    // those through bitcasts) as well as functions whose address is taken.
+    void findAllHCCallees_(Module &M)
+    {
+        SmallVector<const Function*, 16u> Worklist;
+        SmallPtrSet<const Constant*, 32u> Visited;
+        for (auto&& F : M.functions()) {
+            if (F.getCallingConv() != CallingConv::AMDGPU_KERNEL) continue;
+
+            ++NumKernels;
+            if (HCCallees_.insert(&F).second) Worklist.push_back(&F);
+        }
+
+        while (!Worklist.empty()) {
+            const Function *F = Worklist.pop_back_val();
+
+            if (F->hasPersonalityFn()) {
+                enqueueReferencedFunctions_(
+                    *F->getPersonalityFn(), Worklist, Visited);
+            }
+
+            for (auto&& BB : *F) {
+                for (auto&& I : BB) {
+                    auto CB = dyn_cast<CallBase>(&I);
+                    for (auto&& Op : I.operands()) {
+                        auto K = dyn_cast<Constant>(Op);
+                        if (!K) continue;
+
+                        enqueueReferencedFunctions_(
+                            *K,
+                            Worklist,
+                            Visited,
+                            CB && CB->isCallee(&Op));
                     }
                 }
             }
         }
+
+        NumReachable += HCCallees_.size();
     }
 
     template<typename T>
@@ -58,51 +145,104 @@ class SelectAcceleratorCode : public ModulePass {
         X.eraseFromParent();
     }
 
-    template<typename F, typename G, typename P>
-    bool eraseIf_(F First, G Last, P Predicate) const
+    // Collects the global values that the initializer / aliasee of GV refers
+    // to, looking through constant expressions and aggregates. These are the
+    // only values whose liveness can change when GV is erased.
+    static
+    void collectReferencedGlobals_(
+        const GlobalValue &GV, SmallVectorImpl<GlobalValue*> &Out)
     {
-        bool erasedSome = false;
-
-        auto It = First();
-        while (It != Last()) {
-            It->removeDeadConstantUsers();
-            if (Predicate(*It)) {
-                erase_(*It);
-                erasedSome = true;
-                It = First();
+        SmallVector<const Constant*, 8u> Worklist;
+        SmallPtrSet<const Constant*, 8u> Visited;
+
+        if (auto GVar = dyn_cast<GlobalVariable>(&GV)) {
+            if (GVar->hasInitializer()) {
+                Worklist.push_back(GVar->getInitializer());
             }
-            else ++It;
+        }
+        else if (auto GA = dyn_cast<GlobalAlias>(&GV)) {
+            if (GA->getAliasee()) Worklist.push_back(GA->getAliasee());
         }
 
-        return erasedSome;
+        while (!Worklist.empty()) {
+            const Constant *K = Worklist.pop_back_val();
+            if (!Visited.insert(K).second) continue;
+
+            if (auto G = dyn_cast<GlobalValue>(K)) {
+                Out.push_back(const_cast<GlobalValue*>(G));
+                continue;
+            }
+            for (auto&& Op : K->operands()) {
+                if (auto KOp = dyn_cast<Constant>(Op)) Worklist.push_back(KOp);
+            }
+        }
+    }
+
+    bool isDead_(GlobalValue &GV) const
+    {
+        if (auto F = dyn_cast<Function>(&GV)) {
+            if (HCCallees_.count(F) || !F->isDeclaration()) return false;
+        }
+        else if (!isa<GlobalVariable>(GV) && !isa<GlobalAlias>(GV)) {
+            return false;
+        }
+
+        GV.removeDeadConstantUsers();
+
+        return !GV.isConstantUsed();
     }
 
     bool eraseNonHCFunctionsBody_(Module &M) const
     {
         bool Modified = false;
         for (auto&& F : M.functions()) {
-          if (HCCallees_.count(M.getFunction(F.getName())) == 0) {
+            if (F.isDeclaration() || HCCallees_.count(&F)) continue;
+
             F.deleteBody();
+            ++NumBodiesDeleted;
             Modified = true;
-          }
-        };
+        }
         return Modified;
     }
 
-    bool eraseDeadGlobals_(Module &M) const
+    // Erases every global variable, alias and function declaration that is no
+    // longer used. Each value is queued once initially and only re-queued when
+    // a value referencing it is erased, so the whole module is processed in a
+    // single linear pass rather than restarting after every erasure.
+    bool eraseDeadGlobalValues_(Module &M) const
     {
-        return eraseIf_(
-            [&]() { return M.global_begin(); },
-            [&]() { return M.global_end(); },
-            [](const Constant& K) { return !K.isConstantUsed(); });
-    }
+        SmallVector<GlobalValue*, 64u> Worklist;
+        for (auto&& GV : M.global_values()) Worklist.push_back(&GV);
 
-    bool eraseDeadAliases_(Module &M)
-    {
-        return eraseIf_(
-            [&]() { return M.alias_begin(); },
-            [&]() { return M.alias_end(); },
-            [](const Constant& K) { return !K.isConstantUsed(); });
+        // Tracks what is currently queued, so that each value appears in the
+        // worklist at most once.
+        SmallPtrSet<GlobalValue*, 32u> Pending{
+            Worklist.begin(), Worklist.end()};
+        SmallVector<GlobalValue*, 8u> Referenced;
+
+        bool Modified = false;
+        while (!Worklist.empty()) {
+            GlobalValue *GV = Worklist.pop_back_val();
+            if (!Pending.erase(GV) || !isDead_(*GV)) continue;
+
+            Referenced.clear();
+            collectReferencedGlobals_(*GV, Referenced);
+
+            if (isa<Function>(GV)) ++NumFunctionsErased;
+            else if (isa<GlobalAlias>(GV)) ++NumAliasesErased;
+            else ++NumGlobalsErased;
+
+            if (auto F = dyn_cast<Function>(GV)) erase_(*F);
+            else if (auto GA = dyn_cast<GlobalAlias>(GV)) erase_(*GA);
+            else erase_(*cast<GlobalVariable>(GV));
+            Modified = true;
+
+            for (auto&& R : Referenced) {
+                if (R != GV && Pending.insert(R).second) Worklist.push_back(R);
+            }
+        }
+
+        return Modified;
     }
 
     static
@@ -128,21 +268,15 @@ public:
     bool runOnModule(Module &M) override {
         // This may be a candidate for an analysis pass that is
         // invalidated appropriately by other passes.
-        for (auto&& F : M.functions()) {
-            if (F.getCallingConv() == CallingConv::AMDGPU_KERNEL) {
-                auto Tmp = HCCallees_.insert(M.getFunction(F.getName()));
-                if (Tmp.second) findAllHCCallees_(F, M);
-            }
-        }
+        HCCallees_.clear();
+        findAllHCCallees_(M);
 
         bool Modified = eraseNonHCFunctionsBody_(M);
 
-        Modified = eraseDeadGlobals_(M) || Modified;
+        Modified = eraseDeadGlobalValues_(M) || Modified;
 
         M.dropTriviallyDeadConstantArrays();
 
-        Modified = eraseDeadAliases_(M) || Modified;
-
         return Modified;
     }
 };
@@ -42,11 +42,13 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/Internalize.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
+#include <atomic>
 #include <cassert>
 #include <memory>
 #include <set>
@@ -122,6 +124,11 @@ static cl::opt<bool> PrintImportFailures(
 static cl::opt<bool> ComputeDead("compute-dead", cl::init(true), cl::Hidden,
                                  cl::desc("Compute dead symbols"));
 
+static cl::opt<unsigned> ThinLinkThreads(
+    "thin-link-threads", cl::init(0), cl::Hidden,
+    cl::desc("Compute the import lists and the dead symbols of the combined "
+             "index on this many threads (0 = disabled)"));
+
 static cl::opt<bool> EnableImportMetadata(
     "enable-import-metadata", cl::init(
 #if !defined(NDEBUG)
@@ -262,6 +269,10 @@ namespace {
 using EdgeInfo = std::tuple<const FunctionSummary *, unsigned /* Threshold */,
                             GlobalValue::GUID>;
 
+/// The symbols found to be exported while computing the imports of a module,
+/// each with the module exporting it, in the order they were found.
+using ExportLogTy = std::vector<std::pair<StringRef, GlobalValue::GUID>>;
+
 } // anonymous namespace
 
 static ValueInfo
@@ -281,8 +292,7 @@ updateValueInfoForIndirectCalls(const ModuleSummaryIndex &Index, ValueInfo VI) {
 
 static void computeImportForReferencedGlobals(
     const FunctionSummary &Summary, const GVSummaryMapTy &DefinedGVSummaries,
-    FunctionImporter::ImportMapTy &ImportList,
-    StringMap<FunctionImporter::ExportSetTy> *ExportLists) {
+    FunctionImporter::ImportMapTy &ImportList, ExportLogTy *ExportLog) {
   for (auto &VI : Summary.refs()) {
     if (DefinedGVSummaries.count(VI.getGUID())) {
       LLVM_DEBUG(
@@ -311,8 +321,8 @@ static void computeImportForReferencedGlobals(
         // Only update stat if we haven't already imported this variable.
         if (ILI.second)
           NumImportedGlobalVarsThinLink++;
-        if (ExportLists)
-          (*ExportLists)[RefSummary->modulePath()].insert(VI.getGUID());
+        if (ExportLog)
+          ExportLog->emplace_back(RefSummary->modulePath(), VI.getGUID());
         break;
       }
   }
@@ -348,11 +358,10 @@ static void computeImportForFunction(
     const FunctionSummary &Summary, const ModuleSummaryIndex &Index,
     const unsigned Threshold, const GVSummaryMapTy &DefinedGVSummaries,
     SmallVectorImpl<EdgeInfo> &Worklist,
-    FunctionImporter::ImportMapTy &ImportList,
-    StringMap<FunctionImporter::ExportSetTy> *ExportLists,
+    FunctionImporter::ImportMapTy &ImportList, ExportLogTy *ExportLog,
     FunctionImporter::ImportThresholdsTy &ImportThresholds) {
   computeImportForReferencedGlobals(Summary, DefinedGVSummaries, ImportList,
-                                    ExportLists);
+                                    ExportLog);
   static int ImportCount = 0;
   for (auto &Edge : Summary.calls()) {
     ValueInfo VI = Edge.first;
@@ -479,9 +488,8 @@ static void computeImportForFunction(
       }
 
       // Make exports in the source module.
-      if (ExportLists) {
-        auto &ExportList = (*ExportLists)[ExportModulePath];
-        ExportList.insert(VI.getGUID());
+      if (ExportLog) {
+        ExportLog->emplace_back(ExportModulePath, VI.getGUID());
         if (!PreviouslyImported) {
           // This is the first time this function was exported from its source
           // module, so mark all functions and globals it references as exported
@@ -491,11 +499,11 @@ static void computeImportForFunction(
           // defined in the module later in a single pass.
           for (auto &Edge : ResolvedCalleeSummary->calls()) {
             auto CalleeGUID = Edge.first.getGUID();
-            ExportList.insert(CalleeGUID);
+            ExportLog->emplace_back(ExportModulePath, CalleeGUID);
           }
           for (auto &Ref : ResolvedCalleeSummary->refs()) {
             auto GUID = Ref.getGUID();
-            ExportList.insert(GUID);
+            ExportLog->emplace_back(ExportModulePath, GUID);
           }
         }
       }
@@ -512,7 +520,8 @@ static void computeImportForFunction(
 
     const auto AdjThreshold = GetAdjustedThreshold(Threshold, IsHotCallsite);
 
-    ImportCount++;
+    if (ImportCutoff >= 0)
+      ImportCount++;
 
     // Insert the newly imported function to the worklist.
     Worklist.emplace_back(ResolvedCalleeSummary, AdjThreshold, VI.getGUID());
@@ -525,7 +534,7 @@ static void computeImportForFunction(
 static void ComputeImportForModule(
     const GVSummaryMapTy &DefinedGVSummaries, const ModuleSummaryIndex &Index,
     StringRef ModName, FunctionImporter::ImportMapTy &ImportList,
-    StringMap<FunctionImporter::ExportSetTy> *ExportLists = nullptr) {
+    ExportLogTy *ExportLog = nullptr) {
   // Worklist contains the list of function imported in this module, for which
   // we will analyse the callees and may import further down the callgraph.
   SmallVector<EdgeInfo, 128> Worklist;
@@ -551,7 +560,7 @@ static void ComputeImportForModule(
     LLVM_DEBUG(dbgs() << "Initialize import for " << VI << "\n");
     computeImportForFunction(*FuncSummary, Index, ImportInstrLimit,
                              DefinedGVSummaries, Worklist, ImportList,
-                             ExportLists, ImportThresholds);
+                             ExportLog, ImportThresholds);
   }
 
   // Process the newly imported functions and add callees to the worklist.
@@ -561,7 +570,7 @@ static void ComputeImportForModule(
     auto Threshold = std::get<1>(FuncInfo);
 
     computeImportForFunction(*Summary, Index, Threshold, DefinedGVSummaries,
-                             Worklist, ImportList, ExportLists,
+                             Worklist, ImportList, ExportLog,
                              ImportThresholds);
   }
 
@@ -614,6 +623,34 @@ static unsigned numGlobalVarSummaries(const ModuleSummaryIndex &Index,
 }
 #endif
 
+/// Add the exports recorded in \p ExportLog to \p ExportLists.
+static void
+addExports(const ExportLogTy &ExportLog,
+           StringMap<FunctionImporter::ExportSetTy> &ExportLists) {
+  StringRef ModulePath;
+  FunctionImporter::ExportSetTy *ExportList = nullptr;
+  for (auto &Export : ExportLog) {
+    if (!ExportList || Export.first != ModulePath) {
+      ModulePath = Export.first;
+      ExportList = &ExportLists[ModulePath];
+    }
+    ExportList->insert(Export.second);
+  }
+}
+
+/// Return the number of threads to compute the imports of the modules on.
+static unsigned getImportThreads() {
+  // The import cutoff counts the imports of all modules, and the output for
+  // each module has to stay in one piece.
+  if (ImportCutoff >= 0 || PrintImportFailures)
+    return 1;
+#ifndef NDEBUG
+  if (DebugFlag)
+    return 1;
+#endif
+  return std::max(1u, unsigned(ThinLinkThreads));
+}
+
 /// Compute all the import and export for every module using the Index.
 void llvm::ComputeCrossModuleImport(
     const ModuleSummaryIndex &Index,
@@ -621,13 +658,49 @@ void llvm::ComputeCrossModuleImport(
     StringMap<FunctionImporter::ImportMapTy> &ImportLists,
     StringMap<FunctionImporter::ExportSetTy> &ExportLists) {
   // For each module that has function defined, compute the import/export lists.
-  for (auto &DefinedGVSummaries : ModuleToDefinedGVSummaries) {
-    auto &ImportList = ImportLists[DefinedGVSummaries.first()];
-    LLVM_DEBUG(dbgs() << "Computing import for Module '"
-                      << DefinedGVSummaries.first() << "'\n");
-    ComputeImportForModule(DefinedGVSummaries.second, Index,
-                           DefinedGVSummaries.first(), ImportList,
-                           &ExportLists);
+  // Computing the imports of a module only reads the index, so a window of
+  // modules is done in parallel. The exports they cause are then added in
+  // module order, so the export sets are built exactly as when the modules are
+  // done one after the other.
+  std::vector<const StringMapEntry<GVSummaryMapTy> *> Modules;
+  for (auto &DefinedGVSummaries : ModuleToDefinedGVSummaries)
+    Modules.push_back(&DefinedGVSummaries);
+
+  unsigned Threads = getImportThreads();
+  std::unique_ptr<ThreadPool> Pool;
+  if (Threads > 1)
+    Pool = std::make_unique<ThreadPool>(ThreadPool::getGlobal(), Threads);
+  size_t WindowSize = Threads * 4;
+  std::vector<FunctionImporter::ImportMapTy *> WindowImportLists(WindowSize);
+  std::vector<ExportLogTy> WindowExportLogs(WindowSize);
+
+  for (size_t Begin = 0; Begin < Modules.size(); Begin += WindowSize) {
+    size_t End = std::min(Begin + WindowSize, Modules.size());
+    for (size_t I = Begin; I != End; ++I)
+      WindowImportLists[I - Begin] = &ImportLists[Modules[I]->first()];
+
+    auto ComputeImports = [&](size_t I) {
+      auto &DefinedGVSummaries = *Modules[I];
+      LLVM_DEBUG(dbgs() << "Computing import for Module '"
+                        << DefinedGVSummaries.first() << "'\n");
+      ComputeImportForModule(DefinedGVSummaries.second, Index,
+                             DefinedGVSummaries.first(),
+                             *WindowImportLists[I - Begin],
+                             &WindowExportLogs[I - Begin]);
+    };
+    if (Pool) {
+      for (size_t I = Begin; I != End; ++I)
+        Pool->async([&ComputeImports, I] { ComputeImports(I); });
+      Pool->wait();
+    } else {
+      for (size_t I = Begin; I != End; ++I)
+        ComputeImports(I);
+    }
+
+    for (size_t I = Begin; I != End; ++I) {
+      addExports(WindowExportLogs[I - Begin], ExportLists);
+      WindowExportLogs[I - Begin].clear();
+    }
   }
 
   // When computing imports we added all GUIDs referenced by anything
@@ -730,6 +803,125 @@ void llvm::ComputeCrossModuleImportForModuleFromIndex(
 #endif
 }
 
+/// Return true if \p VI, reached from a live value, has to be live as well.
+/// \p IsAliasee is true if it was reached as the aliasee of a live alias.
+static bool
+isLiveWhenReached(ValueInfo VI, bool IsAliasee,
+                  function_ref<PrevailingType(GlobalValue::GUID)> isPrevailing) {
+  // We only keep live symbols that are known to be non-prevailing if any are
+  // available_externally, linkonceodr, weakodr. Those symbols are discarded
+  // later in the EliminateAvailableExternally pass and setting them to
+  // not-live could break downstreams users of liveness information (PR36483)
+  // or limit optimization opportunities.
+  if (isPrevailing(VI.getGUID()) == PrevailingType::No) {
+    bool KeepAliveLinkage = false;
+    bool Interposable = false;
+    for (auto &S : VI.getSummaryList()) {
+      if (S->linkage() == GlobalValue::AvailableExternallyLinkage ||
+          S->linkage() == GlobalValue::WeakODRLinkage ||
+          S->linkage() == GlobalValue::LinkOnceODRLinkage)
+        KeepAliveLinkage = true;
+      else if (GlobalValue::isInterposableLinkage(S->linkage()))
+        Interposable = true;
+    }
+
+    if (!IsAliasee) {
+      if (!KeepAliveLinkage)
+        return false;
+
+      if (Interposable)
+        report_fatal_error(
+            "Interposable and available_externally/linkonce_odr/weak_odr "
+            "symbol");
+    }
+  }
+  return true;
+}
+
+/// Mark everything reachable from the live values in \p Roots live, one
+/// level of the graph at a time. The edges out of a level are followed on
+/// \p Threads threads, which only read the index and claim the values they
+/// reach with an atomic flag; the summaries are marked live in between
+/// levels, so \p isPrevailing is the only callback used from the threads.
+/// Return the number of values made live.
+static unsigned propagateLivenessInParallel(
+    ModuleSummaryIndex &Index, ArrayRef<ValueInfo> Roots,
+    function_ref<PrevailingType(GlobalValue::GUID)> isPrevailing,
+    unsigned Threads) {
+  DenseMap<GlobalValue::GUID, unsigned> EntryIDs;
+  EntryIDs.reserve(Index.size());
+  std::vector<std::atomic<bool>> Claimed(Index.size());
+  for (const auto &Entry : Index) {
+    unsigned ID = EntryIDs.size();
+    EntryIDs[Entry.first] = ID;
+    Claimed[ID] = llvm::any_of(
+        Entry.second.SummaryList,
+        [](const std::unique_ptr<GlobalValueSummary> &S) {
+          return S->isLive();
+        });
+  }
+
+  unsigned LiveSymbols = 0;
+  std::vector<ValueInfo> Level(Roots.begin(), Roots.end());
+  std::unique_ptr<ThreadPool> Pool;
+  while (!Level.empty()) {
+    for (ValueInfo VI : Level)
+      for (auto &Summary : VI.getSummaryList())
+        if (!isa<AliasSummary>(Summary.get()))
+          Summary->setLive(true);
+
+    // Don't bother the pool with small levels.
+    size_t NumChunks = std::min<size_t>(Threads, (Level.size() + 255) / 256);
+    std::vector<std::vector<ValueInfo>> Reached(NumChunks);
+    auto ProcessChunk = [&](size_t Chunk) {
+      auto visit = [&](ValueInfo VI, bool IsAliasee) {
+        VI = updateValueInfoForIndirectCalls(Index, VI);
+        if (!VI)
+          return;
+        std::atomic<bool> &IsClaimed = Claimed[EntryIDs.lookup(VI.getGUID())];
+        if (IsClaimed.load(std::memory_order_relaxed) ||
+            !isLiveWhenReached(VI, IsAliasee, isPrevailing))
+          return;
+        if (!IsClaimed.exchange(true))
+          Reached[Chunk].push_back(VI);
+      };
+      size_t Begin = Chunk * Level.size() / NumChunks;
+      size_t End = (Chunk + 1) * Level.size() / NumChunks;
+      for (size_t I = Begin; I != End; ++I)
+        for (auto &Summary : Level[I].getSummaryList()) {
+          if (auto *AS = dyn_cast<AliasSummary>(Summary.get())) {
+            visit(AS->getAliaseeVI(), true);
+            continue;
+          }
+          for (auto Ref : Summary->refs())
+            visit(Ref, false);
+          if (auto *FS = dyn_cast<FunctionSummary>(Summary.get()))
+            for (auto Call : FS->calls())
+              visit(Call.first, false);
+        }
+    };
+    if (NumChunks == 1) {
+      ProcessChunk(0);
+    } else {
+      if (!Pool)
+        Pool = std::make_unique<ThreadPool>(ThreadPool::getGlobal(), Threads);
+      for (size_t Chunk = 0; Chunk != NumChunks; ++Chunk)
+        Pool->async([&ProcessChunk, Chunk] { ProcessChunk(Chunk); });
+      Pool->wait();
+    }
+
+    Level.clear();
+    for (auto &ChunkReached : Reached)
+      for (ValueInfo VI : ChunkReached) {
+        for (auto &S : VI.getSummaryList())
+          S->setLive(true);
+        ++LiveSymbols;
+        Level.push_back(VI);
+      }
+  }
+  return LiveSymbols;
+}
+
 void llvm::computeDeadSymbols(
     ModuleSummaryIndex &Index,
     const DenseSet<GlobalValue::GUID> &GUIDPreservedSymbols,
@@ -783,33 +975,8 @@ void llvm::computeDeadSymbols(
                      }))
       return;
 
-    // We only keep live symbols that are known to be non-prevailing if any are
-    // available_externally, linkonceodr, weakodr. Those symbols are discarded
-    // later in the EliminateAvailableExternally pass and setting them to
-    // not-live could break downstreams users of liveness information (PR36483)
-    // or limit optimization opportunities.
-    if (isPrevailing(VI.getGUID()) == PrevailingType::No) {
-      bool KeepAliveLinkage = false;
-      bool Interposable = false;
-      for (auto &S : VI.getSummaryList()) {
-        if (S->linkage() == GlobalValue::AvailableExternallyLinkage ||
-            S->linkage() == GlobalValue::WeakODRLinkage ||
-            S->linkage() == GlobalValue::LinkOnceODRLinkage)
-          KeepAliveLinkage = true;
-        else if (GlobalValue::isInterposableLinkage(S->linkage()))
-          Interposable = true;
-      }
-
-      if (!IsAliasee) {
-        if (!KeepAliveLinkage)
-          return;
-
-        if (Interposable)
-          report_fatal_error(
-              "Interposable and available_externally/linkonce_odr/weak_odr "
-              "symbol");
-      }
-    }
+    if (!isLiveWhenReached(VI, IsAliasee, isPrevailing))
+      return;
 
     for (auto &S : VI.getSummaryList())
       S->setLive(true);
@@ -817,6 +984,14 @@ void llvm::computeDeadSymbols(
     Worklist.push_back(VI);
   };
 
+  // Following the edges only writes the live flags, so it can be spread over
+  // threads. The live set is the same either way.
+  if (ThinLinkThreads > 1) {
+    LiveSymbols +=
+        propagateLivenessInParallel(Index, Worklist, isPrevailing,
+                                    ThinLinkThreads);
+    Worklist.clear();
+  }
   while (!Worklist.empty()) {
     auto VI = Worklist.pop_back_val();
     for (auto &Summary : VI.getSummaryList()) {
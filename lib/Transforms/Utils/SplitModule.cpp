@@ -91,12 +91,40 @@ static void addAllGlobalValueUsers(ClusterMapType &GVtoClusterMap,
   }
 }
 
+// Adds all functions that use GV, directly or through the functions they call,
+// to the same cluster as GV.
+static void addAllTransitiveUsers(ClusterMapType &GVtoClusterMap,
+                                  const GlobalValue *GV) {
+  SmallVector<const Value *, 8> Worklist;
+  SmallPtrSet<const Value *, 8> Visited;
+  Worklist.push_back(GV);
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    for (const User *U : V->users()) {
+      if (isa<Constant>(U) && !isa<GlobalValue>(U)) {
+        if (Visited.insert(U).second)
+          Worklist.push_back(U);
+        continue;
+      }
+      addNonConstUser(GVtoClusterMap, GV, U);
+      const GlobalValue *UserGV;
+      if (const Instruction *I = dyn_cast<Instruction>(U))
+        UserGV = I->getFunction();
+      else
+        UserGV = cast<GlobalValue>(U);
+      if (Visited.insert(UserGV).second)
+        Worklist.push_back(UserGV);
+    }
+  }
+}
+
 // Find partitions for module in the way that no locals need to be
 // globalized.
 // Try to balance pack those partitions into N files since this roughly equals
 // thread balancing for the backend codegen step.
-static void findPartitions(Module *M, ClusterIDMapType &ClusterIDMap,
-                           unsigned N) {
+static void findPartitions(
+    Module *M, ClusterIDMapType &ClusterIDMap, unsigned N,
+    function_ref<bool(const GlobalValue &GV)> IsAllocatedPerEntryPoint) {
   // At this point module should have the proper mix of globals and locals.
   // As we attempt to partition this module, we must not change any
   // locals to globals.
@@ -105,7 +133,8 @@ static void findPartitions(Module *M, ClusterIDMapType &ClusterIDMap,
   ClusterMapType GVtoClusterMap;
   ComdatMembersType ComdatMembers;
 
-  auto recordGVSet = [&GVtoClusterMap, &ComdatMembers](GlobalValue &GV) {
+  auto recordGVSet = [&GVtoClusterMap, &ComdatMembers,
+                      IsAllocatedPerEntryPoint](GlobalValue &GV) {
     if (GV.isDeclaration())
       return;
 
@@ -140,7 +169,9 @@ static void findPartitions(Module *M, ClusterIDMapType &ClusterIDMap,
       }
     }
 
-    if (GV.hasLocalLinkage())
+    if (IsAllocatedPerEntryPoint && IsAllocatedPerEntryPoint(GV))
+      addAllTransitiveUsers(GVtoClusterMap, &GV);
+    else if (GV.hasLocalLinkage())
       addAllGlobalValueUsers(GVtoClusterMap, &GV, &GV);
   };
 
@@ -249,7 +280,8 @@ static bool isInPartition(const GlobalValue *GV, unsigned I, unsigned N) {
 void llvm::SplitModule(
     std::unique_ptr<Module> M, unsigned N,
     function_ref<void(std::unique_ptr<Module> MPart)> ModuleCallback,
-    bool PreserveLocals) {
+    bool PreserveLocals,
+    function_ref<bool(const GlobalValue &GV)> IsAllocatedPerEntryPoint) {
   if (!PreserveLocals) {
     for (Function &F : *M)
       externalize(&F);
@@ -264,7 +296,7 @@ void llvm::SplitModule(
   // This performs splitting without a need for externalization, which might not
   // always be possible.
   ClusterIDMapType ClusterIDMap;
-  findPartitions(M.get(), ClusterIDMap, N);
+  findPartitions(M.get(), ClusterIDMap, N, IsAllocatedPerEntryPoint);
 
   // FIXME: We should be able to reuse M as the last partition instead of
   // cloning it.
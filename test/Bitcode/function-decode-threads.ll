@@ -0,0 +1,46 @@
+; RUN: llvm-as < %s > %t.bc
+; RUN: llvm-dis < %t.bc > %t.ll
+; RUN: llvm-dis -bitcode-function-decode-threads=2 < %t.bc > %t.threads.ll
+; RUN: diff %t.ll %t.threads.ll
+; RUN: FileCheck %s < %t.threads.ll
+
+; Function blocks decoded on worker threads give the same module as the ones
+; parsed from the stream, including their constants, metadata and forward
+; referenced block addresses.
+
+@table = global i8* blockaddress(@target, %bb)
+
+; CHECK: define i32 @constants(i32 %x)
+; CHECK: add i32 %x, 42
+; CHECK: store <2 x i32> <i32 1, i32 2>
+define i32 @constants(i32 %x) {
+  %a = add i32 %x, 42
+  %p = alloca <2 x i32>
+  store <2 x i32> <i32 1, i32 2>, <2 x i32>* %p
+  ret i32 %a
+}
+
+; CHECK: define i8* @uses_target()
+; CHECK: ret i8* blockaddress(@target, %bb)
+define i8* @uses_target() {
+  ret i8* blockaddress(@target, %bb)
+}
+
+; CHECK: define void @target(i32* %p)
+; CHECK: load i32, i32* %p, align 4, !tbaa !0
+define void @target(i32* %p) {
+entry:
+  %v = load i32, i32* %p, align 4, !tbaa !0
+  br label %bb
+
+bb:
+  %w = load i32, i32* %p, align 4, !range !3
+  %s = add i32 %v, %w
+  store i32 %s, i32* %p, align 4
+  ret void
+}
+
+!0 = !{!1, !1, i64 0}
+!1 = !{!"int", !2, i64 0}
+!2 = !{!"root"}
+!3 = !{i32 0, i32 10}
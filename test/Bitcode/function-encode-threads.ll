@@ -0,0 +1,70 @@
+; RUN: llvm-as < %s > %t.bc
+; RUN: llvm-as -bitcode-function-encode-threads=3 < %s > %t.threads.bc
+; RUN: cmp %t.bc %t.threads.bc
+; RUN: opt -module-summary -module-hash < %s -o %t.summary.bc
+; RUN: opt -module-summary -module-hash -bitcode-function-encode-threads=3 < %s -o %t.summary.threads.bc
+; RUN: cmp %t.summary.bc %t.summary.threads.bc
+; RUN: llvm-dis < %t.threads.bc | FileCheck %s
+
+; Function blocks encoded on worker threads are spliced into the module block
+; in order, so the output is the same as when they are written one after the
+; other.
+
+@table = global i8* blockaddress(@target, %bb)
+
+; CHECK: define i32 @constants(i32 %x)
+; CHECK: add i32 %x, 42
+; CHECK: store <2 x i32> <i32 1, i32 2>
+define i32 @constants(i32 %x) {
+  %a = add i32 %x, 42
+  %p = alloca <2 x i32>
+  store <2 x i32> <i32 1, i32 2>, <2 x i32>* %p
+  ret i32 %a
+}
+
+; CHECK: define void @target()
+; CHECK: bb:
+define void @target() {
+  br label %bb
+bb:
+  ret void
+}
+
+declare void @external()
+
+; CHECK: define void @calls(i32* %p)
+; CHECK: call void @external(), !dbg
+; CHECK: load i32, i32* %p, align 4, !range
+define void @calls(i32* %p) !dbg !4 {
+  call void @external(), !dbg !7
+  %v = load i32, i32* %p, align 4, !range !8
+  call void @target(), !dbg !7
+  ret void
+}
+
+; CHECK: define i32 @loop(i32 %n)
+; CHECK: phi i32
+define i32 @loop(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp ult i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret i32 %i.next
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "t.c", directory: "/")
+!2 = !{}
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = distinct !DISubprogram(name: "calls", scope: !1, file: !1, line: 1, type: !5, scopeLine: 1, unit: !0, retainedNodes: !2)
+!5 = !DISubroutineType(types: !6)
+!6 = !{null}
+!7 = !DILocation(line: 2, column: 3, scope: !4)
+!8 = !{i32 0, i32 10}
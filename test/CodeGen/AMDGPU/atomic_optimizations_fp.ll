@@ -0,0 +1,87 @@
+; RUN: opt -S -mtriple=amdgcn-- -mcpu=gfx900 -amdgpu-atomic-optimizer -verify < %s | FileCheck -check-prefixes=IR,DPP %s
+; RUN: opt -S -mtriple=amdgcn-- -mcpu=tahiti -amdgpu-atomic-optimizer -verify < %s | FileCheck -check-prefixes=IR,NODPP %s
+
+; Show that floating point add and sub atomics are done by a single lane when
+; unsafe math allows the additions to be reassociated.
+
+declare i32 @llvm.amdgcn.workitem.id.x()
+
+@local_float = addrspace(3) global float undef, align 4
+
+; IR-LABEL: @fadd_f32_uniform_local(
+; IR: [[CTPOP:%.*]] = call i64 @llvm.ctpop.i64(
+; IR: [[CTPOPFP:%.*]] = uitofp i64 [[CTPOP]] to float
+; IR: [[NEWV:%.*]] = fmul float %val, [[CTPOPFP]]
+; IR: atomicrmw fadd float addrspace(3)* @local_float, float [[NEWV]] seq_cst
+; IR: [[PHI:%.*]] = phi float
+; IR: [[PHIINT:%.*]] = bitcast float [[PHI]] to i32
+; IR: [[FIRST:%.*]] = call i32 @llvm.amdgcn.readfirstlane(i32 [[PHIINT]])
+; IR: [[FIRSTFP:%.*]] = bitcast i32 [[FIRST]] to float
+; IR: [[OFFSET:%.*]] = fmul float %val, {{%.*}}
+; IR: fadd float [[FIRSTFP]], [[OFFSET]]
+define amdgpu_kernel void @fadd_f32_uniform_local(float addrspace(1)* %out, float %val) #0 {
+entry:
+  %old = atomicrmw fadd float addrspace(3)* @local_float, float %val seq_cst
+  store float %old, float addrspace(1)* %out
+  ret void
+}
+
+; IR-LABEL: @fsub_f64_uniform_global(
+; IR: [[CTPOPFP:%.*]] = uitofp i64 {{%.*}} to double
+; IR: [[NEWV:%.*]] = fmul double %val, [[CTPOPFP]]
+; IR: atomicrmw fsub double addrspace(1)* %ptr, double [[NEWV]] seq_cst
+; IR: call i32 @llvm.amdgcn.readfirstlane(
+; IR: call i32 @llvm.amdgcn.readfirstlane(
+; IR: fsub double
+define amdgpu_kernel void @fsub_f64_uniform_global(double addrspace(1)* %ptr, double %val) #0 {
+entry:
+  %old = atomicrmw fsub double addrspace(1)* %ptr, double %val seq_cst
+  store double %old, double addrspace(1)* %ptr
+  ret void
+}
+
+; IR-LABEL: @fadd_f32_varying_local(
+; DPP: call i32 @llvm.amdgcn.set.inactive.i32(i32 {{%.*}}, i32 -2147483648)
+; DPP: [[DPP:%.*]] = call i32 @llvm.amdgcn.update.dpp.i32(i32 -2147483648,
+; DPP: [[DPPFP:%.*]] = bitcast i32 [[DPP]] to float
+; DPP: fadd float {{%.*}}, [[DPPFP]]
+; DPP: [[LAST:%.*]] = call i32 @llvm.amdgcn.readlane(i32 {{%.*}}, i32 63)
+; DPP: [[LASTFP:%.*]] = bitcast i32 [[LAST]] to float
+; DPP: [[NEWV:%.*]] = call float @llvm.amdgcn.wwm.f32(float [[LASTFP]])
+; DPP: atomicrmw fadd float addrspace(3)* @local_float, float [[NEWV]] seq_cst
+; NODPP-NOT: @llvm.amdgcn.update.dpp
+; NODPP: atomicrmw fadd float addrspace(3)* @local_float, float %val seq_cst
+define amdgpu_kernel void @fadd_f32_varying_local(float addrspace(1)* %out) #0 {
+entry:
+  %lane = call i32 @llvm.amdgcn.workitem.id.x()
+  %val = uitofp i32 %lane to float
+  %old = atomicrmw fadd float addrspace(3)* @local_float, float %val seq_cst
+  store float %old, float addrspace(1)* %out
+  ret void
+}
+
+; Half precision values are not handled.
+
+; IR-LABEL: @fadd_f16_uniform_local(
+; IR-NOT: @llvm.amdgcn.readfirstlane
+; IR: atomicrmw fadd half addrspace(3)* %ptr, half %val seq_cst
+define amdgpu_kernel void @fadd_f16_uniform_local(half addrspace(3)* %ptr, half %val) #0 {
+entry:
+  %old = atomicrmw fadd half addrspace(3)* %ptr, half %val seq_cst
+  store half %old, half addrspace(3)* %ptr
+  ret void
+}
+
+; Without unsafe math, every lane does its own atomic.
+
+; IR-LABEL: @fadd_f32_uniform_local_strict(
+; IR-NOT: @llvm.ctpop
+; IR: atomicrmw fadd float addrspace(3)* @local_float, float %val seq_cst
+define amdgpu_kernel void @fadd_f32_uniform_local_strict(float addrspace(1)* %out, float %val) {
+entry:
+  %old = atomicrmw fadd float addrspace(3)* @local_float, float %val seq_cst
+  store float %old, float addrspace(1)* %out
+  ret void
+}
+
+attributes #0 = { "unsafe-fp-math"="true" }
@@ -0,0 +1,97 @@
+; RUN: llc -march=amdgcn -pass-remarks-analysis=amdgpu-perf-hint < %s 2>%t | FileCheck -check-prefix=GCN %s
+; RUN: FileCheck -check-prefix=REMARK %s < %t
+; RUN: llc -march=amdgcn -amdgpu-perf-hint-use-frequency=0 < %s | FileCheck -check-prefix=NOFREQ %s
+
+; Most of the instructions are outside the loop, but the loop runs 1024 times
+; and only loads and stores, so the kernel is memory bound once instructions
+; are weighted by execution frequency.
+
+; REMARK: remark: {{.*}} estimated arithmetic intensity {{[0-9.e+-]+}} (memory {{[5-9][0-9]}}%), memory bound: true, wave limiter: {{true|false}}
+
+; GCN-LABEL: {{^}}test_hot_loop:
+; GCN: ; MemoryBound: 1
+
+; NOFREQ-LABEL: {{^}}test_hot_loop:
+; NOFREQ: ; MemoryBound: 0
+define amdgpu_kernel void @test_hot_loop(i32 addrspace(1)* %in, i32 addrspace(1)* %out, i32 %x) {
+entry:
+  %a0 = mul i32 %x, %x
+  %a1 = add i32 %a0, 3
+  %a2 = xor i32 %a1, %x
+  %a3 = mul i32 %a2, %a1
+  %a4 = add i32 %a3, 7
+  %a5 = xor i32 %a4, %a2
+  %a6 = mul i32 %a5, %a4
+  %a7 = add i32 %a6, 11
+  %a8 = xor i32 %a7, %a5
+  %a9 = mul i32 %a8, %a7
+  %a10 = add i32 %a9, 13
+  %a11 = xor i32 %a10, %a8
+  %a12 = mul i32 %a11, %a10
+  %a13 = add i32 %a12, 17
+  %a14 = xor i32 %a13, %a11
+  %a15 = mul i32 %a14, %a13
+  %a16 = add i32 %a15, 19
+  %a17 = xor i32 %a16, %a14
+  %a18 = mul i32 %a17, %a16
+  %a19 = add i32 %a18, 23
+  store i32 %a19, i32 addrspace(1)* %out
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %in.gep = getelementptr inbounds i32, i32 addrspace(1)* %in, i32 %i
+  %v0 = load volatile i32, i32 addrspace(1)* %in.gep
+  %v1 = load volatile i32, i32 addrspace(1)* %in.gep
+  %v2 = load volatile i32, i32 addrspace(1)* %in.gep
+  %v3 = load volatile i32, i32 addrspace(1)* %in.gep
+  %out.gep = getelementptr inbounds i32, i32 addrspace(1)* %out, i32 %i
+  store volatile i32 %v0, i32 addrspace(1)* %out.gep
+  store volatile i32 %v1, i32 addrspace(1)* %out.gep
+  store volatile i32 %v2, i32 addrspace(1)* %out.gep
+  store volatile i32 %v3, i32 addrspace(1)* %out.gep
+  %i.next = add nuw nsw i32 %i, 1
+  %cmp = icmp eq i32 %i.next, 1024
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; The cold block runs once per 1000 calls. Its memory instructions get the
+; smallest weight instead of none, which raises the memory share from the 25%
+; of the kernel argument loads alone.
+
+; REMARK: remark: {{.*}} estimated arithmetic intensity {{[0-9.e+-]+}} (memory 30%), memory bound: false
+define amdgpu_kernel void @test_cold_block(i32 addrspace(1)* %in, i32 addrspace(1)* %out, i32 %x) !prof !1 {
+entry:
+  %a0 = mul i32 %x, %x
+  %a1 = add i32 %a0, 3
+  %c = icmp eq i32 %a1, 0
+  br i1 %c, label %cold, label %exit, !prof !0
+
+cold:
+  %v0 = load volatile i32, i32 addrspace(1)* %in
+  %v1 = load volatile i32, i32 addrspace(1)* %in
+  %v2 = load volatile i32, i32 addrspace(1)* %in
+  %v3 = load volatile i32, i32 addrspace(1)* %in
+  %v4 = load volatile i32, i32 addrspace(1)* %in
+  %v5 = load volatile i32, i32 addrspace(1)* %in
+  %v6 = load volatile i32, i32 addrspace(1)* %in
+  %v7 = load volatile i32, i32 addrspace(1)* %in
+  store volatile i32 %v0, i32 addrspace(1)* %out
+  store volatile i32 %v1, i32 addrspace(1)* %out
+  store volatile i32 %v2, i32 addrspace(1)* %out
+  store volatile i32 %v3, i32 addrspace(1)* %out
+  store volatile i32 %v4, i32 addrspace(1)* %out
+  store volatile i32 %v5, i32 addrspace(1)* %out
+  store volatile i32 %v6, i32 addrspace(1)* %out
+  store volatile i32 %v7, i32 addrspace(1)* %out
+  br label %exit
+
+exit:
+  ret void
+}
+
+!0 = !{!"branch_weights", i32 1, i32 1000}
+!1 = !{!"function_entry_count", i64 1000}
@@ -0,0 +1,67 @@
+; RUN: opt -data-layout=A5 -S -mtriple=amdgcn-unknown-unknown -mcpu=tahiti -amdgpu-promote-alloca < %s | FileCheck %s
+
+; Only one of the allocas fits into the local memory left over by
+; @global_array. The alloca accessed in the loop is promoted even though it
+; comes after the other one.
+
+@global_array = internal unnamed_addr addrspace(3) global [6000 x i32] undef, align 4
+@callee_array = internal unnamed_addr addrspace(3) global [15500 x i32] undef, align 4
+
+; CHECK-NOT: @hot_alloca_promoted_first.cold
+; CHECK: @hot_alloca_promoted_first.hot = internal unnamed_addr addrspace(3) global [64 x [18 x i32]] undef, align 4
+; CHECK-NOT: @hot_alloca_promoted_first.cold
+; CHECK-NOT: @callee_lds_is_counted.stack
+
+; CHECK-LABEL: @hot_alloca_promoted_first(
+; CHECK: %cold = alloca [20 x i32], align 4, addrspace(5)
+; CHECK-NOT: %hot = alloca
+; CHECK: getelementptr inbounds [64 x [18 x i32]], [64 x [18 x i32]] addrspace(3)* @hot_alloca_promoted_first.hot
+define amdgpu_kernel void @hot_alloca_promoted_first(i32 addrspace(1)* nocapture %out, i32 %idx, i32 %n) #0 {
+entry:
+  %cold = alloca [20 x i32], align 4, addrspace(5)
+  %hot = alloca [18 x i32], align 4, addrspace(5)
+  %cold.gep = getelementptr inbounds [20 x i32], [20 x i32] addrspace(5)* %cold, i32 0, i32 %idx
+  store i32 1, i32 addrspace(5)* %cold.gep, align 4
+  %lds = getelementptr inbounds [6000 x i32], [6000 x i32] addrspace(3)* @global_array, i32 0, i32 %idx
+  store i32 2, i32 addrspace(3)* %lds, align 4
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %hot.gep = getelementptr inbounds [18 x i32], [18 x i32] addrspace(5)* %hot, i32 0, i32 %i
+  %val = load i32, i32 addrspace(5)* %hot.gep, align 4
+  %inc = add i32 %val, 1
+  store i32 %inc, i32 addrspace(5)* %hot.gep, align 4
+  %i.next = add i32 %i, 1
+  %cond = icmp ult i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  %cold.load = load i32, i32 addrspace(5)* %cold.gep, align 4
+  store i32 %cold.load, i32 addrspace(1)* %out, align 4
+  ret void
+}
+
+define void @use_callee_array(i32 %idx) {
+  %gep = getelementptr inbounds [15500 x i32], [15500 x i32] addrspace(3)* @callee_array, i32 0, i32 %idx
+  store i32 0, i32 addrspace(3)* %gep, align 4
+  ret void
+}
+
+; Local memory used by a callee is allocated along with the kernel's, so
+; there is no room left for the alloca.
+
+; CHECK-LABEL: @callee_lds_is_counted(
+; CHECK: %stack = alloca [20 x i32], align 4, addrspace(5)
+define amdgpu_kernel void @callee_lds_is_counted(i32 addrspace(1)* nocapture %out, i32 %idx) #0 {
+entry:
+  %stack = alloca [20 x i32], align 4, addrspace(5)
+  %gep = getelementptr inbounds [20 x i32], [20 x i32] addrspace(5)* %stack, i32 0, i32 %idx
+  store i32 1, i32 addrspace(5)* %gep, align 4
+  call void @use_callee_array(i32 %idx)
+  %load = load i32, i32 addrspace(5)* %gep, align 4
+  store i32 %load, i32 addrspace(1)* %out, align 4
+  ret void
+}
+
+attributes #0 = { nounwind "amdgpu-flat-work-group-size"="64,64" }
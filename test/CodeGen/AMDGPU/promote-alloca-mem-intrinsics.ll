@@ -2,9 +2,11 @@
 
 declare void @llvm.memcpy.p0i8.p1i8.i32(i8* nocapture, i8 addrspace(1)* nocapture, i32, i1) #0
 declare void @llvm.memcpy.p1i8.p0i8.i32(i8 addrspace(1)* nocapture, i8* nocapture, i32, i1) #0
+declare void @llvm.memcpy.p0i8.p0i8.i32(i8* nocapture, i8* nocapture, i32, i1) #0
 
 declare void @llvm.memmove.p0i8.p1i8.i32(i8* nocapture, i8 addrspace(1)* nocapture, i32, i1) #0
 declare void @llvm.memmove.p1i8.p0i8.i32(i8 addrspace(1)* nocapture, i8* nocapture, i32, i1) #0
+declare void @llvm.memmove.p0i8.p0i8.i32(i8* nocapture, i8* nocapture, i32, i1) #0
 
 declare void @llvm.memset.p0i8.i32(i8* nocapture, i8, i32, i1) #0
 
@@ -38,6 +40,41 @@ define amdgpu_kernel void @promote_with_memmove(i32 addrspace(1)* %out, i32 addr
   ret void
 }
 
+; The memcpy is a use of both allocas, and is replaced when the first one is
+; promoted.
+
+; CHECK-LABEL: @promote_with_memcpy_between_allocas(
+; CHECK: getelementptr inbounds [4 x [17 x i32]], [4 x [17 x i32]] addrspace(3)* @promote_with_memcpy_between_allocas.a, i32 0, i32 %{{[0-9]+}}
+; CHECK: getelementptr inbounds [4 x [17 x i32]], [4 x [17 x i32]] addrspace(3)* @promote_with_memcpy_between_allocas.b, i32 0, i32 %{{[0-9]+}}
+; CHECK: call void @llvm.memcpy.p3i8.p3i8.i32(i8 addrspace(3)* align 4 %b.bc, i8 addrspace(3)* align 4 %a.bc, i32 68, i1 false)
+; CHECK-NOT: call void @llvm.memcpy
+define amdgpu_kernel void @promote_with_memcpy_between_allocas(i32 addrspace(1)* %out, i32 %idx) #2 {
+  %a = alloca [17 x i32], align 4
+  %b = alloca [17 x i32], align 4
+  %a.bc = bitcast [17 x i32]* %a to i8*
+  %b.bc = bitcast [17 x i32]* %b to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* align 4 %b.bc, i8* align 4 %a.bc, i32 68, i1 false)
+  %gep = getelementptr inbounds [17 x i32], [17 x i32]* %b, i32 0, i32 %idx
+  %load = load i32, i32* %gep
+  store i32 %load, i32 addrspace(1)* %out
+  ret void
+}
+
+; CHECK-LABEL: @promote_with_memmove_between_allocas(
+; CHECK: call void @llvm.memmove.p3i8.p3i8.i32(i8 addrspace(3)* align 4 %b.bc, i8 addrspace(3)* align 4 %a.bc, i32 68, i1 false)
+; CHECK-NOT: call void @llvm.memmove
+define amdgpu_kernel void @promote_with_memmove_between_allocas(i32 addrspace(1)* %out, i32 %idx) #2 {
+  %a = alloca [17 x i32], align 4
+  %b = alloca [17 x i32], align 4
+  %a.bc = bitcast [17 x i32]* %a to i8*
+  %b.bc = bitcast [17 x i32]* %b to i8*
+  call void @llvm.memmove.p0i8.p0i8.i32(i8* align 4 %b.bc, i8* align 4 %a.bc, i32 68, i1 false)
+  %gep = getelementptr inbounds [17 x i32], [17 x i32]* %b, i32 0, i32 %idx
+  %load = load i32, i32* %gep
+  store i32 %load, i32 addrspace(1)* %out
+  ret void
+}
+
 ; CHECK-LABEL: @promote_with_memset(
 ; CHECK: getelementptr inbounds [64 x [17 x i32]], [64 x [17 x i32]] addrspace(3)* @promote_with_memset.alloca, i32 0, i32 %{{[0-9]+}}
 ; CHECK: call void @llvm.memset.p3i8.i32(i8 addrspace(3)* align 4 %alloca.bc, i8 7, i32 68, i1 false)
@@ -63,3 +100,4 @@ define amdgpu_kernel void @promote_with_objectsize(i32 addrspace(1)* %out) #0 {
 
 attributes #0 = { nounwind "amdgpu-flat-work-group-size"="64,64" "amdgpu-waves-per-eu"="1,3" }
 attributes #1 = { nounwind readnone }
+attributes #2 = { nounwind "amdgpu-flat-work-group-size"="4,4" }
@@ -0,0 +1,57 @@
+; RUN: opt -S -mtriple=amdgcn-amd-amdhsa -amdgpu-promote-pointer-args -infer-address-spaces -o - %s | FileCheck %s
+
+target datalayout = "A5"
+
+; All callers pass a global pointer, promote the internal callee in place.
+; CHECK-LABEL: define internal void @internal_callee(
+; CHECK: load i32, i32 addrspace(1)*
+; CHECK: store i32 %{{.*}}, i32 addrspace(1)*
+define internal void @internal_callee(i32* %out, i32* %in) {
+  %v = load i32, i32* %in
+  store i32 %v, i32* %out
+  ret void
+}
+
+; Externally visible callee, use an internal clone for the global call site.
+; CHECK-LABEL: define void @external_callee(
+; CHECK: load i32, i32* %in
+define void @external_callee(i32* %out, i32* %in) {
+  %v = load i32, i32* %in
+  store i32 %v, i32* %out
+  ret void
+}
+
+; Only the first argument is global at every call site.
+; CHECK-LABEL: define internal void @mixed_callee(
+; CHECK: load i32, i32* %in
+; CHECK: store i32 %{{.*}}, i32 addrspace(1)*
+define internal void @mixed_callee(i32* %out, i32* %in) {
+  %v = load i32, i32* %in
+  store i32 %v, i32* %out
+  ret void
+}
+
+; CHECK-LABEL: define amdgpu_kernel void @kernel(
+; CHECK: call void @internal_callee(
+; CHECK: call void @external_callee.global(
+; CHECK: call void @mixed_callee.global(
+; CHECK: call void @mixed_callee(
+define amdgpu_kernel void @kernel(i32* %out, i32* %in, i32 %idx) {
+  %gep = getelementptr i32, i32* %in, i32 %idx
+  call void @internal_callee(i32* %out, i32* %gep)
+  call void @external_callee(i32* %out, i32* %in)
+  call void @mixed_callee(i32* %out, i32* %in)
+  %private = alloca i32, addrspace(5)
+  %flat = addrspacecast i32 addrspace(5)* %private to i32*
+  call void @mixed_callee(i32* %out, i32* %flat)
+  ret void
+}
+
+; The clones of the two call sites which pass only global pointers.
+; CHECK-LABEL: define internal void @mixed_callee.global(
+; CHECK: load i32, i32 addrspace(1)*
+; CHECK: store i32 %{{.*}}, i32 addrspace(1)*
+
+; CHECK-LABEL: define internal void @external_callee.global(
+; CHECK: load i32, i32 addrspace(1)*
+; CHECK: store i32 %{{.*}}, i32 addrspace(1)*
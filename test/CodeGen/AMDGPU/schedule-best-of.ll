@@ -0,0 +1,31 @@
+; RUN: llc -march=amdgcn -mcpu=fiji -misched=gcn-best-of -verify-machineinstrs -stats -o /dev/null < %s 2>&1 | FileCheck -check-prefix=SEARCH %s
+; RUN: llc -march=amdgcn -mcpu=fiji -misched=gcn-best-of -amdgpu-sched-search-budget=0 -verify-machineinstrs -stats -o /dev/null < %s 2>&1 | FileCheck -check-prefix=NOSEARCH %s
+; REQUIRES: asserts
+
+; SEARCH-NOT: without search due to the budget
+; SEARCH: machine-scheduler - Number of regions scheduled by strategy search
+
+; NOSEARCH: machine-scheduler - Number of regions keeping the legacy schedule
+; NOSEARCH: machine-scheduler - Number of regions scheduled without search due to the budget
+; NOSEARCH-NOT: scheduled by strategy search
+define amdgpu_kernel void @best_of(float addrspace(1)* %out, float addrspace(1)* %in) {
+  %tid = call i32 @llvm.amdgcn.workitem.id.x()
+  %gep0 = getelementptr float, float addrspace(1)* %in, i32 %tid
+  %gep1 = getelementptr float, float addrspace(1)* %gep0, i32 64
+  %gep2 = getelementptr float, float addrspace(1)* %gep0, i32 128
+  %gep3 = getelementptr float, float addrspace(1)* %gep0, i32 192
+  %a = load volatile float, float addrspace(1)* %gep0
+  %b = load volatile float, float addrspace(1)* %gep1
+  %c = load volatile float, float addrspace(1)* %gep2
+  %d = load volatile float, float addrspace(1)* %gep3
+  %mul0 = fmul float %a, %b
+  %mul1 = fmul float %c, %d
+  %add0 = fadd float %mul0, %mul1
+  %mul2 = fmul float %add0, %a
+  %add1 = fadd float %mul2, %d
+  %out.gep = getelementptr float, float addrspace(1)* %out, i32 %tid
+  store float %add1, float addrspace(1)* %out.gep
+  ret void
+}
+
+declare i32 @llvm.amdgcn.workitem.id.x()
@@ -0,0 +1,87 @@
+; RUN: opt -S -O1 -mtriple=amdgcn-- -mcpu=gfx900 -amdgpu-simplify-libcall -amdgpu-prelink < %s | FileCheck -enable-var-scope -check-prefix=GCN -check-prefix=PACK %s
+; RUN: opt -S -O1 -mtriple=amdgcn-- -mcpu=fiji -amdgpu-simplify-libcall -amdgpu-prelink < %s | FileCheck -enable-var-scope -check-prefix=GCN -check-prefix=NOPACK %s
+; RUN: opt -S -O1 -mtriple=amdgcn-- -mcpu=gfx900 -amdgpu-simplify-libcall -amdgpu-prelink -amdgpu-pack-libcalls=0 < %s | FileCheck -enable-var-scope -check-prefix=GCN -check-prefix=NOPACK %s
+
+; Independent half precision calls of the same function are combined into a
+; call of the packed variant on targets with packed instructions.
+
+; GCN-LABEL: {{^}}define amdgpu_kernel void @test_pack_sin
+; PACK: [[CALL:%.*]] = tail call <2 x half> @_Z3sinDv2_Dh(<2 x half> {{%.*}})
+; PACK: extractelement <2 x half> [[CALL]], i64 0
+; PACK: extractelement <2 x half> [[CALL]], i64 1
+; PACK-NOT: @_Z3sinDh
+; NOPACK: tail call half @_Z3sinDh(
+; NOPACK: tail call half @_Z3sinDh(
+define amdgpu_kernel void @test_pack_sin(half addrspace(1)* nocapture %a) {
+entry:
+  %arrayidx = getelementptr inbounds half, half addrspace(1)* %a, i64 1
+  %x = load half, half addrspace(1)* %a, align 2
+  %y = load half, half addrspace(1)* %arrayidx, align 2
+  %call0 = call half @_Z3sinDh(half %x)
+  %call1 = call half @_Z3sinDh(half %y)
+  store half %call0, half addrspace(1)* %a, align 2
+  store half %call1, half addrspace(1)* %arrayidx, align 2
+  ret void
+}
+
+declare half @_Z3sinDh(half)
+
+; GCN-LABEL: {{^}}define amdgpu_kernel void @test_pack_pow
+; PACK: tail call <2 x half> @_Z3powDv2_DhS_(<2 x half> {{%.*}}, <2 x half> {{%.*}})
+; NOPACK: tail call half @_Z3powDhDh(
+; NOPACK: tail call half @_Z3powDhDh(
+define amdgpu_kernel void @test_pack_pow(half addrspace(1)* nocapture %a) {
+entry:
+  %arrayidx1 = getelementptr inbounds half, half addrspace(1)* %a, i64 1
+  %arrayidx2 = getelementptr inbounds half, half addrspace(1)* %a, i64 2
+  %arrayidx3 = getelementptr inbounds half, half addrspace(1)* %a, i64 3
+  %x0 = load half, half addrspace(1)* %a, align 2
+  %y0 = load half, half addrspace(1)* %arrayidx1, align 2
+  %x1 = load half, half addrspace(1)* %arrayidx2, align 2
+  %y1 = load half, half addrspace(1)* %arrayidx3, align 2
+  %call0 = call half @_Z3powDhDh(half %x0, half %y0)
+  %call1 = call half @_Z3powDhDh(half %x1, half %y1)
+  store half %call0, half addrspace(1)* %a, align 2
+  store half %call1, half addrspace(1)* %arrayidx1, align 2
+  ret void
+}
+
+declare half @_Z3powDhDh(half, half)
+
+; The second call depends on the first one.
+
+; GCN-LABEL: {{^}}define amdgpu_kernel void @test_no_pack_dependent
+; GCN-NOT: <2 x half>
+; GCN: tail call half @_Z3expDh(
+; GCN: tail call half @_Z3expDh(
+define amdgpu_kernel void @test_no_pack_dependent(half addrspace(1)* nocapture %a) {
+entry:
+  %x = load half, half addrspace(1)* %a, align 2
+  %call0 = call half @_Z3expDh(half %x)
+  %add = fadd half %call0, %x
+  %call1 = call half @_Z3expDh(half %add)
+  store half %call1, half addrspace(1)* %a, align 2
+  ret void
+}
+
+declare half @_Z3expDh(half)
+
+; Single precision calls are left alone.
+
+; GCN-LABEL: {{^}}define amdgpu_kernel void @test_no_pack_float
+; GCN-NOT: <2 x float>
+; GCN: tail call float @_Z3expf(
+; GCN: tail call float @_Z3expf(
+define amdgpu_kernel void @test_no_pack_float(float addrspace(1)* nocapture %a) {
+entry:
+  %arrayidx = getelementptr inbounds float, float addrspace(1)* %a, i64 1
+  %x = load float, float addrspace(1)* %a, align 4
+  %y = load float, float addrspace(1)* %arrayidx, align 4
+  %call0 = call float @_Z3expf(float %x)
+  %call1 = call float @_Z3expf(float %y)
+  store float %call0, float addrspace(1)* %a, align 4
+  store float %call1, float addrspace(1)* %arrayidx, align 4
+  ret void
+}
+
+declare float @_Z3expf(float)
@@ -0,0 +1,94 @@
+; RUN: llc -mtriple=amdgcn-amd-amdhsa -mcpu=gfx900 -verify-machineinstrs < %s | FileCheck -enable-var-scope -check-prefix=GCN %s
+; RUN: llc -mtriple=amdgcn-amd-amdhsa -mcpu=gfx900 -amdgpu-waitcnt-stats -o /dev/null < %s 2>&1 | FileCheck -check-prefix=STATS %s
+
+; A kernel without LDS cannot reach LDS through a flat address, so its flat
+; loads complete in order like global loads, and a loop carried value loaded
+; two iterations ago only needs the loads issued after it to be outstanding.
+
+; GCN-LABEL: {{^}}stream:
+; GCN: BB0_1:
+; GCN: flat_load_dword
+; GCN: s_waitcnt vmcnt(2) lgkmcnt(2){{$}}
+; GCN-NEXT: v_add_f32
+; GCN: s_waitcnt vmcnt(1) lgkmcnt(1){{$}}
+; GCN: s_cbranch_scc1 BB0_1
+
+; STATS: remark: {{.*}}7 counter waits, 4 with a nonzero count, 4 relaxed from zero because flat operations cannot access LDS
+define amdgpu_kernel void @stream(float* %in, float* %out, i32 %n) {
+entry:
+  %a0 = load volatile float, float* %in
+  %p1 = getelementptr float, float* %in, i32 1
+  %a1 = load volatile float, float* %p1
+  br label %loop
+
+loop:
+  %i = phi i32 [ 2, %entry ], [ %i.next, %loop ]
+  %x0 = phi float [ %a0, %entry ], [ %x1, %loop ]
+  %x1 = phi float [ %a1, %entry ], [ %x2, %loop ]
+  %acc = phi float [ 0.0, %entry ], [ %acc.next, %loop ]
+  %p = getelementptr float, float* %in, i32 %i
+  %x2 = load volatile float, float* %p
+  %acc.next = fadd float %acc, %x0
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  store float %acc.next, float* %out
+  ret void
+}
+
+; With LDS in the kernel, a flat load may access it and complete out of order
+; with the others, so every wait on a flat load is a wait for all of them.
+
+; GCN-LABEL: {{^}}stream_lds:
+; GCN: BB1_1:
+; GCN: flat_load_dword
+; GCN: s_waitcnt vmcnt(0) lgkmcnt(0)
+; GCN-NEXT: v_add_f32
+; GCN: s_cbranch_scc1 BB1_1
+
+; STATS: remark: {{.*}} 0 relaxed from zero because flat operations cannot access LDS
+@lds = internal addrspace(3) global float undef, align 4
+
+define amdgpu_kernel void @stream_lds(float* %in, float* %out, i32 %n) {
+entry:
+  %a0 = load volatile float, float* %in
+  %p1 = getelementptr float, float* %in, i32 1
+  %a1 = load volatile float, float* %p1
+  br label %loop
+
+loop:
+  %i = phi i32 [ 2, %entry ], [ %i.next, %loop ]
+  %x0 = phi float [ %a0, %entry ], [ %x1, %loop ]
+  %x1 = phi float [ %a1, %entry ], [ %x2, %loop ]
+  %acc = phi float [ 0.0, %entry ], [ %acc.next, %loop ]
+  %p = getelementptr float, float* %in, i32 %i
+  %x2 = load volatile float, float* %p
+  %acc.next = fadd float %acc, %x0
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  store float %acc.next, float* %out
+  store float %acc.next, float addrspace(3)* @lds
+  ret void
+}
+
+; An LDS pointer argument may be LDS as well, even without LDS variables.
+
+; GCN-LABEL: {{^}}lds_arg:
+; GCN: flat_load_dword
+; GCN: flat_load_dword
+; GCN: s_waitcnt vmcnt(0) lgkmcnt(0)
+; GCN-NEXT: flat_store_dword
+; GCN-NEXT: flat_store_dword
+define amdgpu_kernel void @lds_arg(float* %in, float* %out, float addrspace(3)* %lds) {
+  %a0 = load volatile float, float* %in
+  %p1 = getelementptr float, float* %in, i32 1
+  %a1 = load volatile float, float* %p1
+  store volatile float %a0, float* %out
+  store volatile float %a1, float* %out
+  ret void
+}
@@ -0,0 +1,34 @@
+; REQUIRES: asserts
+; RUN: opt -module-summary %s -o %t1.bc
+; RUN: opt -module-summary %p/Inputs/lazy-summary-edges.ll -o %t2.bc
+
+; The edges of the function summaries are only decoded when the thin link
+; visits them, which it does not for the dead @dead and @dead2.
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.o -stats \
+; RUN:   -r %t1.bc,live,px -r %t1.bc,dead,p -r %t1.bc,callee, -r %t1.bc,g,p \
+; RUN:   -r %t2.bc,callee,p -r %t2.bc,dead2,p 2>&1 | FileCheck %s
+; CHECK: 2 bitcode-reader - Number of function summaries whose encoded edges were decoded
+; CHECK: 4 bitcode-reader - Number of function summaries read with their edges encoded
+
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.o -stats -lazy-summary-edges=false \
+; RUN:   -r %t1.bc,live,px -r %t1.bc,dead,p -r %t1.bc,callee, -r %t1.bc,g,p \
+; RUN:   -r %t2.bc,callee,p -r %t2.bc,dead2,p 2>&1 | FileCheck %s -check-prefix=EAGER
+; EAGER-NOT: encoded edges
+
+target datalayout = "e-p:64:64-p1:64:64-p2:32:32-p3:32:32-p4:64:64-p5:32:32-p6:32:32-i64:64-v16:16-v24:32-v32:32-v48:64-v96:128-v192:256-v256:256-v512:512-v1024:1024-v2048:2048-n32:64-S32-A5-ni:7"
+target triple = "amdgcn-amd-amdhsa"
+
+@g = global i32 0
+
+define void @live() {
+  call void @callee()
+  ret void
+}
+
+define void @dead() {
+  call void @callee()
+  store i32 1, i32* @g
+  ret void
+}
+
+declare void @callee()
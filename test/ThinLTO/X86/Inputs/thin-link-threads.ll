@@ -0,0 +1,18 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@gv = global i32 0
+
+define void @foo() {
+  call void @leaf()
+  ret void
+}
+
+define void @leaf() {
+  store i32 1, i32* @gv
+  ret void
+}
+
+define void @bar() {
+  ret void
+}
@@ -0,0 +1,17 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @big(i32 %a, i32 %b) {
+entry:
+  %0 = add i32 %a, %b
+  %1 = mul i32 %0, %a
+  %2 = sub i32 %1, %b
+  %3 = xor i32 %2, %0
+  %4 = shl i32 %3, 3
+  %5 = or i32 %4, %1
+  %6 = and i32 %5, %2
+  %7 = add i32 %6, %3
+  %8 = mul i32 %7, %4
+  %9 = sub i32 %8, %5
+  ret i32 %9
+}
@@ -0,0 +1,29 @@
+; REQUIRES: zlib
+; Check that compressed cache entries are read back as the objects that were
+; written, both from disk and from the in-memory tier.
+
+; RUN: rm -rf %t.cache
+; RUN: opt -module-hash -module-summary %s -o %t.bc
+
+; RUN: llvm-lto2 run -o %t.o %t.bc -cache-dir %t.cache -cache-compress \
+; RUN:   -r=%t.bc,globalfunc,plx
+; RUN: ls %t.cache | count 1
+; RUN: not cmp %t.o.1 %t.cache/llvmcache-*
+
+; RUN: rm -f %t2.o.1
+; RUN: llvm-lto2 run -o %t2.o %t.bc -cache-dir %t.cache \
+; RUN:   -r=%t.bc,globalfunc,plx
+; RUN: cmp %t.o.1 %t2.o.1
+
+; RUN: rm -f %t2.o.1
+; RUN: llvm-lto2 run -o %t2.o %t.bc -cache-dir %t.cache -cache-compress \
+; RUN:   -cache-memory-size=1000000 -r=%t.bc,globalfunc,plx
+; RUN: cmp %t.o.1 %t2.o.1
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @globalfunc() {
+entry:
+  ret void
+}
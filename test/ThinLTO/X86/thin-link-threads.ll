@@ -0,0 +1,52 @@
+; RUN: opt -module-summary %s -o %t1.bc
+; RUN: opt -module-summary %p/Inputs/thin-link-threads.ll -o %t2.bc
+
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.serial -save-temps \
+; RUN:     -thinlto-distributed-indexes \
+; RUN:     -r=%t1.bc,main,px \
+; RUN:     -r=%t1.bc,dead,p \
+; RUN:     -r=%t1.bc,foo, \
+; RUN:     -r=%t1.bc,bar, \
+; RUN:     -r=%t2.bc,foo,p \
+; RUN:     -r=%t2.bc,leaf,p \
+; RUN:     -r=%t2.bc,bar,p \
+; RUN:     -r=%t2.bc,gv,p
+; RUN: mv %t1.bc.thinlto.bc %t1.serial.thinlto.bc
+; RUN: mv %t2.bc.thinlto.bc %t2.serial.thinlto.bc
+; RUN: mv %t1.bc.imports %t1.serial.imports
+
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.threads -save-temps \
+; RUN:     -thinlto-distributed-indexes -thin-link-threads=4 \
+; RUN:     -r=%t1.bc,main,px \
+; RUN:     -r=%t1.bc,dead,p \
+; RUN:     -r=%t1.bc,foo, \
+; RUN:     -r=%t1.bc,bar, \
+; RUN:     -r=%t2.bc,foo,p \
+; RUN:     -r=%t2.bc,leaf,p \
+; RUN:     -r=%t2.bc,bar,p \
+; RUN:     -r=%t2.bc,gv,p
+
+; Computing the imports and the dead symbols on threads gives the same
+; combined index, import lists and export lists.
+; RUN: cmp %t.serial.index.bc %t.threads.index.bc
+; RUN: cmp %t1.serial.thinlto.bc %t1.bc.thinlto.bc
+; RUN: cmp %t2.serial.thinlto.bc %t2.bc.thinlto.bc
+; RUN: cmp %t1.serial.imports %t1.bc.imports
+; RUN: FileCheck %s --check-prefix=IMPORTS < %t1.bc.imports
+; IMPORTS: thin-link-threads.ll.tmp2.bc
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare void @foo()
+declare void @bar()
+
+define void @main() {
+  call void @foo()
+  ret void
+}
+
+define void @dead() {
+  call void @bar()
+  ret void
+}
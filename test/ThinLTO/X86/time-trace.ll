@@ -0,0 +1,27 @@
+; Check that the in-process backends start with the largest module, that each
+; module keeps the task of its position on the command line, and that every
+; backend shows up in the time trace.
+
+; RUN: opt -module-summary %s -o %t1.bc
+; RUN: opt -module-summary %p/Inputs/time-trace.ll -o %t2.bc
+; RUN: rm -f %t.o.1 %t.o.2
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.o -thinlto-threads=1 \
+; RUN:   -time-trace -time-trace-granularity=0 -time-trace-file=%t.json \
+; RUN:   -r=%t1.bc,small,px -r=%t2.bc,big,px
+; RUN: llvm-nm %t.o.1 | FileCheck %s --check-prefix=TASK1
+; RUN: llvm-nm %t.o.2 | FileCheck %s --check-prefix=TASK2
+; RUN: FileCheck %s --input-file=%t.json
+
+; TASK1: T small
+; TASK2: T big
+
+; CHECK: "name":"ThinLTO backend","args":{"detail":"{{.*}}2.bc"}
+; CHECK: "name":"ThinLTO backend","args":{"detail":"{{.*}}1.bc"}
+; CHECK: "name":"Total ThinLTO backend","args":{"count":2,
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @small(i32 %a) {
+  ret i32 %a
+}
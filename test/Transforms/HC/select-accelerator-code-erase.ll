@@ -0,0 +1,48 @@
+; RUN: opt -load %llvmshlibdir/LLVMSelectAcceleratorCode%shlibext \
+; RUN:   -select-accelerator-code -stats -S < %s 2> %t.stats | FileCheck %s
+; RUN: FileCheck %s --check-prefix=STATS < %t.stats
+; REQUIRES: plugins, asserts
+
+; Code that is not reachable from a kernel is deleted, and so is every global
+; value that is only kept alive by it. @dead_alias refers to @dead_table, which
+; refers to @dead_fn, so erasing one of them makes the next one dead.
+
+@used_gv = global i32 0
+@dead_table = global void ()* @dead_fn
+@dead_alias = alias void ()*, void ()** @dead_table
+
+; CHECK: @used_gv = global i32 0
+; CHECK-NOT: @dead_table
+; CHECK-NOT: @dead_alias
+; CHECK-NOT: @dead_fn
+; CHECK-NOT: @unused_decl
+; CHECK: define void @used_fn()
+; CHECK: declare void @used_decl()
+; CHECK: define amdgpu_kernel void @kernel()
+
+; STATS-DAG: {{^ *}}1 hc-select - Number of dead aliases erased
+; STATS-DAG: {{^ *}}2 hc-select - Number of dead function declarations erased
+; STATS-DAG: {{^ *}}1 hc-select - Number of dead global variables erased
+; STATS-DAG: {{^ *}}1 hc-select - Number of kernels used as reachability roots
+; STATS-DAG: {{^ *}}1 hc-select - Number of non-accelerator bodies deleted
+; STATS-DAG: {{^ *}}3 hc-select - Number of functions reachable from kernels
+
+define void @dead_fn() {
+  store i32 1, i32* @used_gv
+  ret void
+}
+
+declare void @unused_decl()
+
+define void @used_fn() {
+  store i32 2, i32* @used_gv
+  ret void
+}
+
+declare void @used_decl()
+
+define amdgpu_kernel void @kernel() {
+  call void @used_fn()
+  call void @used_decl()
+  ret void
+}
@@ -0,0 +1,67 @@
+; RUN: opt -load %llvmshlibdir/LLVMSelectAcceleratorCode%shlibext \
+; RUN:   -select-accelerator-code -S < %s | FileCheck %s
+; REQUIRES: plugins
+
+; Functions reached from a kernel through invokes, bitcast callees, function
+; pointers stored in global initializers and blockaddress keep their bodies.
+; Everything else loses its body and is erased once it is no longer used.
+
+@dispatch = internal constant [1 x void ()*] [void ()* @from_table]
+
+; CHECK-NOT: @unreachable
+; CHECK: @dispatch = internal constant [1 x void ()*] [void ()* @from_table]
+; CHECK: define void @invoked()
+; CHECK: define void @bitcast_callee()
+; CHECK: define void @from_table()
+; CHECK: define void @with_label()
+; CHECK: define i32 @personality(...)
+; CHECK-NOT: @unreachable
+; CHECK: define amdgpu_kernel void @kernel()
+
+define void @invoked() {
+  ret void
+}
+
+define void @bitcast_callee() {
+  ret void
+}
+
+define void @from_table() {
+  ret void
+}
+
+define void @with_label() {
+  br label %target
+
+target:
+  ret void
+}
+
+define void @takes_label(i8* %p) {
+  ret void
+}
+
+define i32 @personality(...) {
+  ret i32 0
+}
+
+define void @unreachable() {
+  ret void
+}
+
+define amdgpu_kernel void @kernel() personality i32 (...)* @personality {
+entry:
+  invoke void @invoked()
+      to label %cont unwind label %lpad
+
+cont:
+  call void bitcast (void ()* @bitcast_callee to void (i32)*)(i32 0)
+  %fp = load void ()*, void ()** getelementptr ([1 x void ()*], [1 x void ()*]* @dispatch, i64 0, i64 0)
+  call void %fp()
+  call void @takes_label(i8* blockaddress(@with_label, %target))
+  ret void
+
+lpad:
+  %lp = landingpad { i8*, i32 } cleanup
+  ret void
+}
@@ -0,0 +1,50 @@
+; REQUIRES: amdgpu-registered-target
+; RUN: llvm-split -j3 -o %t %s
+; RUN: llvm-dis -o - %t0 | FileCheck --check-prefix=CHECK0 %s
+; RUN: llvm-dis -o - %t1 | FileCheck --check-prefix=CHECK1 %s
+; RUN: llvm-dis -o - %t2 | FileCheck --check-prefix=CHECK2 %s
+
+; Local memory is allocated per kernel, so an LDS variable is kept in the same
+; partition as all kernels that use it, directly or through a callee.
+
+target triple = "amdgcn-amd-amdhsa"
+
+; CHECK0: @lds = external hidden addrspace(3) global i32
+; CHECK0: @lds2 = hidden addrspace(3) global i32 undef
+; CHECK0: define void @helper
+; CHECK0: define amdgpu_kernel void @k2
+; CHECK0-NOT: define
+
+; CHECK1: @lds = hidden addrspace(3) global i32 undef
+; CHECK1: @lds2 = external hidden addrspace(3) global i32
+; CHECK1: define amdgpu_kernel void @k0
+; CHECK1: define amdgpu_kernel void @k1
+; CHECK1-NOT: define
+
+; CHECK2-NOT: addrspace(3) global i32 undef
+; CHECK2-NOT: define
+
+@lds = internal addrspace(3) global i32 undef, align 4
+@lds2 = internal addrspace(3) global i32 undef, align 4
+
+define amdgpu_kernel void @k0(i32 addrspace(1)* %out) {
+  %v = load i32, i32 addrspace(3)* @lds
+  store i32 %v, i32 addrspace(1)* %out
+  ret void
+}
+
+define amdgpu_kernel void @k1(i32 addrspace(1)* %out) {
+  %v = load i32, i32 addrspace(3)* @lds
+  store i32 %v, i32 addrspace(1)* %out
+  ret void
+}
+
+define void @helper(i32 %x) {
+  store i32 %x, i32 addrspace(3)* @lds2
+  ret void
+}
+
+define amdgpu_kernel void @k2(i32 %x) {
+  call void @helper(i32 %x)
+  ret void
+}
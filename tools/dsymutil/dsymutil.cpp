@@ -463,6 +463,7 @@ int main(int argc, char **argv) {
   }
 
   auto &Options = *OptionsOrErr;
+  ThreadPool::setGlobalThreadCount(Options.LinkOpts.Threads);
 
   InitializeAllTargetInfos();
   InitializeAllTargetMCs();
@@ -516,7 +517,7 @@ int main(int argc, char **argv) {
 
     unsigned ThreadCount =
         std::min<unsigned>(Options.LinkOpts.Threads, DebugMapPtrsOrErr->size());
-    ThreadPool Threads(ThreadCount);
+    ThreadPool Threads(ThreadPool::getGlobal(), ThreadCount);
 
     // If there is more than one link to execute, we need to generate
     // temporary files.
@@ -157,7 +157,7 @@ json::Array renderFiles(const coverage::CoverageMapping &Coverage,
     NumThreads = std::max(1U, std::min(llvm::heavyweight_hardware_concurrency(),
                                        unsigned(SourceFiles.size())));
   }
-  ThreadPool Pool(NumThreads);
+  ThreadPool Pool(ThreadPool::getGlobal(), NumThreads);
   json::Array FileArray;
   std::mutex FileArrayMutex;
 
@@ -360,7 +360,7 @@ std::vector<FileCoverageSummary> CoverageReport::prepareFileReports(
         std::max(1U, std::min(llvm::heavyweight_hardware_concurrency(),
                               unsigned(Files.size())));
 
-  ThreadPool Pool(NumThreads);
+  ThreadPool Pool(ThreadPool::getGlobal(), NumThreads);
 
   std::vector<FileCoverageSummary> FileReports;
   FileReports.reserve(Files.size());
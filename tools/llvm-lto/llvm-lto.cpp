@@ -44,6 +44,7 @@
 #include "llvm/Support/Path.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetOptions.h"
@@ -862,6 +863,8 @@ private:
 int main(int argc, char **argv) {
   InitLLVM X(argc, argv);
   cl::ParseCommandLineOptions(argc, argv, "llvm LTO linker\n");
+  if (Parallelism.getNumOccurrences())
+    ThreadPool::setGlobalThreadCount(Parallelism);
 
   if (OptLevel < '0' || OptLevel > '3')
     error("optimization level must be between 0 and 3");
@@ -24,7 +24,9 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/Threading.h"
+#include "llvm/Support/TimeProfiler.h"
 
 using namespace llvm;
 using namespace lto;
@@ -49,6 +51,14 @@ static cl::opt<std::string> OutputFilename("o", cl::Required,
 static cl::opt<std::string> CacheDir("cache-dir", cl::desc("Cache Directory"),
                                      cl::value_desc("directory"));
 
+static cl::opt<bool> CacheCompress("cache-compress",
+                                   cl::desc("Compress the cache entries"));
+
+static cl::opt<uint64_t> CacheMemorySize(
+    "cache-memory-size",
+    cl::desc("Keep up to this many bytes of cache entries in memory"),
+    cl::init(0));
+
 static cl::opt<std::string> OptPipeline("opt-pipeline",
                                         cl::desc("Optimizer Pipeline"),
                                         cl::value_desc("pipeline"));
@@ -137,6 +147,20 @@ static cl::opt<bool>
 static cl::opt<std::string>
     StatsFile("stats-file", cl::desc("Filename to write statistics to"));
 
+static cl::opt<bool> TimeTrace("time-trace",
+                               cl::desc("Record time trace of the LTO run"));
+
+static cl::opt<unsigned> TimeTraceGranularity(
+    "time-trace-granularity",
+    cl::desc("Minimum time granularity (in microseconds) traced by time "
+             "profiler"),
+    cl::init(500));
+
+static cl::opt<std::string>
+    TimeTraceFile("time-trace-file",
+                  cl::desc("Specify time trace file destination"),
+                  cl::value_desc("filename"));
+
 static void check(Error E, std::string Msg) {
   if (!E)
     return;
@@ -171,6 +195,7 @@ static int usage() {
 
 static int run(int argc, char **argv) {
   cl::ParseCommandLineOptions(argc, argv, "Resolution-based LTO test harness");
+  ThreadPool::setGlobalThreadCount(Threads);
 
   // FIXME: Workaround PR30396 which means that a symbol can appear
   // more than once if it is defined in module-level assembly and
@@ -270,6 +295,10 @@ static int run(int argc, char **argv) {
   Conf.OverrideTriple = OverrideTriple;
   Conf.DefaultTriple = DefaultTriple;
   Conf.StatsFile = StatsFile;
+  Conf.TimeTraceEnabled = TimeTrace;
+  Conf.TimeTraceGranularity = TimeTraceGranularity;
+  if (TimeTrace)
+    timeTraceProfilerInitialize(TimeTraceGranularity);
 
   ThinBackend Backend;
   if (ThinLTODistributedIndexes)
@@ -343,10 +372,25 @@ static int run(int argc, char **argv) {
   };
 
   NativeObjectCache Cache;
-  if (!CacheDir.empty())
-    Cache = check(localCache(CacheDir, AddBuffer), "failed to create cache");
+  if (!CacheDir.empty()) {
+    LocalCacheOptions CacheOptions;
+    CacheOptions.Compress = CacheCompress;
+    CacheOptions.MemoryCacheSize = CacheMemorySize;
+    Cache = check(localCache(CacheDir, AddBuffer, CacheOptions),
+                  "failed to create cache");
+  }
 
   check(Lto.run(AddStream, Cache), "LTO::run failed");
+
+  if (TimeTrace) {
+    std::string Path =
+        TimeTraceFile.empty() ? OutputFilename + ".time-trace" : TimeTraceFile;
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+    check(EC, Path);
+    timeTraceProfilerWrite(OS);
+    timeTraceProfilerCleanup();
+  }
   return 0;
 }
 
@@ -274,6 +274,88 @@ static void loadInput(const WeightedFile &Input, SymbolRemapper *Remapper,
       WC->Errors.emplace_back(std::move(E), Filename);
 }
 
+/// Load an input into the writer contexts of a sharded merge. Each function
+/// goes to the context of the shard picked by the hash of its name, so the
+/// contexts hold disjoint sets of functions and never need to be merged.
+static void loadInputSharded(const WeightedFile &Input,
+                             SymbolRemapper *Remapper,
+                             ArrayRef<WriterContext *> Shards) {
+  // Copy the filename, because llvm::ThreadPool copied the input "const
+  // WeightedFile &" by value, making a reference to the filename within it
+  // invalid outside of this packaged task.
+  std::string Filename = Input.Filename;
+
+  // Errors about the input as a whole are kept by the first shard, which also
+  // decides whether the kind of this profile can be merged with the others.
+  WriterContext *First = Shards.front();
+  auto ReaderOrErr = InstrProfReader::create(Input.Filename);
+  if (Error E = ReaderOrErr.takeError()) {
+    // Skip the empty profiles by returning sliently.
+    instrprof_error IPE = InstrProfError::take(std::move(E));
+    if (IPE != instrprof_error::empty_raw_profile) {
+      std::unique_lock<std::mutex> CtxGuard{First->Lock};
+      First->Errors.emplace_back(make_error<InstrProfError>(IPE), Filename);
+    }
+    return;
+  }
+
+  auto Reader = std::move(ReaderOrErr.get());
+  bool IsIRProfile = Reader->isIRLevelProfile();
+  bool HasCSIRProfile = Reader->hasCSIRLevelProfile();
+  {
+    std::unique_lock<std::mutex> CtxGuard{First->Lock};
+    if (Error E =
+            First->Writer.setIsIRLevelProfile(IsIRProfile, HasCSIRProfile)) {
+      consumeError(std::move(E));
+      First->Errors.emplace_back(
+          make_error<StringError>(
+              "Merge IR generated profile with Clang generated profile.",
+              std::error_code()),
+          Filename);
+      return;
+    }
+  }
+
+  // Bucket the records by shard first, so that each shard is locked once per
+  // input rather than once per function.
+  std::vector<std::vector<NamedInstrProfRecord>> Buckets(Shards.size());
+  for (auto &I : *Reader) {
+    if (Remapper)
+      I.Name = (*Remapper)(I.Name);
+    uint64_t Shard = IndexedInstrProf::ComputeHash(I.Name) % Shards.size();
+    Buckets[Shard].push_back(std::move(I));
+  }
+
+  for (unsigned Shard = 0; Shard < Shards.size(); ++Shard) {
+    WriterContext *WC = Shards[Shard];
+    std::unique_lock<std::mutex> CtxGuard{WC->Lock};
+    // The first shard accepted this kind already, so this cannot fail.
+    cantFail(WC->Writer.setIsIRLevelProfile(IsIRProfile, HasCSIRProfile));
+    for (auto &I : Buckets[Shard]) {
+      const StringRef FuncName = I.Name;
+      bool Reported = false;
+      WC->Writer.addRecord(std::move(I), Input.Weight, [&](Error E) {
+        if (Reported) {
+          consumeError(std::move(E));
+          return;
+        }
+        Reported = true;
+        // Only show hint the first time an error occurs.
+        instrprof_error IPE = InstrProfError::take(std::move(E));
+        std::unique_lock<std::mutex> ErrGuard{WC->ErrLock};
+        bool firstTime = WC->WriterErrorCodes.insert(IPE).second;
+        handleMergeWriterError(make_error<InstrProfError>(IPE), Input.Filename,
+                               FuncName, firstTime);
+      });
+    }
+  }
+  if (Reader->hasError())
+    if (Error E = Reader->getError()) {
+      std::unique_lock<std::mutex> CtxGuard{First->Lock};
+      First->Errors.emplace_back(std::move(E), Filename);
+    }
+}
+
 /// Merge the \p Src writer context into \p Dst.
 static void mergeWriterContexts(WriterContext *Dst, WriterContext *Src) {
   for (auto &ErrorPair : Src->Errors)
@@ -293,7 +375,8 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
                               SymbolRemapper *Remapper,
                               StringRef OutputFilename,
                               ProfileFormat OutputFormat, bool OutputSparse,
-                              unsigned NumThreads, FailureMode FailMode) {
+                              unsigned NumThreads, unsigned NumShards,
+                              FailureMode FailMode) {
   if (OutputFilename.compare("-") == 0)
     exitWithError("Cannot write indexed profdata format to stdout.");
 
@@ -309,17 +392,29 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
     NumThreads =
         std::min(hardware_concurrency(), unsigned((Inputs.size() + 1) / 2));
 
-  // Initialize the writer contexts.
+  // Initialize the writer contexts. A sharded merge has one context per shard,
+  // otherwise there is one per thread.
   SmallVector<std::unique_ptr<WriterContext>, 4> Contexts;
-  for (unsigned I = 0; I < NumThreads; ++I)
+  for (unsigned I = 0, E = NumShards ? NumShards : NumThreads; I < E; ++I)
     Contexts.emplace_back(std::make_unique<WriterContext>(
         OutputSparse, ErrorLock, WriterErrorCodes));
-
-  if (NumThreads == 1) {
+  SmallVector<WriterContext *, 4> Shards;
+  if (NumShards)
+    for (std::unique_ptr<WriterContext> &WC : Contexts)
+      Shards.push_back(WC.get());
+
+  if (NumShards) {
+    // Every input is read once and spread over the shards, which only ever
+    // hold one copy of each function between them.
+    ThreadPool Pool(ThreadPool::getGlobal(), NumThreads);
+    for (const auto &Input : Inputs)
+      Pool.async(loadInputSharded, Input, Remapper, makeArrayRef(Shards));
+    Pool.wait();
+  } else if (NumThreads == 1) {
     for (const auto &Input : Inputs)
       loadInput(Input, Remapper, Contexts[0].get());
   } else {
-    ThreadPool Pool(NumThreads);
+    ThreadPool Pool(ThreadPool::getGlobal(), NumThreads);
 
     // Load the inputs in parallel (N/NumThreads serial steps).
     unsigned Ctx = 0;
@@ -368,8 +463,16 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
 
   InstrProfWriter &Writer = Contexts[0]->Writer;
   if (OutputFormat == PF_Text) {
+    // The text writer sorts all the records anyway, so gather the shards.
+    for (unsigned I = 1; I < Shards.size(); ++I)
+      mergeWriterContexts(Shards[0], Shards[I]);
     if (Error E = Writer.writeText(Output))
       exitWithError(std::move(E));
+  } else if (NumShards) {
+    SmallVector<InstrProfWriter *, 4> ShardWriters;
+    for (WriterContext *WC : Shards)
+      ShardWriters.push_back(&WC->Writer);
+    InstrProfWriter::writeShards(ShardWriters, Output);
   } else {
     Writer.write(Output);
   }
@@ -626,6 +729,11 @@ static int merge_main(int argc, const char *argv[]) {
       cl::desc("Number of merge threads to use (default: autodetect)"));
   cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
                         cl::aliasopt(NumThreads));
+  cl::opt<unsigned> NumShards(
+      "num-shards", cl::init(0),
+      cl::desc("Partition the functions by name into this many shards that "
+               "are merged independently, instead of merging whole inputs "
+               "per thread (only meaningful for -instr)"));
   cl::opt<std::string> ProfileSymbolListFile(
       "prof-sym-list", cl::init(""),
       cl::desc("Path to file containing the list of function symbols "
@@ -635,6 +743,7 @@ static int merge_main(int argc, const char *argv[]) {
       cl::desc("Compress profile symbol list before write it into profile. "));
 
   cl::ParseCommandLineOptions(argc, argv, "LLVM profile data merger\n");
+  ThreadPool::setGlobalThreadCount(NumThreads);
 
   WeightedFileVector WeightedInputs;
   for (StringRef Filename : InputFilenames)
@@ -663,7 +772,8 @@ static int merge_main(int argc, const char *argv[]) {
 
   if (ProfileKind == instr)
     mergeInstrProfile(WeightedInputs, Remapper.get(), OutputFilename,
-                      OutputFormat, OutputSparse, NumThreads, FailureMode);
+                      OutputFormat, OutputSparse, NumThreads, NumShards,
+                      FailureMode);
   else
     mergeSampleProfile(WeightedInputs, Remapper.get(), OutputFilename,
                        OutputFormat, ProfileSymbolListFile,
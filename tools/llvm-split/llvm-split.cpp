@@ -18,8 +18,11 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Utils/SplitModule.h"
 
 using namespace llvm;
@@ -42,6 +45,8 @@ static cl::opt<bool>
 int main(int argc, char **argv) {
   LLVMContext Context;
   SMDiagnostic Err;
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
   cl::ParseCommandLineOptions(argc, argv, "LLVM module splitter\n");
 
   std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Context);
@@ -51,6 +56,15 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // Let the target of the module, if it is registered, keep the globals it
+  // allocates per entry point with their users.
+  std::unique_ptr<TargetMachine> TM;
+  std::string Error;
+  if (const Target *T =
+          TargetRegistry::lookupTarget(M->getTargetTriple(), Error))
+    TM.reset(T->createTargetMachine(M->getTargetTriple(), "", "",
+                                    TargetOptions(), None));
+
   unsigned I = 0;
   SplitModule(std::move(M), NumOutputs, [&](std::unique_ptr<Module> MPart) {
     std::error_code EC;
@@ -66,7 +80,9 @@ int main(int argc, char **argv) {
 
     // Declare success.
     Out->keep();
-  }, PreserveLocals);
+  }, PreserveLocals, [&](const GlobalValue &GV) {
+    return TM && TM->isAllocatedPerEntryPoint(GV);
+  });
 
   return 0;
 }
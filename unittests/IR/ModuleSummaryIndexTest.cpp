@@ -0,0 +1,74 @@
+//===- llvm/unittest/IR/ModuleSummaryIndexTest.cpp - Summary index tests --===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/ModuleSummaryIndex.h"
+#include "llvm/Support/ThreadPool.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+
+namespace {
+
+TEST(ModuleSummaryIndexTest, IteratesInGUIDOrder) {
+  ModuleSummaryIndex Index(/*HaveGVs=*/false);
+  for (GlobalValue::GUID GUID : {5, 1, 4})
+    Index.getOrInsertValueInfo(GUID);
+
+  std::vector<GlobalValue::GUID> GUIDs;
+  for (auto &Entry : Index)
+    GUIDs.push_back(Entry.first);
+  EXPECT_EQ((std::vector<GlobalValue::GUID>{1, 4, 5}), GUIDs);
+
+  // Entries inserted after an iteration are merged into the order by the
+  // next one.
+  for (GlobalValue::GUID GUID : {3, 6, 0, 4})
+    Index.getOrInsertValueInfo(GUID);
+  GUIDs.clear();
+  for (auto &Entry : Index)
+    GUIDs.push_back(Entry.first);
+  EXPECT_EQ((std::vector<GlobalValue::GUID>{0, 1, 3, 4, 5, 6}), GUIDs);
+  EXPECT_EQ(6u, Index.size());
+}
+
+TEST(ModuleSummaryIndexTest, ValueInfosStayValid) {
+  ModuleSummaryIndex Index(/*HaveGVs=*/false);
+  ValueInfo First = Index.getOrInsertValueInfo(GlobalValue::GUID(42));
+  for (GlobalValue::GUID GUID = 100; GUID != 10000; ++GUID)
+    Index.getOrInsertValueInfo(GUID);
+
+  EXPECT_EQ(First, Index.getValueInfo(42));
+  EXPECT_EQ(First, Index.getOrInsertValueInfo(GlobalValue::GUID(42)));
+  EXPECT_EQ(42u, First.getGUID());
+  EXPECT_FALSE(Index.getValueInfo(43));
+}
+
+#if LLVM_ENABLE_THREADS
+TEST(ModuleSummaryIndexTest, ConcurrentConstIteration) {
+  ModuleSummaryIndex Index(/*HaveGVs=*/false);
+  for (GlobalValue::GUID GUID = 0; GUID != 1000; ++GUID)
+    Index.getOrInsertValueInfo(GUID * 7919 % 1000);
+
+  // The first readers find the entries unsorted and race to sort them.
+  const ModuleSummaryIndex &ConstIndex = Index;
+  std::vector<std::vector<GlobalValue::GUID>> Seen(4);
+  ThreadPool Pool(4);
+  for (auto &GUIDs : Seen)
+    Pool.async([&] {
+      for (auto &Entry : ConstIndex)
+        GUIDs.push_back(Entry.first);
+    });
+  Pool.wait();
+
+  for (auto &GUIDs : Seen) {
+    ASSERT_EQ(1000u, GUIDs.size());
+    EXPECT_TRUE(std::is_sorted(GUIDs.begin(), GUIDs.end()));
+  }
+}
+#endif
+
+} // end anonymous namespace
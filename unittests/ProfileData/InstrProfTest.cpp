@@ -1029,6 +1029,26 @@ TEST_P(MaybeSparseInstrProfTest, remapping_test) {
   }
 }
 
+TEST_P(MaybeSparseInstrProfTest, remapping_prefers_exact_name) {
+  Writer.addRecord({"_Z3fooi", 0x1234, {1, 2}}, Err);
+  Writer.addRecord({"_Z3fool", 0x5678, {3, 4, 5}}, Err);
+  auto Profile = Writer.writeBuffer();
+  readProfile(std::move(Profile), llvm::MemoryBuffer::getMemBuffer(R"(
+    type i l
+  )"));
+
+  // Both names are in the profile, so neither is remapped to the other.
+  std::vector<uint64_t> Counts;
+  EXPECT_THAT_ERROR(Reader->getFunctionCounts("_Z3fooi", 0x1234, Counts),
+                    Succeeded());
+  ASSERT_EQ(2u, Counts.size());
+  EXPECT_EQ(1u, Counts[0]);
+  EXPECT_THAT_ERROR(Reader->getFunctionCounts("_Z3fool", 0x5678, Counts),
+                    Succeeded());
+  ASSERT_EQ(3u, Counts.size());
+  EXPECT_EQ(3u, Counts[0]);
+}
+
 TEST_F(SparseInstrProfTest, preserve_no_records) {
   Writer.addRecord({"foo", 0x1234, {0}}, Err);
   Writer.addRecord({"bar", 0x4321, {0, 0}}, Err);
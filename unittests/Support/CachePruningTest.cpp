@@ -8,6 +8,11 @@
 
 #include "llvm/Support/CachePruning.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
 
 using namespace llvm;
@@ -72,6 +77,19 @@ TEST(CachePruningPolicyParser, Multiple) {
   EXPECT_EQ(50u, P->MaxSizePercentageOfAvailableSpace);
 }
 
+TEST(CachePruningPolicyParser, Index) {
+  auto P = parseCachePruningPolicy("");
+  ASSERT_TRUE(bool(P));
+  EXPECT_FALSE(P->UseIndex);
+  EXPECT_EQ(std::chrono::seconds(std::chrono::hours(24)),
+            P->IndexWalkInterval);
+  P = parseCachePruningPolicy("cache_index=1:index_walk_interval=2h");
+  ASSERT_TRUE(bool(P));
+  EXPECT_TRUE(P->UseIndex);
+  EXPECT_EQ(std::chrono::seconds(std::chrono::hours(2)),
+            P->IndexWalkInterval);
+}
+
 TEST(CachePruningPolicyParser, Errors) {
   EXPECT_EQ("Duration must not be empty",
             toString(parseCachePruningPolicy("prune_interval=").takeError()));
@@ -91,6 +109,164 @@ TEST(CachePruningPolicyParser, Errors) {
   EXPECT_EQ(
       "'foo' not an integer",
       toString(parseCachePruningPolicy("cache_size_bytes=foom").takeError()));
+  EXPECT_EQ("'yes' must be 0 or 1",
+            toString(parseCachePruningPolicy("cache_index=yes").takeError()));
   EXPECT_EQ("Unknown key: 'foo'",
             toString(parseCachePruningPolicy("foo=bar").takeError()));
 }
+
+TEST(CachePruning, Index) {
+  SmallString<128> TestDir;
+  ASSERT_FALSE(sys::fs::createUniqueDirectory("cache-pruning", TestDir));
+  auto Write = [&](StringRef Name, StringRef Contents) {
+    SmallString<128> Path(TestDir);
+    sys::path::append(Path, Name);
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+    ASSERT_FALSE(EC);
+    OS << Contents;
+  };
+  auto Exists = [&](StringRef Name) {
+    SmallString<128> Path(TestDir);
+    sys::path::append(Path, Name);
+    return sys::fs::exists(Path);
+  };
+
+  // Without an index, uses are not recorded.
+  recordCacheIndexUse(TestDir, "llvmcache-a", 1);
+  EXPECT_FALSE(Exists("llvmcache.index"));
+
+  // "llvmcache-c" is not in the index, so the pruner does not see it. The last
+  // use of "llvmcache-a" is the older one.
+  Write("llvmcache-a", "a");
+  Write("llvmcache-b", "b");
+  Write("llvmcache-c", "c");
+  Write("llvmcache.index", "300 1 llvmcache-a\n"
+                           "200 1 llvmcache-b\n"
+                           "garbage\n"
+                           "100 1 llvmcache-a\n"
+                           "400 1 llvmcache-b\n");
+  recordCacheIndexUse(TestDir, "llvmcache-a", 1);
+
+  CachePruningPolicy Policy;
+  Policy.Interval = std::chrono::seconds(0);
+  Policy.Expiration = std::chrono::seconds(0);
+  Policy.MaxSizePercentageOfAvailableSpace = 0;
+  Policy.MaxSizeFiles = 1;
+  Policy.UseIndex = true;
+  Policy.IndexWalkInterval = None;
+  EXPECT_TRUE(pruneCache(TestDir, Policy));
+  EXPECT_TRUE(Exists("llvmcache-a"));
+  EXPECT_FALSE(Exists("llvmcache-b"));
+  EXPECT_TRUE(Exists("llvmcache-c"));
+
+  // Only the entry that was kept remains in the new index.
+  SmallString<128> IndexPath(TestDir);
+  sys::path::append(IndexPath, "llvmcache.index");
+  auto MB = MemoryBuffer::getFile(IndexPath);
+  ASSERT_TRUE(bool(MB));
+  StringRef Index = (*MB)->getBuffer();
+  EXPECT_TRUE(Index.endswith(" 1 llvmcache-a\n"));
+  EXPECT_EQ(StringRef::npos, Index.find("llvmcache-b"));
+
+  ASSERT_FALSE(sys::fs::remove_directories(TestDir));
+}
+
+TEST(CachePruning, IndexWalk) {
+  SmallString<128> TestDir;
+  ASSERT_FALSE(sys::fs::createUniqueDirectory("cache-pruning", TestDir));
+  auto Write = [&](StringRef Name, StringRef Contents) {
+    SmallString<128> Path(TestDir);
+    sys::path::append(Path, Name);
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+    ASSERT_FALSE(EC);
+    OS << Contents;
+  };
+  SmallString<128> IndexPath(TestDir);
+  sys::path::append(IndexPath, "llvmcache.index");
+
+  // The walk finds "llvmcache-c", which is not in the index, and forgets
+  // "llvmcache-d", which is gone.
+  Write("llvmcache-a", "a");
+  Write("llvmcache-c", "c");
+  Write("llvmcache.index", "100 1 llvmcache-a\n"
+                           "100 1 llvmcache-d\n");
+
+  CachePruningPolicy Policy;
+  Policy.Interval = std::chrono::seconds(0);
+  Policy.Expiration = std::chrono::seconds(0);
+  Policy.MaxSizePercentageOfAvailableSpace = 0;
+  Policy.MaxSizeFiles = 10;
+  Policy.UseIndex = true;
+  Policy.IndexWalkInterval = std::chrono::seconds(0);
+  EXPECT_TRUE(pruneCache(TestDir, Policy));
+
+  auto MB = MemoryBuffer::getFile(IndexPath);
+  ASSERT_TRUE(bool(MB));
+  StringRef Index = (*MB)->getBuffer();
+  EXPECT_NE(StringRef::npos, Index.find(" 1 llvmcache-a\n"));
+  EXPECT_NE(StringRef::npos, Index.find(" 1 llvmcache-c\n"));
+  EXPECT_EQ(StringRef::npos, Index.find("llvmcache-d"));
+
+  ASSERT_FALSE(sys::fs::remove_directories(TestDir));
+}
+
+TEST(CachePruning, IndexLocked) {
+  SmallString<128> TestDir;
+  ASSERT_FALSE(sys::fs::createUniqueDirectory("cache-pruning", TestDir));
+  SmallString<128> IndexPath(TestDir);
+  sys::path::append(IndexPath, "llvmcache.index");
+
+  {
+    // While another pruner holds the lock, the index may be moved aside.
+    // Uses are still recorded, in a new index.
+    LockFileManager Lock(IndexPath);
+    ASSERT_EQ(LockFileManager::LFS_Owned, Lock.getState());
+    recordCacheIndexUse(TestDir, "llvmcache-a", 1);
+    EXPECT_TRUE(sys::fs::exists(IndexPath));
+
+    // And nobody else prunes.
+    CachePruningPolicy Policy;
+    Policy.Interval = std::chrono::seconds(0);
+    Policy.MaxSizeFiles = 1;
+    Policy.UseIndex = true;
+    EXPECT_FALSE(pruneCache(TestDir, Policy));
+  }
+
+  auto MB = MemoryBuffer::getFile(IndexPath);
+  ASSERT_TRUE(bool(MB));
+  EXPECT_TRUE((*MB)->getBuffer().endswith(" 1 llvmcache-a\n"));
+
+  ASSERT_FALSE(sys::fs::remove_directories(TestDir));
+}
+
+TEST(CachePruning, IndexCompaction) {
+  SmallString<128> TestDir;
+  ASSERT_FALSE(sys::fs::createUniqueDirectory("cache-pruning", TestDir));
+  SmallString<128> IndexPath(TestDir);
+  sys::path::append(IndexPath, "llvmcache.index");
+  {
+    std::error_code EC;
+    raw_fd_ostream OS(IndexPath, EC, sys::fs::OF_None);
+    ASSERT_FALSE(EC);
+  }
+
+  // Repeated uses of two entries do not grow the index without bound.
+  for (unsigned I = 0; I != 5000; ++I) {
+    recordCacheIndexUse(TestDir, "llvmcache-a", 1);
+    recordCacheIndexUse(TestDir, "llvmcache-b", 2);
+  }
+  uint64_t Size;
+  ASSERT_FALSE(sys::fs::file_size(IndexPath, Size));
+  EXPECT_LT(Size, 128u * 1024);
+
+  // Both entries are still there, with their latest size.
+  auto MB = MemoryBuffer::getFile(IndexPath);
+  ASSERT_TRUE(bool(MB));
+  StringRef Index = (*MB)->getBuffer();
+  EXPECT_NE(StringRef::npos, Index.find(" 1 llvmcache-a\n"));
+  EXPECT_NE(StringRef::npos, Index.find(" 2 llvmcache-b\n"));
+
+  ASSERT_FALSE(sys::fs::remove_directories(TestDir));
+}
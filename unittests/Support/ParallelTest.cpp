@@ -14,6 +14,7 @@
 #include "llvm/Support/Parallel.h"
 #include "gtest/gtest.h"
 #include <array>
+#include <atomic>
 #include <random>
 
 uint32_t array[1024 * 1024];
@@ -49,4 +50,13 @@ TEST(Parallel, parallel_for) {
   ASSERT_EQ(range[2049], 1u);
 }
 
+TEST(Parallel, nested_parallel_for) {
+  // Inner loops wait for their tasks from within tasks of the outer loop.
+  std::atomic<unsigned> count{0};
+  for_each_n(parallel::par, 0, 64, [&count](size_t) {
+    for_each_n(parallel::par, 0, 2048, [&count](size_t) { ++count; });
+  });
+  ASSERT_EQ(64u * 2048u, count.load());
+}
+
 #endif
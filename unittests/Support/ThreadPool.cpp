@@ -163,3 +163,93 @@ TEST_F(ThreadPoolTest, PoolDestruction) {
   }
   ASSERT_EQ(5, checked_in);
 }
+
+TEST_F(ThreadPoolTest, NestedAsync) {
+  CHECK_UNSUPPORTED();
+  // Test that tasks submitted from within the pool are waited for as well.
+  std::atomic_int checked_in{0};
+  ThreadPool Pool;
+  for (size_t i = 0; i < 5; ++i) {
+    Pool.async([&Pool, &checked_in] {
+      for (size_t j = 0; j < 100; ++j)
+        Pool.async([&checked_in] { ++checked_in; });
+    });
+  }
+  Pool.wait();
+  ASSERT_EQ(500, checked_in);
+}
+
+TEST_F(ThreadPoolTest, HighPriority) {
+  CHECK_UNSUPPORTED();
+  // Test that a pending high priority task starts before pending normal ones.
+  std::mutex OrderLock;
+  std::vector<int> Order;
+  auto Record = [&](int Value) {
+    std::lock_guard<std::mutex> LockGuard(OrderLock);
+    Order.push_back(Value);
+  };
+
+  ThreadPool Pool{1};
+  Pool.async([this] { waitForMainThread(); });
+  for (int i = 0; i < 3; ++i)
+    Pool.async([&Record, i] { Record(i); });
+  Pool.async(ThreadPool::Priority::High, [&Record] { Record(-1); });
+  setMainThreadReady();
+  Pool.wait();
+  ASSERT_EQ(4u, Order.size());
+  ASSERT_EQ(-1, Order.front());
+}
+
+TEST_F(ThreadPoolTest, ManyTasks) {
+  CHECK_UNSUPPORTED();
+  // Test that bursts larger than the initial deque capacity are not lost.
+  std::atomic_int checked_in{0};
+  ThreadPool Pool;
+  Pool.async([&Pool, &checked_in] {
+    for (size_t i = 0; i < 10000; ++i)
+      Pool.async([&checked_in] { ++checked_in; });
+  });
+  Pool.wait();
+  ASSERT_EQ(10000, checked_in);
+}
+
+TEST_F(ThreadPoolTest, ParentPool) {
+  CHECK_UNSUPPORTED();
+  // Test that a pool built on a parent honors its concurrency limit and only
+  // waits for its own tasks.
+  ThreadPool Parent{4};
+  ThreadPool Pool{Parent, 2};
+  std::atomic_int Running{0};
+  std::atomic_int MaxRunning{0};
+  std::atomic_int checked_in{0};
+  for (size_t i = 0; i < 20; ++i) {
+    Pool.async([&] {
+      int Now = ++Running;
+      int Max = MaxRunning;
+      while (Now > Max && !MaxRunning.compare_exchange_weak(Max, Now))
+        ;
+      std::this_thread::yield();
+      --Running;
+      ++checked_in;
+    });
+  }
+  Pool.wait();
+  ASSERT_EQ(20, checked_in);
+  ASSERT_LE(MaxRunning.load(), 2);
+}
+
+TEST_F(ThreadPoolTest, NestedParentPoolWait) {
+  CHECK_UNSUPPORTED();
+  // Test that a task of the parent can wait on a pool built on the same
+  // parent, even when the parent has a single thread.
+  ThreadPool Parent{1};
+  std::atomic_int checked_in{0};
+  Parent.async([&] {
+    ThreadPool Pool{Parent, 1};
+    for (size_t i = 0; i < 5; ++i)
+      Pool.async([&checked_in] { ++checked_in; });
+    Pool.wait();
+  });
+  Parent.wait();
+  ASSERT_EQ(5, checked_in);
+}